@@ -17,6 +17,10 @@
         'include/codius-util.h',
         'src/json.c',
         'src/jsmn.c',
+        'src/rpc.c',
+        'src/ring.c',
+        'src/image.c',
+        'src/recv.c',
         'src/codius-util.c'
       ],
       'include_dirs': [
@@ -21,27 +21,520 @@
 #define __CODIUS_UTIL_H_
 
 #include "jsmn.h"
+#include <stdint.h>
+#include <stddef.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 // 129 KB
 #define CODIUS_MAX_MESSAGE_SIZE 132096
 // 256 MB
 #define CODIUS_MAX_RESPONSE_SIZE 268435456
+// Larger response buffers are released again after use.
+#define CODIUS_RESPONSE_BUFFER_KEEP 1048576
+// Enough for a binary call with a handful of scalars and short strings.
+#define CODIUS_RPC_SMALL_MESSAGE_SIZE 256
+
+// Frame bodies are JSON strings.
+#define CODIUS_MAGIC_BYTES 0xC0D105FE
+// Frame bodies use the binary encoding below.
+#define CODIUS_MAGIC_BYTES_BINARY 0xC0D1B1FE
+// Frames pushed by the host on its own, carrying readiness events.
+#define CODIUS_MAGIC_BYTES_EVENT 0xC0D1E7FE
+// Frames pushed by the host on its own, carrying async call completions.
+#define CODIUS_MAGIC_BYTES_COMPLETION 0xC0D1C0FE
+// Leading parts of a response body that was split, see "Framed I/O".
+#define CODIUS_MAGIC_BYTES_CONTINUATION 0xC0D1CCFE
+// Frames pushed by the host on its own, carrying data received on a socket.
+#define CODIUS_MAGIC_BYTES_DATA 0xC0D1DAFE
+// The host splits response bodies into frames of at most this size.
+#define CODIUS_FRAME_CHUNK_SIZE 65536
+// Events that arrive while a call is waiting for its response.
+#define CODIUS_MAX_PENDING_EVENTS 1024
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Channel to the host.
+ *
+ * All frames to and from the host go through these, so that they work the
+ * same over the fd 3 pipe and the shared memory transport below.
+ * codius_channel_writev may modify iov. Both return 0 or -1 for error.
+ * codius_channel_poll waits up to timeout milliseconds (-1 for no limit)
+ * for data to read and returns 1, 0 on timeout, or -1 for error.
+ */
+int codius_channel_writev(struct iovec *iov, int iovcnt);
+int codius_channel_read(char *buf, size_t len);
+int codius_channel_poll(int timeout);
+
+/**
+ * Shared memory transport.
+ *
+ * If the runner passes a shared file in the CODIUS_SHM_FD environment
+ * variable, the byte stream that would go over fd 3 goes through two
+ * single-producer, single-consumer rings in it instead:
+ *
+ *   uint32 magic | uint32 ring size | padding to CODIUS_CACHE_LINE_SIZE
+ *   request ring header | request ring data    (sandbox to host)
+ *   response ring header | response ring data  (host to sandbox)
+ *
+ * Each ring header is CODIUS_RING_HEADER_SIZE bytes holding head, tail,
+ * consumer_waiting and producer_waiting, each on its own cache line as a
+ * uint32 followed by its complement. The host reaches the file with plain
+ * reads and writes, which may tear, so a field is only taken once the two
+ * agree. head and tail are free-running byte counters, written by the
+ * producer and the consumer, and the ring size is a power of two.
+ *
+ * A side that runs out of data (or space) sets its waiting flag, checks the
+ * ring once more and sleeps on fd 3. The other side writes a single byte to
+ * fd 3 after moving head (or tail) if it finds the flag set, and only the
+ * sleeper clears it again. Otherwise nothing is written to fd 3 at all. The
+ * sandbox never sleeps longer than CODIUS_RING_SLEEP_MS at a time, and kicks
+ * the host again if its requests are still waiting, so a doorbell lost to
+ * the host's unordered accesses only costs latency. The runner writes the
+ * magic last, and without it the pipe is used as before.
+ */
+#define CODIUS_SHM_MAGIC 0xC0D15A4E
+#define CODIUS_CACHE_LINE_SIZE 64
+#define CODIUS_RING_HEADER_SIZE (4 * CODIUS_CACHE_LINE_SIZE)
+// Polls of an empty ring before going to sleep on fd 3.
+#define CODIUS_RING_SPIN 1000
+#define CODIUS_RING_SLEEP_MS 50
+
+int codius_ring_active(void);
+int codius_ring_writev(const struct iovec *iov, int iovcnt);
+int codius_ring_read(char *buf, size_t len);
+int codius_ring_poll(int timeout);
+
+typedef struct codius_rpc_header_s codius_rpc_header_t;
+
+struct codius_rpc_header_s {
+  uint32_t magic_bytes;
+  uint32_t callback_id;
+  uint32_t size;
+};
+
+/**
+ * Binary RPC encoding.
+ *
+ * A request body is a method id, a value count and that many typed values,
+ * optionally followed by a raw payload that runs to the end of the frame:
+ *
+ *   uint32 method | uint32 count | value * count | payload
+ *
+ * A response body has the same shape with the method id replaced by an int32
+ * result, which is negative (-errno) on failure:
+ *
+ *   int32 result | uint32 count | value * count | payload
+ *
+ * Each value is a uint32 type tag followed by its data. All integers are
+ * little-endian. The host answers a frame in the encoding of its magic bytes,
+ * so JSON and binary calls can be mixed freely on the same channel.
+ */
+typedef enum {
+  CODIUS_RPC_INT32  = 1,  /* int32 */
+  CODIUS_RPC_DOUBLE = 2,  /* IEEE 754 double */
+  CODIUS_RPC_STRING = 3   /* uint32 length, then the bytes (no terminator) */
+} codius_rpc_type_t;
+
+#define CODIUS_RPC_METHOD(api, method) (((api) << 8) | (method))
+
+/* The descriptor opened earlier in the same batch, see CODIUS_RPC_FS_BATCH. */
+#define CODIUS_RPC_FS_BATCH_FD -2
+
+enum {
+  CODIUS_RPC_API_FS     = 1,
+  CODIUS_RPC_API_NET    = 2,
+  CODIUS_RPC_API_CRYPTO = 3,
+  CODIUS_RPC_API_LOG    = 4,
+  CODIUS_RPC_API_CACHE  = 5,
+  CODIUS_RPC_API_SANDBOX = 6
+};
+
+/* Keep in sync with METHODS in lib/binary/format.js. */
+typedef enum {
+  /* Stat calls answer with the fields of struct stat as values, in the order
+     of the fs.Stats constructor, and readdir with one string per entry. Read
+     takes (fd, length, position) and answers with the bytes read as the
+     payload and their count as the result. */
+  CODIUS_RPC_FS_OPEN                = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 1),
+  CODIUS_RPC_FS_CLOSE               = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 2),
+  CODIUS_RPC_FS_READ                = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 3),
+  CODIUS_RPC_FS_STAT                = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 4),
+  CODIUS_RPC_FS_LSTAT               = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 5),
+  CODIUS_RPC_FS_FSTAT               = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 6),
+  CODIUS_RPC_FS_READDIR             = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 7),
+  /* Takes a directory and answers with everything below it, depth first.
+     Each entry is a path relative to the directory ("" for itself), an int32
+     that is 1 if the entries of a directory follow, and its stat values. */
+  CODIUS_RPC_FS_SCAN                = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 8),
+  /* Runs open, close, read and fstat calls one after the other in a single
+     round trip. The values are the calls in order, each as its method id
+     followed by its usual arguments. CODIUS_RPC_FS_BATCH_FD as a descriptor
+     stands for the one the last open of the batch returned, and a read
+     length of -1 reads to the end of the file. The first call that fails
+     ends the batch, the files it opened are closed and the response is that
+     call's error, with the call's method id added as the last value.
+     Otherwise each call adds its result as a value, followed by
+     its values if any, and the data of all reads is the payload. */
+  CODIUS_RPC_FS_BATCH               = CODIUS_RPC_METHOD(CODIUS_RPC_API_FS, 9),
+  CODIUS_RPC_NET_SOCKET             = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 1),
+  CODIUS_RPC_NET_ACCEPT             = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 2),
+  CODIUS_RPC_NET_CLOSE              = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 3),
+  CODIUS_RPC_NET_BIND               = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 4),
+  CODIUS_RPC_NET_CONNECT            = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 5),
+  CODIUS_RPC_NET_READ               = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 6),
+  CODIUS_RPC_NET_WRITE              = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 7),
+  CODIUS_RPC_NET_GET_REMOTE_FAMILY  = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 8),
+  CODIUS_RPC_NET_GET_REMOTE_ADDRESS = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 9),
+  CODIUS_RPC_NET_GET_REMOTE_PORT    = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 10),
+  /* Payload is a codius_event_t per fd, the response payload a bitmap of the
+     entries that are ready. */
+  CODIUS_RPC_NET_POLL               = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 11),
+  /* Takes a fd and a byte count, and lets the host push that many more bytes
+     received on the socket, see "Receive rings". */
+  CODIUS_RPC_NET_CREDIT             = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 12),
+  /* Takes a fd and a count, and accepts up to that many pending connections.
+     Each adds its fd, peer family, peer port and peer address as values;
+     -EAGAIN if none is pending. */
+  CODIUS_RPC_NET_ACCEPT_BATCH       = CODIUS_RPC_METHOD(CODIUS_RPC_API_NET, 13),
+  /* Takes a file name and a flag, and writes the payload to that file in the
+     host's log directory, appending to it if the flag is set. The name must
+     end in .log and have no directory part. */
+  CODIUS_RPC_LOG_WRITE              = CODIUS_RPC_METHOD(CODIUS_RPC_API_LOG, 1),
+  /* Compiled code cache of the running contract, kept by the host under the
+     manifest hash. Get takes a module path and answers with the cache data as
+     the payload, empty if there is none. Put takes a module path and stores
+     the payload for it. Only sent by sandboxes started with --code-cache, or
+     told to use it by CODIUS_RPC_SANDBOX_LOAD. */
+  CODIUS_RPC_CACHE_GET              = CODIUS_RPC_METHOD(CODIUS_RPC_API_CACHE, 1),
+  CODIUS_RPC_CACHE_PUT              = CODIUS_RPC_METHOD(CODIUS_RPC_API_CACHE, 2),
+  /* Sent by a sandbox started with --park once it is ready to run a
+     contract. The host answers when it has one, with 1 if the contract
+     should use the code cache (0 if not), then the path of the main module
+     and its arguments as strings. */
+  CODIUS_RPC_SANDBOX_LOAD           = CODIUS_RPC_METHOD(CODIUS_RPC_API_SANDBOX, 1)
+} codius_rpc_method_t;
+
+typedef struct codius_rpc_msg_s codius_rpc_msg_t;
+typedef struct codius_rpc_reply_s codius_rpc_reply_t;
+
+/* A request being built in a caller-provided buffer. */
+struct codius_rpc_msg_s {
+  char *base;
+  size_t len;
+  size_t size;
+  uint32_t count;
+  int overflow;
+};
+
+/* A decoded response. Values are consumed in order with codius_rpc_get_*. */
+struct codius_rpc_reply_s {
+  int32_t result;
+  uint32_t count;
+  const char *pos;
+  const char *end;
+  const char *payload;
+  size_t payload_len;
+  char *buf;
+};
+
+void codius_rpc_msg_init(codius_rpc_msg_t *msg, char *buf, size_t size,
+                         codius_rpc_method_t method);
+void codius_rpc_add_int32(codius_rpc_msg_t *msg, int32_t value);
+void codius_rpc_add_double(codius_rpc_msg_t *msg, double value);
+void codius_rpc_add_string(codius_rpc_msg_t *msg, const char *str, size_t len);
+
+/**
+ * Fill in the value count once all values have been added. msg->base then
+ * holds msg->len bytes ready to send. Returns 0, or -1 if the message did not
+ * fit its buffer. The call functions below do this themselves.
+ */
+int codius_rpc_msg_finish(codius_rpc_msg_t *msg);
+
+/**
+ * Decode a binary response body into reply. Returns 0, or -1 if the body is
+ * malformed.
+ */
+int codius_rpc_reply_parse(codius_rpc_reply_t *reply, char *buf, size_t len);
+
+int codius_rpc_get_int32(codius_rpc_reply_t *reply, int32_t *value);
+int codius_rpc_get_double(codius_rpc_reply_t *reply, double *value);
+int codius_rpc_get_string(codius_rpc_reply_t *reply,
+                          const char **str, size_t *len);
+
+/* Get the next value as a double, whether it was sent as int32 or double. */
+int codius_rpc_get_number(codius_rpc_reply_t *reply, double *value);
+
+void codius_rpc_reply_free(codius_rpc_reply_t *reply);
+
+/**
+ * Make a synchronous binary call outside the sandbox. On success the caller
+ * owns reply and must release it with codius_rpc_reply_free. Its values live
+ * in the shared response buffer and are only valid until the next call.
+ * Returns 0, or -1 if the request could not be sent or the response could not
+ * be decoded.
+ */
+int codius_rpc_call(codius_rpc_msg_t *msg, codius_rpc_reply_t *reply);
+
+/**
+ * Like codius_rpc_call, but the request carries the given buffers as its
+ * payload and a response payload is placed in dst (if not NULL). The frame is
+ * sent with a single writev straight from the payload buffers, and a response
+ * that consists only of payload is read directly into dst without copying.
+ * reply->payload then points into dst.
+ */
+int codius_rpc_callv(codius_rpc_msg_t *msg,
+                     const struct iovec *payload, int payload_cnt,
+                     char *dst, size_t dst_len,
+                     codius_rpc_reply_t *reply);
+
+/**
+ * Make a binary call whose response payload the caller reads itself, so that
+ * large payloads never have to be held in full by anyone but the caller.
+ * codius_rpc_call_begin sends the call like codius_rpc_callv and reads the
+ * response up to its payload: reply then holds the result and the values,
+ * with payload NULL. codius_rpc_read_payload must then be called until it
+ * returns 0, before any other call. It reads up to len bytes of the payload
+ * into buf and returns their count, 0 at the end of the payload, or -1 for
+ * error. A buf of NULL skips len bytes instead.
+ */
+int codius_rpc_call_begin(codius_rpc_msg_t *msg,
+                          const struct iovec *payload, int payload_cnt,
+                          codius_rpc_reply_t *reply);
+ssize_t codius_rpc_read_payload(char *buf, size_t len);
+
+/**
+ * Contract image.
+ *
+ * If the runner passes a file in the CODIUS_IMAGE_FD environment variable, it
+ * is a read-only image of the contract's files, mapped on first use:
+ *
+ *   uint32 magic | uint32 version | uint32 entry count |
+ *   uint32 children offset | uint32 children count | 12 bytes reserved
+ *   codius_image_entry_t * entry count, sorted by path (bytewise)
+ *   uint32 entry index * children count, at the children offset
+ *   paths and file contents, at the offsets given by the entries
+ *
+ * The first entry is the root directory of the image, and the image is
+ * authoritative below it: a path under the root that it doesn't contain does
+ * not exist. A directory's children are entries first_child to first_child +
+ * child_count - 1 of the children table. Offsets are from the start of the
+ * image and times are in milliseconds since the epoch.
+ *
+ * codius_image_call answers open, close, read, stat, lstat, fstat and readdir
+ * calls for paths under the root, and for descriptors it handed out, without
+ * leaving the sandbox, and so are batches that start by opening such a path.
+ * It builds the response in buf (read data goes to dst if it is not NULL, as
+ * with codius_rpc_callv) and returns 1, or returns 0 if the call has to go to
+ * the host.
+ */
+#define CODIUS_IMAGE_MAGIC 0xC0D11A6E
+#define CODIUS_IMAGE_VERSION 1
+// Descriptors of files opened from the image, well above any host descriptor.
+#define CODIUS_IMAGE_FD_BASE 0x40000000
+#define CODIUS_IMAGE_MAX_FILES 256
+
+typedef struct codius_image_entry_s codius_image_entry_t;
+
+struct codius_image_entry_s {
+  uint32_t path_offset;
+  uint32_t path_len;
+  uint32_t mode;
+  uint32_t size;
+  uint32_t data_offset;
+  uint32_t first_child;
+  uint32_t child_count;
+  uint32_t reserved;
+  double mtime;
+};
+
+int codius_image_call(codius_rpc_msg_t *msg, char *buf, size_t buf_size,
+                      char *dst, size_t dst_len, codius_rpc_reply_t *reply);
+
+/**
+ * Framed I/O.
+ *
+ * codius_write_frame sends a header and the given body buffers with a single
+ * writev. codius_read_frame reads the next response, which must carry
+ * magic_bytes, in full into the shared response buffer. The buffer is reused
+ * by every call, so *buf is only valid until the next one and must not be
+ * freed. Both return 0 or -1 for error.
+ *
+ * The host may split a response body across several frames, none larger than
+ * CODIUS_FRAME_CHUNK_SIZE: all but the last carry
+ * CODIUS_MAGIC_BYTES_CONTINUATION and the last carries the magic of the
+ * response. The body is their bodies in order. Readers put it back together
+ * as they go, so a payload can be consumed a chunk at a time.
+ */
+int codius_write_frame(uint32_t magic_bytes, uint32_t callback_id,
+                       const struct iovec *body, int body_cnt);
+int codius_read_frame(uint32_t magic_bytes, char **buf, size_t *len);
+
+/**
+ * Make a synchronous JSON call outside the sandbox. Like codius_read_frame,
+ * *response_buf points into the shared response buffer. Returns
+ * response_len or -1 for error.
+ */
 int codius_sync_call(const char* request_buf, size_t request_len,
                      char **response_buf, size_t *response_len);
 
+/**
+ * Readiness events.
+ *
+ * The host pushes an event frame whenever a socket may have become readable
+ * because of data, EOF or a pending connection. The body is a list of
+ *
+ *   int32 fd | uint32 events
+ *
+ * pairs. Events are edge-triggered hints; the reader must still cope with
+ * EAGAIN. Pushed frames can arrive in front of any response, so every reader
+ * of fd 3 goes through codius_read_header, which sets them aside.
+ */
+#define CODIUS_EVENT_READABLE 1
+#define CODIUS_EVENT_WRITABLE 2
+
+typedef struct codius_event_s codius_event_t;
+
+struct codius_event_s {
+  int32_t fd;
+  uint32_t events;
+};
+
+/**
+ * Read the next response header from fd 3, queueing any pushed frames in
+ * front of it. Returns 0, or -1 on a read error.
+ */
+int codius_read_header(codius_rpc_header_t *rpc_header);
+
+/**
+ * Wait up to timeout milliseconds (-1 for no limit) for readiness events and
+ * store at most max_events of them in events. Events queued by earlier calls
+ * are returned without blocking. If events were dropped because the queue was
+ * full, a single event with fd -1 is returned, meaning any fd may be ready.
+ * Returns the number of events, or -1 with errno set.
+ */
+int codius_wait_events(codius_event_t *events, int max_events, int timeout);
+
+/**
+ * Async completions.
+ *
+ * The host pushes the responses to async calls as soon as they are ready,
+ * batching whatever completed together into one frame of
+ *
+ *   uint32 callback_id | uint32 size | response * size
+ *
+ * records. Completion frames are queued wherever they are read and announced
+ * as a readable event on fd 3.
+ */
+
+/**
+ * Take the next queued completion. buf points into the queue and stays valid
+ * until the next call. Returns 1, or 0 if there are no more completions.
+ */
+int codius_next_completion(uint32_t *callback_id,
+                           const char **buf, size_t *len);
+
+/**
+ * Receive rings.
+ *
+ * Rather than being asked for each read, the host pushes the data it receives
+ * on a socket in data frames of
+ *
+ *   int32 fd | int32 status | data
+ *
+ * where a status other than 0 ends the stream with that code (UV_EOF at the
+ * end of the data). Data frames are taken out of the channel wherever they
+ * are read, stored in the socket's ring and announced as a readable event on
+ * the socket.
+ *
+ * The host only pushes as much as the sandbox gave it credit for, at most
+ * CODIUS_RECV_WINDOW bytes ahead of the reader, so a ring never overflows and
+ * a slow reader holds the data back in the host's TCP stack. A ring's buffer
+ * starts at CODIUS_RECV_INITIAL_SIZE bytes when the first data arrives and
+ * doubles while the reader lags behind, up to the window. codius_recv_open
+ * sets up the ring of fd and grants the first window; codius_recv_read copies
+ * data out of it and hands the credit back once half a window has been read.
+ * codius_recv_read returns the number of bytes, -EAGAIN if the ring is empty,
+ * or the code that ended the stream. codius_recv_pending tells if a read would
+ * not return -EAGAIN.
+ */
+#define CODIUS_RECV_WINDOW 262144
+#define CODIUS_RECV_INITIAL_SIZE 4096
+#define CODIUS_RECV_EOF -4095  /* UV_EOF */
+
+int codius_recv_open(int fd);
+int codius_recv_active(int fd);
+int codius_recv_pending(int fd);
+ssize_t codius_recv_read(int fd, char *buf, size_t len);
+void codius_recv_close(int fd);
+
+/* Take the body of a data frame out of the channel. Returns the fd the data
+   is for, or -1 for error. */
+int codius_recv_frame(size_t size);
+
+/**
+ * A JSON response tokenized once. Tokens live in the handle itself unless the
+ * response is unusually large, and the keys of all objects are hashed into a
+ * small index so field lookups don't rescan the response.
+ */
+#define CODIUS_JSON_STACK_TOKENS 64
+#define CODIUS_JSON_INDEX_SIZE 64
+
+typedef struct codius_json_s codius_json_t;
+
+struct codius_json_s {
+  const char *js;
+  jsmntok_t *tokens;
+  int ntokens;
+  int indexed;
+  struct {
+    int parent;
+    int key;
+  } index[CODIUS_JSON_INDEX_SIZE];
+  jsmntok_t stack_tokens[CODIUS_JSON_STACK_TOKENS];
+};
+
+/**
+ * Tokenize a response whose root is an object. Returns 0, or -1 if the
+ * response is not valid JSON. js must outlive the handle, which must be
+ * released with codius_json_free.
+ */
+int codius_json_parse(codius_json_t *json, const char *js, size_t len);
+
+void codius_json_free(codius_json_t *json);
+
+/**
+ * Get the token of the value of field name in the object at token object
+ * (0 is the root object), or -1 if there is no such field.
+ */
+int codius_json_field(const codius_json_t *json, int object, const char *name);
+
+/**
+ * Get the jsmntype_t of a token, or -1 if tok is not a valid token.
+ */
+int codius_json_type(const codius_json_t *json, int tok);
+
+/**
+ * Accessors for the value at a token. All of them return -1 if tok is invalid
+ * or holds a value of a different type; codius_json_str returns the string
+ * length otherwise.
+ */
+int codius_json_int(const codius_json_t *json, int tok, int *value);
+int codius_json_str(const codius_json_t *json, int tok,
+                    char *buf, size_t buf_size);
+int codius_json_tm(const codius_json_t *json, int tok, struct tm *t);
+
 /**
  * Get the type of the result field.
  */
 jsmntype_t codius_parse_json_type(char *js, size_t len, const char *field_name);
 
 /**
- * Get the integer that is present from the result field.
+ * Get the integer that is present from the result field, or -1 on error.
  */
 int codius_parse_json_int(char *js, size_t len, const char *field_name);
 
@@ -52,6 +545,9 @@ int codius_parse_json_str(char *js, size_t len, const char *field_name, char *bu
 
 /**
  * Get the struct tm that is present in the result field.
+ *
+ * These helpers tokenize the response for a single lookup. Use a
+ * codius_json_t to read several fields of the same response.
  */
 int codius_parse_json_tm(char *js, size_t len, const char *field_name, struct tm *t);
 
@@ -17,65 +17,633 @@
 */
 //==============================================================================
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #include "codius-util.h"
 
-typedef struct codius_rpc_header_s codius_rpc_header_t;
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-struct codius_rpc_header_s {
-  unsigned long magic_bytes;
-  unsigned long callback_id;
-  unsigned long size;
+
+int codius_channel_read(char *buf, size_t len) {
+  const int sync_fd = 3;
+  ssize_t n;
+
+  if (codius_ring_active())
+    return codius_ring_read(buf, len);
+
+  while (len > 0) {
+    n = read(sync_fd, buf, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+int codius_channel_writev(struct iovec *iov, int iovcnt) {
+  const int sync_fd = 3;
+  ssize_t n;
+
+  if (codius_ring_active())
+    return codius_ring_writev(iov, iovcnt);
+
+  /* Frames may gather more pieces than one writev takes. */
+  while (iovcnt > 0) {
+    n = writev(sync_fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+
+    /* Skip over whatever was written and retry the rest. */
+    while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return 0;
+}
+
+
+int codius_channel_poll(int timeout) {
+  const int sync_fd = 3;
+  struct pollfd pfd;
+
+  if (codius_ring_active())
+    return codius_ring_poll(timeout);
+
+  pfd.fd = sync_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll(&pfd, 1, timeout);
+}
+
+
+static codius_event_t pending_events[CODIUS_MAX_PENDING_EVENTS];
+static int pending_events_len;
+static int pending_events_overflow;
+
+/* Completion frames that have not been fully consumed, oldest first. */
+typedef struct codius_completion_frame_s codius_completion_frame_t;
+
+struct codius_completion_frame_s {
+  codius_completion_frame_t *next;
+  size_t pos;
+  size_t len;
+  char buf[1];
 };
 
+static codius_completion_frame_t *completions_head;
+static codius_completion_frame_t *completions_tail;
+
+
+/* Store event in events if there is room, otherwise queue it. */
+static void codius_add_event(codius_event_t *events, int max_events,
+                             int *nevents, const codius_event_t *event) {
+  if (*nevents < max_events)
+    events[(*nevents)++] = *event;
+  else if (pending_events_len < CODIUS_MAX_PENDING_EVENTS)
+    pending_events[pending_events_len++] = *event;
+  else
+    pending_events_overflow = 1;
+}
+
+
+/* Read the body of a frame the host pushed on its own. Readiness events are
+   stored in events, queueing whatever does not fit. Completions are queued
+   for codius_next_completion and announced as an event on fd 3, and data goes
+   to the receive ring of its socket and is announced as an event on that.
+   Returns the number of events stored in events or -1 for error. */
+static int codius_read_pushed(const codius_rpc_header_t *rpc_header,
+                              codius_event_t *events, int max_events) {
+  const int sync_fd = 3;
+  codius_completion_frame_t *frame;
+  codius_event_t event;
+  size_t size = rpc_header->size;
+  int nevents = 0;
+
+  if (rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_DATA) {
+    event.fd = codius_recv_frame(size);
+    if (event.fd == -1)
+      return -1;
+    event.events = CODIUS_EVENT_READABLE;
+    codius_add_event(events, max_events, &nevents, &event);
+    return nevents;
+  }
+
+  if (rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_COMPLETION) {
+    if (size > CODIUS_MAX_RESPONSE_SIZE) {
+      printf("Message too large from fd %d\n", sync_fd);
+      abort();
+    }
+
+    frame = (codius_completion_frame_t*) malloc(sizeof(*frame) + size);
+    if (frame == NULL ||
+        -1==codius_channel_read(frame->buf, size)) {
+      free(frame);
+      return -1;
+    }
+
+    frame->next = NULL;
+    frame->pos = 0;
+    frame->len = size;
+    if (completions_tail != NULL)
+      completions_tail->next = frame;
+    else
+      completions_head = frame;
+    completions_tail = frame;
+
+    event.fd = sync_fd;
+    event.events = CODIUS_EVENT_READABLE;
+    codius_add_event(events, max_events, &nevents, &event);
+    return nevents;
+  }
+
+  if (size % sizeof(event) != 0) {
+    printf("Invalid event frame from fd %d\n", sync_fd);
+    return -1;
+  }
+
+  for (; size > 0; size -= sizeof(event)) {
+    if (-1==codius_channel_read((char*) &event, sizeof(event)))
+      return -1;
+    codius_add_event(events, max_events, &nevents, &event);
+  }
+
+  return nevents;
+}
+
 
-const unsigned long CODIUS_MAGIC_BYTES = 0xC0D105FE;
+static int codius_is_pushed(const codius_rpc_header_t *rpc_header) {
+  return rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_EVENT ||
+         rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_COMPLETION ||
+         rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_DATA;
+}
+
+
+int codius_read_header(codius_rpc_header_t *rpc_header) {
+  for (;;) {
+    if (-1==codius_channel_read((char*) rpc_header, sizeof(*rpc_header)))
+      return -1;
+
+    if (!codius_is_pushed(rpc_header))
+      return 0;
+
+    if (-1==codius_read_pushed(rpc_header, NULL, 0))
+      return -1;
+  }
+}
+
+
+int codius_wait_events(codius_event_t *events, int max_events, int timeout) {
+  const int sync_fd = 3;
+  codius_rpc_header_t rpc_header;
+  int n;
+
+  if (pending_events_overflow) {
+    pending_events_overflow = 0;
+    pending_events_len = 0;
+    events[0].fd = -1;
+    events[0].events = CODIUS_EVENT_READABLE;
+    return 1;
+  }
+
+  if (pending_events_len > 0) {
+    n = pending_events_len < max_events ? pending_events_len : max_events;
+    memcpy(events, pending_events, n * sizeof(*events));
+    pending_events_len -= n;
+    memmove(pending_events, pending_events + n,
+            pending_events_len * sizeof(*events));
+    return n;
+  }
+
+  n = codius_channel_poll(timeout);
+  if (n <= 0)
+    return n;
+
+  /* Nothing else is outstanding when the loop blocks, so the host can only
+     have pushed a frame on its own. */
+  if (-1==codius_channel_read((char*) &rpc_header, sizeof(rpc_header)) ||
+      !codius_is_pushed(&rpc_header)) {
+    printf("Error reading events from fd %d\n", sync_fd);
+    errno = EIO;
+    return -1;
+  }
+
+  n = codius_read_pushed(&rpc_header, events, max_events);
+  if (n == -1)
+    errno = EIO;
+
+  return n;
+}
+
+
+int codius_next_completion(uint32_t *callback_id,
+                           const char **buf, size_t *len) {
+  codius_completion_frame_t *frame;
+  uint32_t size;
+
+  for (;;) {
+    frame = completions_head;
+    if (frame == NULL)
+      return 0;
+
+    if (frame->len - frame->pos >= 2 * sizeof(uint32_t)) {
+      memcpy(callback_id, frame->buf + frame->pos, sizeof(*callback_id));
+      memcpy(&size, frame->buf + frame->pos + 4, sizeof(size));
+      if (size <= frame->len - frame->pos - 8) {
+        *buf = frame->buf + frame->pos + 8;
+        *len = size;
+        frame->pos += 8 + size;
+        return 1;
+      }
+      printf("Invalid completion frame\n");
+    }
+
+    /* The frame is used up, and nothing points into it any more. */
+    completions_head = frame->next;
+    if (completions_head == NULL)
+      completions_tail = NULL;
+    free(frame);
+  }
+}
+
+
+/* Responses are read into this buffer, which is reused from call to call.
+   The sandbox runs a single event loop on a single thread, so this is the
+   loop's buffer. */
+static char *response_buffer;
+static size_t response_buffer_size;
+
+
+/* Make room for size bytes of response, keeping the first used bytes. */
+static char *codius_response_reserve(size_t used, size_t size) {
+  char *buf;
+
+  if (size > CODIUS_MAX_RESPONSE_SIZE) {
+    printf("Message too large from fd %d\n", 3);
+    abort();
+  }
+
+  if (size > response_buffer_size || response_buffer == NULL) {
+    if (size < CODIUS_MAX_MESSAGE_SIZE)
+      size = CODIUS_MAX_MESSAGE_SIZE;
+    /* Grow geometrically while a body is coming in a chunk at a time. */
+    if (used > 0 && size < 2 * response_buffer_size)
+      size = 2 * response_buffer_size;
+    if (size > CODIUS_MAX_RESPONSE_SIZE)
+      size = CODIUS_MAX_RESPONSE_SIZE;
+    buf = (char*) realloc(response_buffer, size);
+    if (buf == NULL)
+      return NULL;
+    response_buffer = buf;
+    response_buffer_size = size;
+  }
+
+  return response_buffer;
+}
+
+
+static char *codius_response_buffer(size_t size) {
+  /* Give back the memory of an unusually large response once calls are
+     small again. */
+  if (response_buffer_size > CODIUS_RESPONSE_BUFFER_KEEP &&
+      size <= CODIUS_RESPONSE_BUFFER_KEEP) {
+    free(response_buffer);
+    response_buffer = NULL;
+    response_buffer_size = 0;
+  }
+
+  return codius_response_reserve(0, size);
+}
+
+
+/* The response body being read, which may continue over several frames. */
+static struct {
+  uint32_t magic_bytes;
+  size_t remaining;  /* Left in the current frame. */
+  int last;          /* The current frame is the last one. */
+} body;
+
+
+static int codius_body_frame(const codius_rpc_header_t *rpc_header) {
+  if (rpc_header->magic_bytes==CODIUS_MAGIC_BYTES_CONTINUATION)
+    body.last = 0;
+  else if (rpc_header->magic_bytes==body.magic_bytes)
+    body.last = 1;
+  else
+    return -1;
+
+  body.remaining = rpc_header->size;
+  return 0;
+}
+
+
+/* Start reading the body of the next response, which must carry
+   magic_bytes. */
+static int codius_body_begin(uint32_t magic_bytes) {
+  codius_rpc_header_t rpc_header;
+
+  body.magic_bytes = magic_bytes;
+  if (-1==codius_read_header(&rpc_header) ||
+      -1==codius_body_frame(&rpc_header)) {
+    body.remaining = 0;
+    body.last = 1;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* Read up to len bytes of the body, or skip them if buf is NULL. Returns the
+   number of bytes, 0 at the end of the body, or -1 for error. */
+static ssize_t codius_body_read_some(char *buf, size_t len) {
+  codius_rpc_header_t rpc_header;
+  char skip[256];
+
+  while (body.remaining == 0) {
+    if (body.last)
+      return 0;
+    if (-1==codius_read_header(&rpc_header) ||
+        -1==codius_body_frame(&rpc_header))
+      return -1;
+  }
+
+  if (len > body.remaining)
+    len = body.remaining;
+  if (buf == NULL && len > sizeof(skip))
+    len = sizeof(skip);
+
+  if (-1==codius_channel_read(buf != NULL ? buf : skip, len))
+    return -1;
+  body.remaining -= len;
+  return len;
+}
+
+
+/* Read exactly len bytes of the body. */
+static int codius_body_read(char *buf, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = codius_body_read_some(buf, len);
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/* Read the rest of the body into the response buffer after the first used
+   bytes. Returns the size of the whole body, or -1 for error. */
+static ssize_t codius_body_read_rest(size_t used) {
+  char *buf;
+  ssize_t n;
+
+  for (;;) {
+    buf = codius_response_reserve(used, used + (body.remaining > 0 ?
+                                                body.remaining : 1));
+    if (buf == NULL)
+      return -1;
+    n = codius_body_read_some(buf + used, response_buffer_size - used);
+    if (n <= 0)
+      return n == 0 ? (ssize_t) used : -1;
+    used += n;
+  }
+}
+
+
+int codius_write_frame(uint32_t magic_bytes, uint32_t callback_id,
+                       const struct iovec *body, int body_cnt) {
+  codius_rpc_header_t rpc_header;
+  struct iovec iov[body_cnt + 1];
+  size_t size = 0;
+  int i;
+
+  for (i = 0; i < body_cnt; i++) {
+    iov[i + 1] = body[i];
+    size += body[i].iov_len;
+  }
+
+  rpc_header.magic_bytes = magic_bytes;
+  rpc_header.callback_id = callback_id;
+  rpc_header.size = size;
+
+  iov[0].iov_base = &rpc_header;
+  iov[0].iov_len = sizeof(rpc_header);
+
+  if (-1==codius_channel_writev(iov, body_cnt + 1)) {
+    perror("writev()");
+    printf("Error writing to fd %d\n", 3);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int codius_read_frame(uint32_t magic_bytes, char **buf, size_t *len) {
+  ssize_t size;
+
+  if (-1==codius_body_begin(magic_bytes) ||
+      codius_response_buffer(body.remaining) == NULL ||
+      (size = codius_body_read_rest(0)) == -1) {
+    printf("Error reading from fd %d\n", 3);
+    fflush(stdout);
+    return -1;
+  }
+
+  *buf = response_buffer;
+  *len = size;
+  return 0;
+}
 
 
 /* Make synchronous function call outside the sandbox.
    Return response_len or -1 for error. */
 int codius_sync_call(const char* request_buf, size_t request_len,
                      char **response_buf, size_t *response_len) {
-  size_t bytes_read;
-  const int sync_fd = 3;
-  int resp_len;
+  struct iovec iov;
 
-  codius_rpc_header_t rpc_header;
-  rpc_header.magic_bytes = CODIUS_MAGIC_BYTES;
-  rpc_header.callback_id = 0;
-  rpc_header.size = request_len;
-  
-  if (-1==write(sync_fd, &rpc_header, sizeof(rpc_header)) ||
-      -1==write(sync_fd, request_buf, request_len)) {
-    perror("write()");
-    printf("Error writing to fd %d\n", sync_fd);
+  iov.iov_base = (char*) request_buf;
+  iov.iov_len = request_len;
+
+  if (-1==codius_write_frame(CODIUS_MAGIC_BYTES, 0, &iov, 1) ||
+      -1==codius_read_frame(CODIUS_MAGIC_BYTES, response_buf, response_len))
+    return -1;
+
+  return *response_len;
+}
+
+
+/* Send a binary call and read its response up to the payload into the
+   response buffer. Returns the number of bytes read, or -1 for error. */
+static ssize_t codius_rpc_send(codius_rpc_msg_t *msg,
+                               const struct iovec *payload, int payload_cnt) {
+  struct iovec iov[payload_cnt + 1];
+  uint32_t count, type, i;
+  size_t used = 8;
+  size_t len;
+  char *buf;
+  int k;
+
+  if (-1==codius_rpc_msg_finish(msg))
+    return -1;
+
+  iov[0].iov_base = msg->base;
+  iov[0].iov_len = msg->len;
+  for (k = 0; k < payload_cnt; k++)
+    iov[k + 1] = payload[k];
+
+  if (-1==codius_write_frame(CODIUS_MAGIC_BYTES_BINARY, 0,
+                             iov, payload_cnt + 1) ||
+      -1==codius_body_begin(CODIUS_MAGIC_BYTES_BINARY))
+    return -1;
+
+  buf = codius_response_buffer(CODIUS_RPC_SMALL_MESSAGE_SIZE);
+  if (buf == NULL || -1==codius_body_read(buf, 8))
+    return -1;
+
+  /* Values are read one by one, as their sizes come in. */
+  memcpy(&count, buf + 4, sizeof(count));
+  for (i = 0; i < count; i++) {
+    if (codius_response_reserve(used, used + 8) == NULL ||
+        -1==codius_body_read(response_buffer + used, 4))
+      return -1;
+    memcpy(&type, response_buffer + used, sizeof(type));
+    used += 4;
+
+    switch (type) {
+      case CODIUS_RPC_INT32:
+        len = 4;
+        break;
+      case CODIUS_RPC_DOUBLE:
+        len = 8;
+        break;
+      case CODIUS_RPC_STRING:
+        if (-1==codius_body_read(response_buffer + used, 4))
+          return -1;
+        memcpy(&type, response_buffer + used, sizeof(type));
+        used += 4;
+        len = type;
+        break;
+      default:
+        return -1;
+    }
+
+    if (codius_response_reserve(used, used + len) == NULL ||
+        -1==codius_body_read(response_buffer + used, len))
+      return -1;
+    used += len;
+  }
+
+  return used;
+}
+
+
+int codius_rpc_call_begin(codius_rpc_msg_t *msg,
+                          const struct iovec *payload, int payload_cnt,
+                          codius_rpc_reply_t *reply) {
+  ssize_t used = codius_rpc_send(msg, payload, payload_cnt);
+
+  if (used == -1 ||
+      -1==codius_rpc_reply_parse(reply, response_buffer, used)) {
+    printf("Error reading from fd %d\n", 3);
     return -1;
   }
-  
-  bytes_read = read(sync_fd, &rpc_header, sizeof(rpc_header));
-  if (bytes_read==-1 || rpc_header.magic_bytes!=CODIUS_MAGIC_BYTES) {
+
+  /* The response buffer is not the caller's to free. */
+  reply->buf = NULL;
+  reply->payload = NULL;
+  reply->payload_len = 0;
+  return 0;
+}
+
+
+ssize_t codius_rpc_read_payload(char *buf, size_t len) {
+  return len > 0 ? codius_body_read_some(buf, len) : 0;
+}
+
+
+int codius_rpc_callv(codius_rpc_msg_t *msg,
+                     const struct iovec *payload, int payload_cnt,
+                     char *dst, size_t dst_len,
+                     codius_rpc_reply_t *reply) {
+  const int sync_fd = 3;
+  ssize_t used, size, n;
+  size_t payload_len = 0;
+
+  used = codius_rpc_send(msg, payload, payload_cnt);
+  if (used == -1) {
     printf("Error reading from fd %d\n", sync_fd);
     return -1;
   }
-  
-  if (rpc_header.size > CODIUS_MAX_RESPONSE_SIZE) {
-    printf("Message too large from fd %d\n", sync_fd);
-    abort();
+
+  /* The payload goes straight into the caller's buffer, a chunk at a
+     time. */
+  if (dst != NULL) {
+    while ((n = codius_body_read_some(dst + payload_len,
+                                      dst_len - payload_len)) > 0)
+      payload_len += n;
+    if (n == 0 && payload_len == dst_len &&
+        codius_body_read_some(NULL, 1) != 0) {
+      printf("Payload exceeds %u byte buffer.\n", (unsigned int) dst_len);
+      abort();
+    }
+    if (n == -1) {
+      printf("Error reading from fd %d\n", sync_fd);
+      return -1;
+    }
+    size = used;
+  } else {
+    size = codius_body_read_rest(used);
+    if (size == -1) {
+      printf("Error reading from fd %d\n", sync_fd);
+      return -1;
+    }
   }
-  *response_len = rpc_header.size;  
-  
-  *response_buf = (char*) malloc(*response_len);
-  
-  bytes_read = read(sync_fd, *response_buf, *response_len);
-  if (bytes_read==-1) {
-    perror("read()");
-    printf("Error reading from fd %d\n", sync_fd);
-    fflush(stdout);
 
+  if (-1==codius_rpc_reply_parse(reply, response_buffer, size)) {
+    printf("Invalid binary RPC response.\n");
     return -1;
   }
+  /* The response buffer is not the caller's to free. */
+  reply->buf = NULL;
 
-  return *response_len;
-}
\ No newline at end of file
+  if (dst != NULL) {
+    reply->payload = dst;
+    reply->payload_len = payload_len;
+  }
+
+  return 0;
+}
+
+
+int codius_rpc_call(codius_rpc_msg_t *msg, codius_rpc_reply_t *reply) {
+  return codius_rpc_callv(msg, NULL, 0, NULL, 0, reply);
+}
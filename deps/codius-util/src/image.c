@@ -0,0 +1,604 @@
+//------------------------------------------------------------------------------
+/*
+    This file is part of Codius: https://github.com/codius
+    Copyright (c) 2014 Ripple Labs Inc.
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose  with  or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE  SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH  REGARD  TO  THIS  SOFTWARE  INCLUDING  ALL  IMPLIED  WARRANTIES  OF
+    MERCHANTABILITY  AND  FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY  SPECIAL ,  DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER  RESULTING  FROM  LOSS  OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION  OF  CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+//==============================================================================
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codius-util.h"
+
+/* See the description of the contract image in codius-util.h. */
+
+#define CODIUS_IMAGE_HEADER_SIZE 32
+/* Stat values, in the order of the fs.Stats constructor. */
+#define CODIUS_IMAGE_STAT_VALUES 14
+
+typedef struct codius_image_file_s codius_image_file_t;
+
+struct codius_image_file_s {
+  int used;
+  uint32_t entry;
+  double position;
+};
+
+static int image_state;  /* 0 not initialized, 1 mapped, -1 unavailable. */
+static const char *image_base;
+static uint32_t image_count;
+static const codius_image_entry_t *image_entries;
+static const uint32_t *image_children;
+static codius_image_file_t image_files[CODIUS_IMAGE_MAX_FILES];
+
+
+/* Check that every entry points inside the image, so lookups can trust it. */
+static int codius_image_check(const char *base, size_t size) {
+  const uint32_t *header = (const uint32_t*) base;
+  const codius_image_entry_t *entries;
+  uint32_t count, children_offset, children_count;
+  uint32_t i;
+
+  if (size < CODIUS_IMAGE_HEADER_SIZE ||
+      header[0] != CODIUS_IMAGE_MAGIC || header[1] != CODIUS_IMAGE_VERSION)
+    return -1;
+
+  count = header[2];
+  children_offset = header[3];
+  children_count = header[4];
+  if (count == 0 ||
+      count > (size - CODIUS_IMAGE_HEADER_SIZE) / sizeof(*entries) ||
+      children_offset > size || (children_offset & 3) != 0 ||
+      children_count > (size - children_offset) / sizeof(uint32_t))
+    return -1;
+
+  entries = (const codius_image_entry_t*) (base + CODIUS_IMAGE_HEADER_SIZE);
+  for (i = 0; i < count; i++) {
+    const codius_image_entry_t *e = &entries[i];
+    if (e->path_len == 0 || e->path_offset > size ||
+        e->path_len > size - e->path_offset ||
+        e->data_offset > size || e->size > size - e->data_offset ||
+        e->first_child > children_count ||
+        e->child_count > children_count - e->first_child)
+      return -1;
+  }
+
+  for (i = 0; i < children_count; i++) {
+    const uint32_t *children = (const uint32_t*) (base + children_offset);
+    if (children[i] >= count)
+      return -1;
+  }
+
+  image_count = count;
+  image_entries = entries;
+  image_children = (const uint32_t*) (base + children_offset);
+  return 0;
+}
+
+
+static int codius_image_map(void) {
+  const char *env = getenv("CODIUS_IMAGE_FD");
+  struct stat st;
+  char *base;
+  size_t done;
+  ssize_t r;
+  int fd;
+  int mapped = 1;
+
+  if (env == NULL)
+    return -1;
+
+  fd = atoi(env);
+  if (fd <= 0 || fstat(fd, &st) == -1 || st.st_size <= 0)
+    return -1;
+
+  base = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    /* Not every descriptor can be mapped, so fall back to reading it. */
+    mapped = 0;
+    base = (char*) malloc(st.st_size);
+    if (base == NULL)
+      return -1;
+    for (done = 0; done < (size_t) st.st_size; done += r) {
+      r = pread(fd, base + done, st.st_size - done, done);
+      if (r <= 0) {
+        free(base);
+        return -1;
+      }
+    }
+  }
+
+  if (codius_image_check(base, st.st_size) == -1) {
+    if (mapped)
+      munmap(base, st.st_size);
+    else
+      free(base);
+    return -1;
+  }
+
+  image_base = base;
+  return 0;
+}
+
+
+static int codius_image_active(void) {
+  if (image_state == 0)
+    image_state = codius_image_map() == 0 ? 1 : -1;
+  return image_state == 1;
+}
+
+
+/* Only absolute paths without empty, "." or ".." components are looked up.
+   Anything else goes to the host, which resolves it properly. */
+static int codius_image_path_ok(const char *path, size_t len) {
+  size_t i;
+
+  if (len == 0 || path[0] != '/')
+    return 0;
+  if (len == 1)
+    return 1;
+  if (path[len - 1] == '/')
+    return 0;
+
+  for (i = 0; i < len; i++) {
+    if (path[i] != '/')
+      continue;
+    if (i + 1 < len && path[i + 1] == '/')
+      return 0;
+    if (i + 1 < len && path[i + 1] == '.' &&
+        (i + 2 == len || path[i + 2] == '/' ||
+         (path[i + 2] == '.' && (i + 3 == len || path[i + 3] == '/'))))
+      return 0;
+  }
+
+  return 1;
+}
+
+
+static int codius_image_compare(const codius_image_entry_t *e,
+                                const char *path, size_t len) {
+  size_t n = e->path_len < len ? e->path_len : len;
+  int r = memcmp(image_base + e->path_offset, path, n);
+
+  if (r != 0)
+    return r;
+  if (e->path_len == len)
+    return 0;
+  return e->path_len < len ? -1 : 1;
+}
+
+
+/* Find the entry for path. Returns its index, -ENOENT if the path is below
+   the root of the image but not in it, or -1 if the image doesn't cover it. */
+static int64_t codius_image_lookup(const char *path, size_t len) {
+  const codius_image_entry_t *root = &image_entries[0];
+  const char *root_path = image_base + root->path_offset;
+  uint32_t lo, hi;
+
+  if (!codius_image_path_ok(path, len))
+    return -1;
+
+  if (!(root->path_len == 1 ||
+        (len >= root->path_len &&
+         memcmp(path, root_path, root->path_len) == 0 &&
+         (len == root->path_len || path[root->path_len] == '/'))))
+    return -1;
+
+  lo = 0;
+  hi = image_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int r = codius_image_compare(&image_entries[mid], path, len);
+    if (r == 0)
+      return mid;
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return -ENOENT;
+}
+
+
+static codius_image_file_t *codius_image_file(int32_t fd) {
+  uint32_t slot = (uint32_t) fd - CODIUS_IMAGE_FD_BASE;
+
+  if (slot >= CODIUS_IMAGE_MAX_FILES || !image_files[slot].used)
+    return NULL;
+  return &image_files[slot];
+}
+
+
+static const char *codius_image_error_code(int err) {
+  switch (err) {
+    case ENOENT: return "ENOENT";
+    case ENOTDIR: return "ENOTDIR";
+    case EISDIR: return "EISDIR";
+    case EROFS: return "EROFS";
+    case EBADF: return "EBADF";
+    default: return "EIO";
+  }
+}
+
+
+/* Responses have the layout of requests, with the result in place of the
+   method id. */
+static void codius_image_reply_init(codius_rpc_msg_t *resp, char *buf,
+                                    size_t size, int32_t result) {
+  codius_rpc_msg_init(resp, buf, size, (codius_rpc_method_t) result);
+}
+
+
+static void codius_image_reply_error(codius_rpc_msg_t *resp, char *buf,
+                                     size_t size, int err,
+                                     const char *path, size_t path_len) {
+  const char *code = codius_image_error_code(err);
+
+  codius_image_reply_init(resp, buf, size, -err);
+  codius_rpc_add_string(resp, code, strlen(code));
+  if (path != NULL)
+    codius_rpc_add_string(resp, path, path_len);
+}
+
+
+static void codius_image_add_stat(codius_rpc_msg_t *resp, uint32_t index) {
+  const codius_image_entry_t *e = &image_entries[index];
+  int is_dir = S_ISDIR(e->mode);
+
+  codius_rpc_add_int32(resp, 0);                            /* dev */
+  codius_rpc_add_int32(resp, e->mode);                      /* mode */
+  codius_rpc_add_int32(resp, is_dir ? 2 : 1);               /* nlink */
+  codius_rpc_add_int32(resp, 0);                            /* uid */
+  codius_rpc_add_int32(resp, 0);                            /* gid */
+  codius_rpc_add_int32(resp, 0);                            /* rdev */
+  codius_rpc_add_int32(resp, 4096);                         /* blksize */
+  codius_rpc_add_double(resp, index + 1);                   /* ino */
+  codius_rpc_add_double(resp, e->size);                     /* size */
+  codius_rpc_add_double(resp, (e->size + 511) / 512);       /* blocks */
+  codius_rpc_add_double(resp, e->mtime);                    /* atime */
+  codius_rpc_add_double(resp, e->mtime);                    /* mtime */
+  codius_rpc_add_double(resp, e->mtime);                    /* ctime */
+  codius_rpc_add_double(resp, e->mtime);                    /* birthtime */
+}
+
+
+static void codius_image_reply_stat(codius_rpc_msg_t *resp, char *buf,
+                                    size_t size, uint32_t index) {
+  codius_image_reply_init(resp, buf, size, 0);
+  codius_image_add_stat(resp, index);
+}
+
+
+static void codius_image_reply_names(codius_rpc_msg_t *resp, char *buf,
+                                     size_t size, uint32_t index) {
+  const codius_image_entry_t *e = &image_entries[index];
+  uint32_t i;
+
+  codius_image_reply_init(resp, buf, size, 0);
+  for (i = 0; i < e->child_count; i++) {
+    const codius_image_entry_t *child =
+        &image_entries[image_children[e->first_child + i]];
+    const char *path = image_base + child->path_offset;
+    const char *name = path + child->path_len;
+    while (name > path && name[-1] != '/')
+      name--;
+    codius_rpc_add_string(resp, name, path + child->path_len - name);
+  }
+}
+
+
+/* Get the next call of a batch, see CODIUS_RPC_FS_BATCH. Returns -1 at the
+   end of the batch or if the call is malformed. */
+static int codius_image_batch_next(codius_rpc_reply_t *req, int32_t *method,
+                                   const char **path, size_t *path_len,
+                                   int32_t *fd, int32_t *len,
+                                   double *position) {
+  int32_t flags, mode;
+
+  if (codius_rpc_get_int32(req, method) == -1)
+    return -1;
+
+  switch ((uint32_t) *method) {
+    case CODIUS_RPC_FS_OPEN:
+      if (codius_rpc_get_string(req, path, path_len) == -1 ||
+          codius_rpc_get_int32(req, &flags) == -1 ||
+          codius_rpc_get_int32(req, &mode) == -1)
+        return -1;
+      /* The caller checks the flags. */
+      *fd = flags;
+      return 0;
+    case CODIUS_RPC_FS_CLOSE:
+    case CODIUS_RPC_FS_FSTAT:
+      return codius_rpc_get_int32(req, fd);
+    case CODIUS_RPC_FS_READ:
+      if (codius_rpc_get_int32(req, fd) == -1 ||
+          codius_rpc_get_int32(req, len) == -1 ||
+          codius_rpc_get_number(req, position) == -1)
+        return -1;
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+
+/* Run a batch against the image. It is only taken on if it opens a file of
+   the image for reading first, only uses that file, reads from it at most
+   once and the data fits in room bytes. Anything else goes to the host as a
+   whole. Returns 1 if resp holds the answer and the data read, or 0. */
+static int codius_image_batch(codius_rpc_reply_t *req, codius_rpc_msg_t *resp,
+                              char *buf, size_t buf_size, size_t room,
+                              const char **data, size_t *data_len) {
+  codius_rpc_reply_t calls = *req;
+  const char *path = NULL;
+  size_t path_len = 0;
+  int32_t method, fd, len;
+  double position;
+  int64_t index = -1;
+  uint32_t i, slot;
+  int reads = 0;
+  codius_image_file_t *file = NULL;
+
+  /* First make sure the image can run the whole batch. */
+  for (i = 0; codius_image_batch_next(&calls, &method, &path, &path_len,
+                                      &fd, &len, &position) == 0; i++) {
+    if (i == 0 && method == CODIUS_RPC_FS_OPEN) {
+      if ((fd & O_ACCMODE) != O_RDONLY || (fd & (O_CREAT | O_TRUNC)) ||
+          (index = codius_image_lookup(path, path_len)) == -1)
+        return 0;
+    } else if (i == 0 || method == CODIUS_RPC_FS_OPEN ||
+               fd != CODIUS_RPC_FS_BATCH_FD ||
+               (method == CODIUS_RPC_FS_READ && reads++ > 0)) {
+      return 0;
+    }
+  }
+  if (i == 0 || calls.pos != calls.end)
+    return 0;
+  if (reads > 0 && index >= 0 && image_entries[index].size > room)
+    return 0;
+
+  if (index < 0) {
+    codius_image_reply_error(resp, buf, buf_size, ENOENT, path, path_len);
+    codius_rpc_add_int32(resp, CODIUS_RPC_FS_OPEN);
+    return 1;
+  }
+
+  for (slot = 0; slot < CODIUS_IMAGE_MAX_FILES; slot++) {
+    if (!image_files[slot].used)
+      break;
+  }
+  if (slot == CODIUS_IMAGE_MAX_FILES)
+    return 0;
+
+  codius_image_reply_init(resp, buf, buf_size, 0);
+  calls = *req;
+  while (codius_image_batch_next(&calls, &method, &path, &path_len,
+                                 &fd, &len, &position) == 0) {
+    switch ((uint32_t) method) {
+      case CODIUS_RPC_FS_OPEN:
+        file = &image_files[slot];
+        file->used = 1;
+        file->entry = (uint32_t) index;
+        file->position = 0;
+        codius_rpc_add_int32(resp, CODIUS_IMAGE_FD_BASE + slot);
+        break;
+
+      case CODIUS_RPC_FS_CLOSE:
+        file->used = 0;
+        codius_rpc_add_int32(resp, 0);
+        break;
+
+      case CODIUS_RPC_FS_FSTAT:
+        codius_rpc_add_int32(resp, 0);
+        codius_image_add_stat(resp, file->entry);
+        break;
+
+      case CODIUS_RPC_FS_READ: {
+        const codius_image_entry_t *e = &image_entries[file->entry];
+        double start = position < 0 ? file->position : position;
+
+        if (S_ISDIR(e->mode)) {
+          file->used = 0;
+          codius_image_reply_error(resp, buf, buf_size, EISDIR, NULL, 0);
+          codius_rpc_add_int32(resp, CODIUS_RPC_FS_READ);
+          *data_len = 0;
+          return 1;
+        }
+        if (start < e->size) {
+          *data = image_base + e->data_offset + (size_t) start;
+          *data_len = e->size - (size_t) start;
+          if (len >= 0 && *data_len > (size_t) len)
+            *data_len = len;
+        }
+        if (position < 0)
+          file->position += *data_len;
+        codius_rpc_add_int32(resp, (int32_t) *data_len);
+        break;
+      }
+    }
+  }
+
+  return 1;
+}
+
+
+int codius_image_call(codius_rpc_msg_t *msg, char *buf, size_t buf_size,
+                      char *dst, size_t dst_len, codius_rpc_reply_t *reply) {
+  codius_rpc_reply_t req;
+  codius_rpc_msg_t resp;
+  const char *path = NULL;
+  size_t path_len = 0;
+  const char *data = NULL;
+  size_t data_len = 0;
+  int64_t index;
+  int32_t fd, flags, mode, len;
+  double position;
+  codius_image_file_t *file;
+  codius_image_file_t *advance = NULL;
+  uint32_t slot;
+
+  if (msg->overflow || !codius_image_active())
+    return 0;
+
+  codius_rpc_msg_finish(msg);
+  if (codius_rpc_reply_parse(&req, msg->base, msg->len) == -1)
+    return 0;
+
+  switch ((uint32_t) req.result) {
+    case CODIUS_RPC_FS_OPEN:
+      if (codius_rpc_get_string(&req, &path, &path_len) == -1 ||
+          codius_rpc_get_int32(&req, &flags) == -1 ||
+          codius_rpc_get_int32(&req, &mode) == -1 ||
+          (index = codius_image_lookup(path, path_len)) == -1)
+        return 0;
+      if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC))) {
+        codius_image_reply_error(&resp, buf, buf_size, EROFS, path, path_len);
+        break;
+      }
+      if (index < 0) {
+        codius_image_reply_error(&resp, buf, buf_size, ENOENT, path, path_len);
+        break;
+      }
+      for (slot = 0; slot < CODIUS_IMAGE_MAX_FILES; slot++) {
+        if (!image_files[slot].used)
+          break;
+      }
+      /* Out of descriptors, the host can still open it. */
+      if (slot == CODIUS_IMAGE_MAX_FILES)
+        return 0;
+      image_files[slot].used = 1;
+      image_files[slot].entry = (uint32_t) index;
+      image_files[slot].position = 0;
+      codius_image_reply_init(&resp, buf, buf_size,
+                              CODIUS_IMAGE_FD_BASE + slot);
+      break;
+
+    case CODIUS_RPC_FS_CLOSE:
+      if (codius_rpc_get_int32(&req, &fd) == -1 || fd < CODIUS_IMAGE_FD_BASE)
+        return 0;
+      file = codius_image_file(fd);
+      if (file == NULL) {
+        codius_image_reply_error(&resp, buf, buf_size, EBADF, NULL, 0);
+        break;
+      }
+      file->used = 0;
+      codius_image_reply_init(&resp, buf, buf_size, 0);
+      break;
+
+    case CODIUS_RPC_FS_READ:
+      if (codius_rpc_get_int32(&req, &fd) == -1 ||
+          codius_rpc_get_int32(&req, &len) == -1 ||
+          codius_rpc_get_number(&req, &position) == -1 ||
+          fd < CODIUS_IMAGE_FD_BASE || len < 0)
+        return 0;
+      file = codius_image_file(fd);
+      if (file == NULL) {
+        codius_image_reply_error(&resp, buf, buf_size, EBADF, NULL, 0);
+        break;
+      } else {
+        const codius_image_entry_t *e = &image_entries[file->entry];
+        double start = position < 0 ? file->position : position;
+        if (S_ISDIR(e->mode)) {
+          codius_image_reply_error(&resp, buf, buf_size, EISDIR, NULL, 0);
+          break;
+        }
+        if (start < e->size) {
+          data = image_base + e->data_offset + (size_t) start;
+          data_len = e->size - (size_t) start;
+          if (data_len > (size_t) len)
+            data_len = len;
+        }
+        if (position < 0)
+          advance = file;
+        codius_image_reply_init(&resp, buf, buf_size, (int32_t) data_len);
+      }
+      break;
+
+    case CODIUS_RPC_FS_STAT:
+    case CODIUS_RPC_FS_LSTAT:
+    case CODIUS_RPC_FS_READDIR:
+      if (codius_rpc_get_string(&req, &path, &path_len) == -1 ||
+          (index = codius_image_lookup(path, path_len)) == -1)
+        return 0;
+      if (index < 0) {
+        codius_image_reply_error(&resp, buf, buf_size, ENOENT, path, path_len);
+      } else if ((uint32_t) req.result != CODIUS_RPC_FS_READDIR) {
+        codius_image_reply_stat(&resp, buf, buf_size, (uint32_t) index);
+      } else if (!S_ISDIR(image_entries[index].mode)) {
+        codius_image_reply_error(&resp, buf, buf_size, ENOTDIR,
+                                 path, path_len);
+      } else {
+        codius_image_reply_names(&resp, buf, buf_size, (uint32_t) index);
+      }
+      break;
+
+    case CODIUS_RPC_FS_FSTAT:
+      if (codius_rpc_get_int32(&req, &fd) == -1 || fd < CODIUS_IMAGE_FD_BASE)
+        return 0;
+      file = codius_image_file(fd);
+      if (file == NULL)
+        codius_image_reply_error(&resp, buf, buf_size, EBADF, NULL, 0);
+      else
+        codius_image_reply_stat(&resp, buf, buf_size, file->entry);
+      break;
+
+    case CODIUS_RPC_FS_BATCH:
+      if (!codius_image_batch(&req, &resp, buf, buf_size,
+                              dst != NULL ? dst_len :
+                              buf_size - CODIUS_RPC_SMALL_MESSAGE_SIZE,
+                              &data, &data_len))
+        return 0;
+      break;
+
+    default:
+      return 0;
+  }
+
+  /* Read data goes to dst if there is one, otherwise after the values. */
+  if (data_len > 0 && dst != NULL) {
+    if (data_len > dst_len)
+      return 0;
+    memcpy(dst, data, data_len);
+  } else if (data_len > 0) {
+    if (resp.overflow || resp.size - resp.len < data_len)
+      return 0;
+    memcpy(resp.base + resp.len, data, data_len);
+  }
+
+  /* Responses that don't fit, e.g. a huge directory, are left to the host. */
+  if (resp.overflow)
+    return 0;
+  codius_rpc_msg_finish(&resp);
+
+  if (codius_rpc_reply_parse(reply, buf,
+                             resp.len + (dst == NULL ? data_len : 0)) == -1)
+    return 0;
+  reply->buf = NULL;
+  if (advance != NULL)
+    advance->position += data_len;
+  if (dst != NULL) {
+    reply->payload = dst;
+    reply->payload_len = data_len;
+  }
+
+  return 1;
+}
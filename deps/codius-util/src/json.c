@@ -17,250 +17,314 @@
 */
 //==============================================================================
 
-#define JSON_TOKENS 256
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "jsmn.h"
 #include "codius-util.h"
 
-int json_token_streq(char *js, jsmntok_t *t, char *s)
-{
-    return (strncmp(js + t->start, s, t->end - t->start) == 0
-            && strlen(s) == (size_t) (t->end - t->start));
+static int json_token_streq(const char *js, const jsmntok_t *t,
+                            const char *s, size_t s_len) {
+  return ((size_t) (t->end - t->start) == s_len
+          && strncmp(js + t->start, s, s_len) == 0);
 }
 
-jsmntok_t *json_tokenise(char *js, size_t len)
-{
-    jsmn_parser parser;
-    jsmn_init(&parser);
+static unsigned int json_hash(int parent, const char *s, size_t len) {
+  /* FNV-1a, seeded with the parent object so equal keys in different
+     objects land in different slots. */
+  unsigned int h = 2166136261u ^ (unsigned int) parent;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
 
-    unsigned int n = JSON_TOKENS;
-    jsmntok_t *tokens = malloc(sizeof(jsmntok_t) * n);
-    assert(tokens != NULL);
+/* Index of the first token after the subtree rooted at token i. */
+static int json_skip(const codius_json_t *json, int i) {
+  int pending = 1;
 
-    int ret = jsmn_parse(&parser, js, len, tokens, n);
+  while (pending > 0 && i < json->ntokens) {
+    const jsmntok_t *t = &json->tokens[i];
+    if (t->type == JSMN_ARRAY || t->type == JSMN_OBJECT)
+      pending += t->size;
+    pending--;
+    i++;
+  }
 
-    while (ret == JSMN_ERROR_NOMEM)
-    {
-        n = n * 2 + 1;
-        tokens = realloc(tokens, sizeof(jsmntok_t) * n);
-        assert(tokens != NULL);
-        ret = jsmn_parse(&parser, js, len, tokens, n);
-    }
+  return i;
+}
 
-    if (ret == JSMN_ERROR_INVAL) {
-        printf("jsmn_parse: invalid JSON string");
-        abort();
-    }
-    if (ret == JSMN_ERROR_PART) {
-        printf("jsmn_parse: truncated JSON string");
-        abort();
+static void json_index_insert(codius_json_t *json, int parent, int key) {
+  const jsmntok_t *t = &json->tokens[key];
+  unsigned int slot = json_hash(parent, json->js + t->start,
+                                t->end - t->start);
+  unsigned int i;
+
+  for (i = 0; i < CODIUS_JSON_INDEX_SIZE; i++) {
+    slot &= CODIUS_JSON_INDEX_SIZE - 1;
+    if (json->index[slot].key == 0) {
+      json->index[slot].parent = parent;
+      json->index[slot].key = key;
+      return;
     }
-
-    return tokens;
+    slot++;
+  }
 }
 
-jsmntok_t codius_json_find_token(char *js, size_t len, jsmntok_t* tokens, const char *field_name) {
-  typedef enum { START, KEY, RETVAL, SKIP, STOP } parse_state;
-  parse_state state = START;
+/* Record every object key in the hash index. Returns -1 if an object does
+   not consist of string keys and values. */
+static int json_build_index(codius_json_t *json) {
+  int nkeys = 0;
+  int i, j, k;
+
+  memset(json->index, 0, sizeof(json->index));
+
+  for (i = 0; i < json->ntokens; i++) {
+    const jsmntok_t *t = &json->tokens[i];
+    if (t->type != JSMN_OBJECT)
+      continue;
+    if (t->size % 2 != 0)
+      return -1;
+    nkeys += t->size / 2;
+  }
 
-  size_t object_tokens = 0;
-  size_t i, j;
+  /* Keep the load factor below 3/4, otherwise fall back to scanning. */
+  json->indexed = (nkeys * 4 < CODIUS_JSON_INDEX_SIZE * 3);
 
-  for (i = 0, j = 1; j > 0; i++, j--) {
-    jsmntok_t * t = &tokens[i];
+  for (i = 0; i < json->ntokens; i++) {
+    const jsmntok_t *t = &json->tokens[i];
+    if (t->type != JSMN_OBJECT)
+      continue;
 
-    // Should never reach uninitialized tokens
-    assert(t->start != -1 && t->end != -1);
+    for (j = 0, k = i + 1; j < t->size / 2; j++) {
+      if (k + 1 >= json->ntokens || json->tokens[k].type != JSMN_STRING)
+        return -1;
+      if (json->indexed)
+        json_index_insert(json, i, k);
+      k = json_skip(json, k + 1);
+    }
+  }
 
-    if (t->type == JSMN_ARRAY || t->type == JSMN_OBJECT)
-      j += t->size;
+  return 0;
+}
 
-    switch (state) {
-      case START:
-        if (t->type != JSMN_OBJECT) {
-          printf("Invalid response: root element must be an object.");
-          abort();
-        }
+int codius_json_parse(codius_json_t *json, const char *js, size_t len) {
+  jsmn_parser parser;
+  unsigned int n = CODIUS_JSON_STACK_TOKENS;
+  int ret;
+
+  json->js = js;
+  json->tokens = json->stack_tokens;
+  json->ntokens = 0;
+
+  if (js == NULL || len == 0)
+    return -1;
+
+  jsmn_init(&parser);
+  ret = jsmn_parse(&parser, js, len, json->tokens, n);
+
+  /* Only unusually large responses leave the stack. jsmn resumes where it
+     stopped, so the tokens parsed so far are carried over. */
+  while (ret == JSMN_ERROR_NOMEM) {
+    jsmntok_t *tokens;
+    n = n * 2 + 1;
+    if (json->tokens == json->stack_tokens) {
+      tokens = malloc(sizeof(jsmntok_t) * n);
+      if (tokens != NULL)
+        memcpy(tokens, json->stack_tokens, sizeof(json->stack_tokens));
+    } else {
+      tokens = realloc(json->tokens, sizeof(jsmntok_t) * n);
+    }
+    if (tokens == NULL) {
+      codius_json_free(json);
+      return -1;
+    }
+    json->tokens = tokens;
+    ret = jsmn_parse(&parser, js, len, json->tokens, n);
+  }
 
-        state = KEY;
-        object_tokens = t->size;
+  if (ret < 0) {
+    codius_json_free(json);
+    return -1;
+  }
 
-        if (object_tokens == 0)
-          state = STOP;
+  json->ntokens = parser.toknext;
 
-        if (object_tokens % 2 != 0) {
-          printf("Invalid response: object must have even number of children.");
-          abort();
-        }
+  if (json->ntokens == 0 || json->tokens[0].type != JSMN_OBJECT ||
+      json_build_index(json) == -1) {
+    codius_json_free(json);
+    return -1;
+  }
 
-        break;
+  return 0;
+}
 
-      case KEY:
-        object_tokens--;
+void codius_json_free(codius_json_t *json) {
+  if (json->tokens != json->stack_tokens)
+    free(json->tokens);
+  json->tokens = json->stack_tokens;
+  json->ntokens = 0;
+}
 
-        if (t->type != JSMN_STRING) {
-          printf("Invalid response: object keys must be strings.");
-          abort();
-        }
+int codius_json_field(const codius_json_t *json, int object,
+                      const char *name) {
+  size_t name_len = strlen(name);
+  unsigned int slot;
+  int i, j, key;
+
+  if (codius_json_type(json, object) != JSMN_OBJECT)
+    return -1;
+
+  if (json->indexed) {
+    slot = json_hash(object, name, name_len);
+    for (i = 0; i < CODIUS_JSON_INDEX_SIZE; i++) {
+      slot &= CODIUS_JSON_INDEX_SIZE - 1;
+      key = json->index[slot].key;
+      if (key == 0)
+        return -1;
+      if (json->index[slot].parent == object &&
+          json_token_streq(json->js, &json->tokens[key], name, name_len))
+        return key + 1;
+      slot++;
+    }
+    return -1;
+  }
 
-        state = SKIP;
+  for (j = 0, i = object + 1; j < json->tokens[object].size / 2; j++) {
+    if (json_token_streq(json->js, &json->tokens[i], name, name_len))
+      return i + 1;
+    i = json_skip(json, i + 1);
+  }
 
-        if (json_token_streq(js, t, field_name)) {
-          state = RETVAL;
-        }
+  return -1;
+}
 
-        break;
+int codius_json_type(const codius_json_t *json, int tok) {
+  if (tok < 0 || tok >= json->ntokens)
+    return -1;
+  return json->tokens[tok].type;
+}
 
-      case SKIP:
-        if (t->type != JSMN_STRING && t->type != JSMN_PRIMITIVE) {
-          printf("Invalid response: object values must be strings or primitives.");
-          abort();
-        }
+int codius_json_int(const codius_json_t *json, int tok, int *value) {
+  const jsmntok_t *t;
+  char *end;
+  long v;
 
-        object_tokens--;
-        state = KEY;
+  if (codius_json_type(json, tok) != JSMN_PRIMITIVE)
+    return -1;
 
-        if (object_tokens == 0)
-          state = STOP;
+  t = &json->tokens[tok];
+  v = strtol(json->js + t->start, &end, 10);
+  if (end != json->js + t->end)
+    return -1;
 
-        break;
+  *value = (int) v;
+  return 0;
+}
 
-      case RETVAL:
-        return *t;
+// Returns buf length or -1 for error.
+int codius_json_str(const codius_json_t *json, int tok,
+                    char *buf, size_t buf_size) {
+  const jsmntok_t *t;
+  size_t len;
 
-      case STOP:
-        // Just consume the tokens
-        break;
+  if (codius_json_type(json, tok) != JSMN_STRING)
+    return -1;
 
-      default:
-        printf("Invalid state %u", state);
-        abort();
-    }
-  }
-  
-  // token not found
-  jsmntok_t niltoken = { 0 };
-  return niltoken;
+  t = &json->tokens[tok];
+  len = t->end - t->start;
+  if (buf_size < len)
+    return -1;
+
+  memcpy(buf, json->js + t->start, len);
+  if (buf_size > len)
+    buf[len] = '\0';
+
+  return len;
 }
 
-jsmntype_t codius_parse_json_type(char *js, size_t len, const char *field_name) {
-  if (len==0 || js==NULL) return -1;
+int codius_json_tm(const codius_json_t *json, int tok, struct tm *t) {
+  int gmtoff;
 
-  jsmntok_t *tokens = json_tokenise(js, len);
-  
-  typedef enum { START, KEY, RETVAL, SKIP, STOP } parse_state;
-  parse_state state = START;
+  if (codius_json_type(json, tok) != JSMN_OBJECT)
+    return -1;
 
-  size_t object_tokens = 0;
-  size_t i, j;
+#define JSON_TM_FIELD(field, dst)                                             \
+  if (codius_json_int(json, codius_json_field(json, tok, field), dst) == -1) \
+    return -1;
 
-  jsmntok_t t = codius_json_find_token(js, len, tokens, "result");
+  JSON_TM_FIELD("tm_sec", &t->tm_sec)
+  JSON_TM_FIELD("tm_min", &t->tm_min)
+  JSON_TM_FIELD("tm_hour", &t->tm_hour)
+  JSON_TM_FIELD("tm_mday", &t->tm_mday)
+  JSON_TM_FIELD("tm_mon", &t->tm_mon)
+  JSON_TM_FIELD("tm_year", &t->tm_year)
+  JSON_TM_FIELD("tm_wday", &t->tm_wday)
+  JSON_TM_FIELD("tm_yday", &t->tm_yday)
+  JSON_TM_FIELD("tm_isdst", &t->tm_isdst)
+  JSON_TM_FIELD("tm_gmtoff", &gmtoff)
 
-  if (t.start == 0 && t.end == 0) {
-    printf("Invalid response: token '%s' not found.", field_name);
-    abort();
-  }
+#undef JSON_TM_FIELD
 
-  jsmntype_t type = t.type;
+  t->tm_gmtoff = gmtoff;
 
-  free(tokens);
-  
-  return type;
+  //TODO-CODIUS: Get "tm_zone" string.
+
+  return 0;
 }
 
-int codius_parse_json_int(char *js, size_t len, const char *field_name) {
-  if (len==0 || js==NULL) return -1;
+jsmntype_t codius_parse_json_type(char *js, size_t len, const char *field_name) {
+  codius_json_t json;
+  int type;
 
-  jsmntok_t *tokens = json_tokenise(js, len);
+  if (codius_json_parse(&json, js, len) == -1)
+    return -1;
+  type = codius_json_type(&json, codius_json_field(&json, 0, field_name));
+  codius_json_free(&json);
 
-  jsmntok_t t = codius_json_find_token(js, len, tokens, field_name);
+  return type;
+}
 
-  if (t.start == 0 && t.end == 0) {
-    printf("Invalid response: token '%s' not found.", field_name);
-    abort();
-  }
+int codius_parse_json_int(char *js, size_t len, const char *field_name) {
+  codius_json_t json;
+  int value;
 
-  if (t.type != JSMN_PRIMITIVE) {
-    printf("Invalid response: object values must be primitives.");
-    abort();
-  }
+  if (codius_json_parse(&json, js, len) == -1)
+    return -1;
+  if (codius_json_int(&json, codius_json_field(&json, 0, field_name),
+                      &value) == -1)
+    value = -1;
+  codius_json_free(&json);
 
-  char *end;
-  long int value = strtol(js+t.start, &end, 10);
-  if (end != (js+t.end)) {
-    printf("Invalid response: response is not an integer.");
-    abort();
-  }
-  
-  free(tokens);
-  
   return value;
 }
 
 // Returns buf length or -1 for error.
 int codius_parse_json_str(char *js, size_t len, const char *field_name, char *buf, size_t buf_size) {
-  if (len==0 || js==NULL) return -1;
-  
-  jsmntok_t *tokens = json_tokenise(js, len);
-
-  jsmntok_t t = codius_json_find_token(js, len, tokens, field_name);
-
-  if (t.start == 0 && t.end == 0) {
-    printf("Invalid response: token '%s' not found.\n", field_name);
-    abort();
-  }
-  
-  if (t.type != JSMN_STRING) {
-    printf("Invalid response: object values must be strings or primitives.\n");
-    abort();
-  }
-
-  if (buf_size < t.end-t.start) {
-    printf("Insufficient buffer size: cannot copy %d byte message into %d byte buffer.\n", t.end-t.start, buf_size);
-    abort();
-  }
-  strncpy(buf, js+t.start, t.end-t.start);
+  codius_json_t json;
+  int ret;
 
-  free(tokens);
+  if (codius_json_parse(&json, js, len) == -1)
+    return -1;
+  ret = codius_json_str(&json, codius_json_field(&json, 0, field_name),
+                        buf, buf_size);
+  codius_json_free(&json);
 
-  return t.end-t.start;
+  return ret;
 }
 
 // Returns -1 for error.
 int codius_parse_json_tm(char *js, size_t len, const char *field_name, struct tm *t) {
-  if (len==0 || js==NULL) return -1;
-
-  jsmntok_t *tokens = json_tokenise(js, len);
+  codius_json_t json;
+  int ret;
 
-  jsmntok_t token = codius_json_find_token(js, len, tokens, field_name);
+  if (codius_json_parse(&json, js, len) == -1)
+    return -1;
+  ret = codius_json_tm(&json, codius_json_field(&json, 0, field_name), t);
+  codius_json_free(&json);
 
-  if (token.start == 0 && token.end == 0) {
-    printf("Invalid response: token '%s' not found.", field_name);
-    fflush(stdout);
-    abort();
-  }
-
-  if (token.type != JSMN_OBJECT) {
-    printf("Invalid response: field value must be an object.");
-    fflush(stdout);
-    abort();
-  }
-
-  char *field = js+token.start;
-  t->tm_sec = codius_parse_json_int(field, token.end-token.start, "tm_sec");
-  t->tm_min = codius_parse_json_int(field, token.end-token.start, "tm_min");
-  t->tm_hour = codius_parse_json_int(field, token.end-token.start, "tm_hour");
-  t->tm_mday = codius_parse_json_int(field, token.end-token.start, "tm_mday");
-  t->tm_mon = codius_parse_json_int(field, token.end-token.start, "tm_mon");
-  t->tm_year = codius_parse_json_int(field, token.end-token.start, "tm_year");
-  t->tm_wday = codius_parse_json_int(field, token.end-token.start, "tm_wday");
-  t->tm_yday = codius_parse_json_int(field, token.end-token.start, "tm_yday");
-  t->tm_isdst = codius_parse_json_int(field, token.end-token.start, "tm_isdst");
-  t->tm_gmtoff = codius_parse_json_int(field, token.end-token.start, "tm_gmtoff");
-  
-  //TODO-CODIUS: Get "tm_zone" string.
-
-  free(tokens);
-  
-  return 0;
-}
\ No newline at end of file
+  return ret;
+}
@@ -0,0 +1,243 @@
+//------------------------------------------------------------------------------
+/*
+    This file is part of Codius: https://github.com/codius
+    Copyright (c) 2014 Ripple Labs Inc.
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose  with  or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE  SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH  REGARD  TO  THIS  SOFTWARE  INCLUDING  ALL  IMPLIED  WARRANTIES  OF
+    MERCHANTABILITY  AND  FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY  SPECIAL ,  DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER  RESULTING  FROM  LOSS  OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION  OF  CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+//==============================================================================
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codius-util.h"
+
+/* See the description of receive rings in codius-util.h. */
+
+typedef struct codius_recv_ring_s codius_recv_ring_t;
+
+struct codius_recv_ring_s {
+  char *data;       /* Allocated when the first data arrives. */
+  size_t size;      /* Size of data, a power of two up to the window. */
+  size_t begin;     /* Offset of the first unread byte. */
+  size_t used;      /* Bytes stored and not yet read. */
+  size_t unacked;   /* Bytes read since credit was last handed back. */
+  int status;       /* What ended the stream, or 0. */
+};
+
+/* Rings by fd. Socket fds are small, so a table will do. */
+static codius_recv_ring_t **rings;
+static int rings_len;
+
+
+static codius_recv_ring_t *codius_recv_ring(int fd) {
+  if (fd < 0 || fd >= rings_len)
+    return NULL;
+  return rings[fd];
+}
+
+
+/* Make room for len more bytes, growing the buffer while the reader lags
+   behind. Most sockets never need the whole window. */
+static int codius_recv_reserve(codius_recv_ring_t *ring, size_t len) {
+  size_t size, first;
+  char *data;
+
+  if (ring->used + len <= ring->size)
+    return 0;
+
+  size = ring->size ? ring->size : CODIUS_RECV_INITIAL_SIZE;
+  while (size < ring->used + len)
+    size *= 2;
+  data = (char*) malloc(size);
+  if (data == NULL)
+    return -1;
+
+  /* Unwrap what is still unread into the new buffer. */
+  first = ring->size - ring->begin;
+  if (first > ring->used)
+    first = ring->used;
+  if (ring->used > 0) {
+    memcpy(data, ring->data + ring->begin, first);
+    memcpy(data + first, ring->data, ring->used - first);
+  }
+  free(ring->data);
+  ring->data = data;
+  ring->size = size;
+  ring->begin = 0;
+
+  return 0;
+}
+
+
+static int codius_recv_credit(int fd, size_t bytes) {
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_NET_CREDIT);
+  codius_rpc_add_int32(&msg, fd);
+  codius_rpc_add_int32(&msg, (int32_t) bytes);
+
+  if (-1==codius_rpc_call(&msg, &reply))
+    return -1;
+  codius_rpc_reply_free(&reply);
+
+  return reply.result < 0 ? -1 : 0;
+}
+
+
+int codius_recv_open(int fd) {
+  codius_recv_ring_t **grown;
+  int len;
+
+  if (fd < 0)
+    return -1;
+
+  if (fd >= rings_len) {
+    len = rings_len ? rings_len : 16;
+    while (len <= fd)
+      len *= 2;
+    grown = (codius_recv_ring_t**) realloc(rings, len * sizeof(*rings));
+    if (grown == NULL)
+      return -1;
+    memset(grown + rings_len, 0, (len - rings_len) * sizeof(*rings));
+    rings = grown;
+    rings_len = len;
+  }
+
+  if (rings[fd] != NULL)
+    return 0;
+
+  rings[fd] = (codius_recv_ring_t*) calloc(1, sizeof(**rings));
+  if (rings[fd] == NULL)
+    return -1;
+
+  /* Data can be pushed from here on. */
+  if (-1==codius_recv_credit(fd, CODIUS_RECV_WINDOW)) {
+    free(rings[fd]);
+    rings[fd] = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int codius_recv_active(int fd) {
+  return codius_recv_ring(fd) != NULL;
+}
+
+
+int codius_recv_pending(int fd) {
+  codius_recv_ring_t *ring = codius_recv_ring(fd);
+
+  return ring != NULL && (ring->used > 0 || ring->status != 0);
+}
+
+
+ssize_t codius_recv_read(int fd, char *buf, size_t len) {
+  codius_recv_ring_t *ring = codius_recv_ring(fd);
+  size_t n, first;
+
+  if (ring == NULL)
+    return -EBADF;
+
+  n = ring->used;
+  if (n == 0)
+    return ring->status != 0 ? ring->status : -EAGAIN;
+  if (n > len)
+    n = len;
+
+  /* The data may wrap around the end of the ring. */
+  first = ring->size - ring->begin;
+  if (first > n)
+    first = n;
+  memcpy(buf, ring->data + ring->begin, first);
+  memcpy(buf + first, ring->data, n - first);
+  ring->begin = (ring->begin + n) & (ring->size - 1);
+  ring->used -= n;
+
+  /* Hand the credit back in large steps, so that it costs a round trip per
+     half window rather than per read. */
+  ring->unacked += n;
+  if (ring->unacked >= CODIUS_RECV_WINDOW / 2 && ring->status == 0) {
+    size_t unacked = ring->unacked;
+    ring->unacked = 0;
+    codius_recv_credit(fd, unacked);
+  }
+
+  return n;
+}
+
+
+void codius_recv_close(int fd) {
+  codius_recv_ring_t *ring = codius_recv_ring(fd);
+
+  if (ring != NULL) {
+    free(ring->data);
+    free(ring);
+    rings[fd] = NULL;
+  }
+}
+
+
+int codius_recv_frame(size_t size) {
+  codius_recv_ring_t *ring;
+  int32_t prefix[2];
+  size_t offset, first;
+  char discard[256];
+  int overrun;
+
+  if (size < sizeof(prefix) ||
+      -1==codius_channel_read((char*) prefix, sizeof(prefix)))
+    return -1;
+  size -= sizeof(prefix);
+
+  ring = codius_recv_ring(prefix[0]);
+  overrun = ring != NULL && ring->status == 0 &&
+            (size > CODIUS_RECV_WINDOW - ring->used ||
+             -1==codius_recv_reserve(ring, size));
+  if (ring == NULL || ring->status != 0 || overrun) {
+    /* Closed in the meantime, or the host overran its credit. The stream
+       has a hole after an overrun, so it ends in an error once what came
+       before is read. */
+    if (overrun)
+      ring->status = -EIO;
+    while (size > 0) {
+      first = size < sizeof(discard) ? size : sizeof(discard);
+      if (-1==codius_channel_read(discard, first))
+        return -1;
+      size -= first;
+    }
+    return prefix[0];
+  }
+
+  /* Nothing to store for a frame that only ends the stream. */
+  if (size > 0) {
+    offset = (ring->begin + ring->used) & (ring->size - 1);
+    first = ring->size - offset;
+    if (first > size)
+      first = size;
+    if (-1==codius_channel_read(ring->data + offset, first) ||
+        -1==codius_channel_read(ring->data, size - first))
+      return -1;
+    ring->used += size;
+  }
+
+  if (prefix[1] != 0)
+    ring->status = prefix[1];
+
+  return prefix[0];
+}
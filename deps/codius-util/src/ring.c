@@ -0,0 +1,300 @@
+//------------------------------------------------------------------------------
+/*
+    This file is part of Codius: https://github.com/codius
+    Copyright (c) 2014 Ripple Labs Inc.
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose  with  or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE  SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH  REGARD  TO  THIS  SOFTWARE  INCLUDING  ALL  IMPLIED  WARRANTIES  OF
+    MERCHANTABILITY  AND  FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY  SPECIAL ,  DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER  RESULTING  FROM  LOSS  OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION  OF  CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+//==============================================================================
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codius-util.h"
+
+/* See the description of the shared memory transport in codius-util.h. */
+
+typedef struct codius_ring_field_s codius_ring_field_t;
+typedef struct codius_ring_s codius_ring_t;
+
+struct codius_ring_field_s {
+  volatile uint32_t value;
+  volatile uint32_t check;  /* ~value once the field is written in full. */
+  char pad[CODIUS_CACHE_LINE_SIZE - 8];
+};
+
+struct codius_ring_s {
+  codius_ring_field_t head;              /* Written by the producer. */
+  codius_ring_field_t tail;              /* Written by the consumer. */
+  codius_ring_field_t consumer_waiting;  /* Consumer sleeps until data. */
+  codius_ring_field_t producer_waiting;  /* Producer sleeps until space. */
+};
+
+static int ring_state;  /* 0 not initialized, 1 active, -1 unavailable. */
+static uint32_t ring_size;
+static codius_ring_t *request_ring;
+static codius_ring_t *response_ring;
+static char *request_data;
+static char *response_data;
+
+
+static int codius_ring_map(void) {
+  const char *env = getenv("CODIUS_SHM_FD");
+  struct stat st;
+  uint32_t *header;
+  char *base;
+  int fd;
+
+  if (env == NULL)
+    return -1;
+
+  fd = atoi(env);
+  if (fd <= 0 || fstat(fd, &st) == -1)
+    return -1;
+
+  base = (char*) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  /* The runner lays out the region and writes the header last. */
+  header = (uint32_t*) base;
+  ring_size = header[1];
+  if (header[0] != CODIUS_SHM_MAGIC ||
+      ring_size == 0 || (ring_size & (ring_size - 1)) != 0 ||
+      (size_t) st.st_size < CODIUS_CACHE_LINE_SIZE +
+                            2 * (CODIUS_RING_HEADER_SIZE + (size_t) ring_size)) {
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  request_ring = (codius_ring_t*) (base + CODIUS_CACHE_LINE_SIZE);
+  request_data = (char*) request_ring + CODIUS_RING_HEADER_SIZE;
+  response_ring = (codius_ring_t*) (request_data + ring_size);
+  response_data = (char*) response_ring + CODIUS_RING_HEADER_SIZE;
+
+  return 0;
+}
+
+
+int codius_ring_active(void) {
+  if (ring_state == 0)
+    ring_state = codius_ring_map() == 0 ? 1 : -1;
+  return ring_state == 1;
+}
+
+
+/* Read a field once its value and check agree, i.e. no write to it is half
+   done. */
+static uint32_t codius_ring_load(const codius_ring_field_t *field) {
+  uint32_t value;
+  int i;
+
+  for (i = 0;; i++) {
+    value = field->value;
+    __sync_synchronize();
+    if (field->check == ~value)
+      return value;
+    /* The host may have been preempted in the middle of its write. */
+    if (i >= CODIUS_RING_SPIN)
+      sched_yield();
+  }
+}
+
+
+static void codius_ring_store(codius_ring_field_t *field, uint32_t value) {
+  field->value = value;
+  field->check = ~value;
+  __sync_synchronize();
+}
+
+
+static int codius_has_data(void) {
+  return codius_ring_load(&response_ring->head) !=
+         codius_ring_load(&response_ring->tail);
+}
+
+
+static int codius_has_space(void) {
+  return codius_ring_load(&request_ring->head) -
+         codius_ring_load(&request_ring->tail) < ring_size;
+}
+
+
+static void codius_ring_doorbell(void) {
+  const int doorbell_fd = 3;
+  ssize_t n;
+
+  do
+    n = write(doorbell_fd, "", 1);
+  while (n == -1 && errno == EINTR);
+}
+
+
+/* Ring the doorbell if the host went to sleep waiting for what we just
+   did. */
+static void codius_ring_notify(codius_ring_field_t *waiting) {
+  __sync_synchronize();
+  if (codius_ring_load(waiting))
+    codius_ring_doorbell();
+}
+
+
+static int64_t codius_ring_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Wait up to timeout milliseconds (-1 for no limit) for ready() to hold.
+   Spins briefly first (unless polling), since the host usually answers
+   within a few microseconds. Returns 1 once ready, 0 on timeout or -1 for
+   error. */
+static int codius_ring_wait(codius_ring_field_t *waiting, int (*ready)(void),
+                            int timeout) {
+  const int doorbell_fd = 3;
+  struct pollfd pfd;
+  int64_t deadline = timeout < 0 ? -1 : codius_ring_now() + timeout;
+  int64_t left;
+  char drain[64];
+  int i, n, slice;
+
+  for (i = 0; timeout != 0 && i < CODIUS_RING_SPIN; i++) {
+    if (ready())
+      return 1;
+  }
+
+  for (;;) {
+    codius_ring_store(waiting, 1);
+    if (ready()) {
+      codius_ring_store(waiting, 0);
+      return 1;
+    }
+
+    slice = CODIUS_RING_SLEEP_MS;
+    if (deadline >= 0) {
+      left = deadline - codius_ring_now();
+      if (left < slice)
+        slice = left > 0 ? (int) left : 0;
+    }
+
+    pfd.fd = doorbell_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    n = poll(&pfd, 1, slice);
+    codius_ring_store(waiting, 0);
+
+    if (n == -1 && errno != EINTR)
+      return -1;
+    /* Doorbells carry nothing, take all that came in. Without any, the
+       host is gone. */
+    if (n > 0 && read(doorbell_fd, drain, sizeof(drain)) <= 0)
+      return -1;
+
+    if (ready())
+      return 1;
+    if (deadline >= 0 && codius_ring_now() >= deadline)
+      return 0;
+
+    /* Our doorbell may have gone unnoticed, ask again. */
+    if (n == 0 && codius_ring_load(&request_ring->head) !=
+                  codius_ring_load(&request_ring->tail))
+      codius_ring_doorbell();
+  }
+}
+
+
+int codius_ring_writev(const struct iovec *iov, int iovcnt) {
+  const char *src;
+  size_t len;
+  uint32_t head, space, n, offset;
+
+  for (; iovcnt > 0; iov++, iovcnt--) {
+    src = (const char*) iov->iov_base;
+    len = iov->iov_len;
+
+    while (len > 0) {
+      if (!codius_has_space() &&
+          codius_ring_wait(&request_ring->producer_waiting,
+                           codius_has_space, -1) != 1)
+        return -1;
+
+      head = codius_ring_load(&request_ring->head);
+      space = ring_size - (head - codius_ring_load(&request_ring->tail));
+      n = len < space ? len : space;
+      offset = head & (ring_size - 1);
+      if (n > ring_size - offset)
+        n = ring_size - offset;
+
+      memcpy(request_data + offset, src, n);
+      __sync_synchronize();
+      codius_ring_store(&request_ring->head, head + n);
+      codius_ring_notify(&request_ring->consumer_waiting);
+
+      src += n;
+      len -= n;
+    }
+  }
+
+  return 0;
+}
+
+
+int codius_ring_read(char *buf, size_t len) {
+  uint32_t tail, avail, n, offset;
+
+  while (len > 0) {
+    if (!codius_has_data() &&
+        codius_ring_wait(&response_ring->consumer_waiting,
+                         codius_has_data, -1) != 1)
+      return -1;
+
+    tail = codius_ring_load(&response_ring->tail);
+    avail = codius_ring_load(&response_ring->head) - tail;
+    if (avail > ring_size) {
+      printf("Invalid response ring head from the host\n");
+      return -1;
+    }
+    n = len < avail ? len : avail;
+    offset = tail & (ring_size - 1);
+    if (n > ring_size - offset)
+      n = ring_size - offset;
+
+    memcpy(buf, response_data + offset, n);
+    codius_ring_store(&response_ring->tail, tail + n);
+    codius_ring_notify(&response_ring->producer_waiting);
+
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+int codius_ring_poll(int timeout) {
+  if (codius_has_data())
+    return 1;
+  return codius_ring_wait(&response_ring->consumer_waiting, codius_has_data,
+                          timeout);
+}
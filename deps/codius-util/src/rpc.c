@@ -0,0 +1,212 @@
+//------------------------------------------------------------------------------
+/*
+    This file is part of Codius: https://github.com/codius
+    Copyright (c) 2014 Ripple Labs Inc.
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose  with  or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE  SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH  REGARD  TO  THIS  SOFTWARE  INCLUDING  ALL  IMPLIED  WARRANTIES  OF
+    MERCHANTABILITY  AND  FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY  SPECIAL ,  DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER  RESULTING  FROM  LOSS  OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION  OF  CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codius-util.h"
+
+/* Both ends of the channel are little-endian (x86 NaCl and the host), so
+   values are copied in native byte order. */
+
+static void codius_rpc_append(codius_rpc_msg_t *msg, const void *data,
+                              size_t len) {
+  if (msg->overflow || msg->size - msg->len < len) {
+    msg->overflow = 1;
+    return;
+  }
+  memcpy(msg->base + msg->len, data, len);
+  msg->len += len;
+}
+
+static void codius_rpc_append_u32(codius_rpc_msg_t *msg, uint32_t value) {
+  codius_rpc_append(msg, &value, sizeof(value));
+}
+
+void codius_rpc_msg_init(codius_rpc_msg_t *msg, char *buf, size_t size,
+                         codius_rpc_method_t method) {
+  msg->base = buf;
+  msg->len = 0;
+  msg->size = size;
+  msg->count = 0;
+  msg->overflow = 0;
+
+  codius_rpc_append_u32(msg, method);
+  /* Placeholder for the value count, filled in by codius_rpc_call. */
+  codius_rpc_append_u32(msg, 0);
+}
+
+void codius_rpc_add_int32(codius_rpc_msg_t *msg, int32_t value) {
+  codius_rpc_append_u32(msg, CODIUS_RPC_INT32);
+  codius_rpc_append(msg, &value, sizeof(value));
+  msg->count++;
+}
+
+void codius_rpc_add_double(codius_rpc_msg_t *msg, double value) {
+  codius_rpc_append_u32(msg, CODIUS_RPC_DOUBLE);
+  codius_rpc_append(msg, &value, sizeof(value));
+  msg->count++;
+}
+
+void codius_rpc_add_string(codius_rpc_msg_t *msg, const char *str,
+                           size_t len) {
+  codius_rpc_append_u32(msg, CODIUS_RPC_STRING);
+  codius_rpc_append_u32(msg, len);
+  codius_rpc_append(msg, str, len);
+  msg->count++;
+}
+
+int codius_rpc_msg_finish(codius_rpc_msg_t *msg) {
+  if (msg->overflow) {
+    printf("Binary RPC message exceeds %u byte buffer.\n",
+           (unsigned int) msg->size);
+    return -1;
+  }
+
+  /* The value count is only known once all arguments have been added. */
+  memcpy(msg->base + 4, &msg->count, sizeof(msg->count));
+  return 0;
+}
+
+/* Walk over one value starting at pos. Returns a pointer past it, or NULL if
+   it does not fit before end. */
+static const char *codius_rpc_skip_value(const char *pos, const char *end) {
+  uint32_t type;
+  uint32_t len;
+
+  if (end - pos < 4)
+    return NULL;
+  memcpy(&type, pos, sizeof(type));
+  pos += 4;
+
+  switch (type) {
+    case CODIUS_RPC_INT32:
+      len = 4;
+      break;
+    case CODIUS_RPC_DOUBLE:
+      len = 8;
+      break;
+    case CODIUS_RPC_STRING:
+      if (end - pos < 4)
+        return NULL;
+      memcpy(&len, pos, sizeof(len));
+      pos += 4;
+      break;
+    default:
+      return NULL;
+  }
+
+  if ((size_t) (end - pos) < len)
+    return NULL;
+
+  return pos + len;
+}
+
+int codius_rpc_reply_parse(codius_rpc_reply_t *reply, char *buf, size_t len) {
+  const char *pos;
+  const char *end = buf + len;
+  uint32_t i;
+
+  if (len < 8)
+    return -1;
+
+  memcpy(&reply->result, buf, sizeof(reply->result));
+  memcpy(&reply->count, buf + 4, sizeof(reply->count));
+
+  /* Validate all values up front so the getters can trust the layout. */
+  pos = buf + 8;
+  for (i = 0; i < reply->count; i++) {
+    pos = codius_rpc_skip_value(pos, end);
+    if (pos == NULL)
+      return -1;
+  }
+
+  reply->pos = buf + 8;
+  reply->end = pos;
+  reply->payload = pos;
+  reply->payload_len = end - pos;
+  reply->buf = buf;
+
+  return 0;
+}
+
+/* Return a pointer to the data of the next value if it has the given type. */
+static const char *codius_rpc_next(codius_rpc_reply_t *reply,
+                                   codius_rpc_type_t type) {
+  const char *data;
+  uint32_t actual;
+
+  if (reply->pos >= reply->end)
+    return NULL;
+
+  memcpy(&actual, reply->pos, sizeof(actual));
+  if (actual != type)
+    return NULL;
+
+  data = reply->pos + 4;
+  reply->pos = codius_rpc_skip_value(reply->pos, reply->end);
+
+  return data;
+}
+
+int codius_rpc_get_int32(codius_rpc_reply_t *reply, int32_t *value) {
+  const char *data = codius_rpc_next(reply, CODIUS_RPC_INT32);
+  if (data == NULL)
+    return -1;
+  memcpy(value, data, sizeof(*value));
+  return 0;
+}
+
+int codius_rpc_get_double(codius_rpc_reply_t *reply, double *value) {
+  const char *data = codius_rpc_next(reply, CODIUS_RPC_DOUBLE);
+  if (data == NULL)
+    return -1;
+  memcpy(value, data, sizeof(*value));
+  return 0;
+}
+
+int codius_rpc_get_string(codius_rpc_reply_t *reply,
+                          const char **str, size_t *len) {
+  uint32_t str_len;
+  const char *data = codius_rpc_next(reply, CODIUS_RPC_STRING);
+  if (data == NULL)
+    return -1;
+  memcpy(&str_len, data, sizeof(str_len));
+  *str = data + 4;
+  *len = str_len;
+  return 0;
+}
+
+int codius_rpc_get_number(codius_rpc_reply_t *reply, double *value) {
+  int32_t i;
+
+  if (codius_rpc_get_int32(reply, &i) == 0) {
+    *value = i;
+    return 0;
+  }
+  return codius_rpc_get_double(reply, value);
+}
+
+void codius_rpc_reply_free(codius_rpc_reply_t *reply) {
+  /* NULL if the response is in the shared response buffer or was read
+     straight into a caller's buffer. */
+  free(reply->buf);
+  reply->buf = NULL;
+}
@@ -160,8 +160,6 @@ int RAND_poll(void)
   	fflush(stdout);
   	return 0;
   }
-  
-  free(resp_buf);
 
   //hex to string
   unsigned char buf[ENTROPY_NEEDED];
@@ -215,15 +215,6 @@ typedef struct uv_fs_poll_s uv_fs_poll_t;
 typedef struct uv_signal_s uv_signal_t;
 
 
-typedef struct codius_rpc_header_s codius_rpc_header_t;
-
-struct codius_rpc_header_s {
-  unsigned long magic_bytes;
-  unsigned long callback_id;
-  unsigned long size;
-};
-
-
 /* Request types. */
 typedef struct uv_req_s uv_req_t;
 typedef struct uv_getaddrinfo_s uv_getaddrinfo_t;
@@ -1729,6 +1720,15 @@ UV_EXTERN int uv_queue_work(uv_loop_t* loop,
                             size_t buf_len,
                             uv_after_work_cb after_work_cb);
 
+/* Like uv_queue_work, but buf is a binary RPC request (see codius-util.h) and
+ * the response passed to after_work_cb is binary as well.
+ */
+UV_EXTERN int uv_queue_binary_work(uv_loop_t* loop,
+                                   uv_work_t* req,
+                                   const char *buf,
+                                   size_t buf_len,
+                                   uv_after_work_cb after_work_cb);
+
 /* Cancel a pending request. Fails if the request is executing or has finished
  * executing.
  *
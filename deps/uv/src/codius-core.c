@@ -19,35 +19,179 @@
 
 #include "uv.h"
 #include "internal.h"
+#include "codius-util.h"
+#include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define UV__CODIUS_POLL_BATCH 256
+
+typedef struct {
+  codius_event_t entries[UV__CODIUS_POLL_BATCH];
+  int n;
+} uv__poll_batch_t;
+
+static unsigned int uv__codius_events(unsigned int pevents) {
+  unsigned int events = 0;
+
+  if (pevents & UV__POLLIN)
+    events |= CODIUS_EVENT_READABLE;
+  if (pevents & UV__POLLOUT)
+    events |= CODIUS_EVENT_WRITABLE;
+
+  return events;
+}
+
+static void uv__io_poll_fd(uv_loop_t* loop, int fd, unsigned int events) {
+  uv__io_t* w;
+  unsigned int pevents = 0;
+
+  if (events & CODIUS_EVENT_READABLE)
+    pevents |= UV__POLLIN;
+  if (events & CODIUS_EVENT_WRITABLE)
+    pevents |= UV__POLLOUT;
+
+  /* Stale events for closed or stopped fds are dropped. */
+  if (fd < 0 || (unsigned) fd >= loop->nwatchers)
+    return;
+
+  w = loop->watchers[fd];
+  if (w == NULL)
+    return;
+
+  pevents &= w->pevents;
+  if (pevents != 0)
+    w->cb(loop, w, pevents);
+}
+
+/* Ask the host which of the batched fds are ready in a single round trip and
+ * run the callbacks of those that are.
+ */
+static void uv__io_poll_flush(uv_loop_t* loop, uv__poll_batch_t* batch) {
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  unsigned char ready[UV__CODIUS_POLL_BATCH / 8];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  struct iovec iov;
+  int n;
+
+  if (batch->n == 0)
+    return;
+
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_NET_POLL);
+  iov.iov_base = batch->entries;
+  iov.iov_len = batch->n * sizeof(batch->entries[0]);
+
+  if (codius_rpc_callv(&msg, &iov, 1, (char*) ready, sizeof(ready), &reply)) {
+    /* Without an answer, treat everything as ready and let the callbacks
+     * find out for themselves.
+     */
+    memset(ready, 0xff, sizeof(ready));
+  } else {
+    if (reply.result < 0 || reply.payload_len < (size_t) (batch->n + 7) / 8)
+      memset(ready, 0xff, sizeof(ready));
+    codius_rpc_reply_free(&reply);
+  }
+
+  /* Data the host already pushed into a receive ring is ready as well. */
+  for (n = 0; n < batch->n; n++)
+    if ((ready[n >> 3] & (1 << (n & 7))) ||
+        ((batch->entries[n].events & CODIUS_EVENT_READABLE) &&
+         codius_recv_pending(batch->entries[n].fd)))
+      uv__io_poll_fd(loop, batch->entries[n].fd, batch->entries[n].events);
+
+  batch->n = 0;
+}
+
+static void uv__io_poll_add(uv_loop_t* loop,
+                            uv__poll_batch_t* batch,
+                            int fd,
+                            unsigned int pevents) {
+  if (batch->n == UV__CODIUS_POLL_BATCH)
+    uv__io_poll_flush(loop, batch);
+
+  batch->entries[batch->n].fd = fd;
+  batch->entries[batch->n].events = uv__codius_events(pevents);
+  batch->n++;
+}
+
 void uv__io_poll(uv_loop_t* loop, int timeout) {
-  uv__io_t* watcher;
+  codius_event_t events[256];
+  uv__poll_batch_t batch;
+  uv__io_t* w;
+  unsigned int events_changed;
+  QUEUE queue;
+  QUEUE* q;
+  unsigned int i;
+  int nevents;
+  int n;
 
   if (loop->nfds == 0) {
     assert(QUEUE_EMPTY(&loop->watcher_queue));
     return;
   }
 
+  /* Watchers on loop->watcher_queue have changed interest since the last
+   * poll. The host only pushes events for changes it sees, so whether any of
+   * them became ready before we started watching is asked for in one batched
+   * poll call. That may find work to do now, so we must not block. After
+   * that, POLLOUT waiters block like everyone else until the host pushes a
+   * writable event when their socket drains.
+   */
+  if (!QUEUE_EMPTY(&loop->watcher_queue))
+    timeout = 0;
+
+  nevents = codius_wait_events(events, ARRAY_SIZE(events), timeout);
+  if (nevents == -1) {
+    if (errno != EINTR)
+      abort();
+    nevents = 0;
+  }
+
+  if (timeout != 0)
+    uv__update_time(loop);
+
+  batch.n = 0;
+
   // QUEUE_FOREACH is unsafe if the the callback removes the watcher from the
   // queue. So instead we do this.
-  assert(!QUEUE_EMPTY(&loop->watcher_queue));
-  QUEUE queue;
-  QUEUE* q = QUEUE_HEAD(&loop->watcher_queue);
-  QUEUE_SPLIT(&loop->watcher_queue, q, &queue);
-  while (!QUEUE_EMPTY(&queue)) {
-    q = QUEUE_HEAD(&queue);
-    QUEUE_REMOVE(q);
-    QUEUE_INSERT_TAIL(&loop->watcher_queue, q);
+  if (!QUEUE_EMPTY(&loop->watcher_queue)) {
+    q = QUEUE_HEAD(&loop->watcher_queue);
+    QUEUE_SPLIT(&loop->watcher_queue, q, &queue);
+    while (!QUEUE_EMPTY(&queue)) {
+      q = QUEUE_HEAD(&queue);
+      QUEUE_REMOVE(q);
+      QUEUE_INIT(q);
 
-    watcher = QUEUE_DATA(q, uv__io_t, watcher_queue);
+      w = QUEUE_DATA(q, uv__io_t, watcher_queue);
+      assert(w->pevents != 0);
+      assert(w->fd >= 0);
+      assert(w->fd < (int) loop->nwatchers);
 
-    assert(watcher->fd >= 0);
-    assert(watcher->fd < (int) loop->nwatchers);
+      events_changed = w->pevents & ~w->events;
+      w->events = w->pevents;
+      if (events_changed != 0)
+        uv__io_poll_add(loop, &batch, w->fd, events_changed);
+    }
+  }
+
+  for (n = 0; n < nevents; n++) {
+    if (events[n].fd != -1) {
+      uv__io_poll_fd(loop, events[n].fd, events[n].events);
+      continue;
+    }
 
-    if (watcher->pevents & (UV__POLLIN | UV__POLLOUT)) {
-      watcher->cb(loop, watcher, watcher->pevents & (UV__POLLIN | UV__POLLOUT));
+    /* The host sent more events than could be queued, so ask about every
+     * readable watcher.
+     */
+    for (i = 0; i < loop->nwatchers; i++) {
+      w = loop->watchers[i];
+      if (w != NULL && (w->pevents & UV__POLLIN))
+        uv__io_poll_add(loop, &batch, i, UV__POLLIN);
     }
   }
+
+  uv__io_poll_flush(loop, &batch);
 }
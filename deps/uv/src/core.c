@@ -21,6 +21,7 @@
 
 #include "uv.h"
 #include "internal.h"
+#include "codius-util.h"
 
 #include <stddef.h> /* NULL */
 #include <stdio.h> /* printf */
@@ -348,27 +349,24 @@ int uv__socket(int domain, int type, int protocol) {
   int err;
 
   // Call socket outside the sandbox.
-  const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"socket\",\"data\":[%d, %d, %d]}";
-  char message [UV_SYNC_MAX_MESSAGE_SIZE];
-  int len;
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, domain, type, protocol);
-  if (len==-1) {
-    printf("Error forming socket message.\n");
-    abort();
-  }
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
 
-  char *resp_buf;
-  size_t resp_len;
-  int result = codius_sync_call(message, len, &resp_buf, &resp_len);
-  if (result==-1) {
+  codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_SOCKET);
+  codius_rpc_add_int32(&msg, domain);
+  codius_rpc_add_int32(&msg, type);
+  codius_rpc_add_int32(&msg, protocol);
+
+  if (codius_rpc_call(&msg, &reply) == -1) {
     return UV_EINVAL;
   }
 
-  sockfd = codius_parse_json_int(resp_buf, resp_len, "result");
+  sockfd = reply.result;
   
-  free(resp_buf);
+  codius_rpc_reply_free(&reply);
 
-  if (sockfd == -1)
+  if (sockfd < 0)
     return UV_EINVAL;
 
 #if defined(SO_NOSIGPIPE)
@@ -428,23 +426,19 @@ int uv__accept(int sockfd) {
 //       uv__close(peerfd);
 //       return err;
 //     }
-    const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"accept\",\"data\":[%d]}";
-    char message [UV_SYNC_MAX_MESSAGE_SIZE];
-    int len;
-    len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, sockfd);
-    if (len==-1) {
-      printf("Error forming socket message.");
-      abort();
-    }
-    char *resp_buf;
-    size_t resp_len;
-    int result = codius_sync_call(message, len, &resp_buf, &resp_len);
+    char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+    codius_rpc_msg_t msg;
+    codius_rpc_reply_t reply;
+
+    codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_ACCEPT);
+    codius_rpc_add_int32(&msg, sockfd);
+
+    int result = codius_rpc_call(&msg, &reply);
     assert(result != -1);
-    peerfd = codius_parse_json_int(resp_buf, resp_len, "result");
-    free(resp_buf);
-    if (peerfd == -1) {
-      return -peerfd;
-    }
+
+    /* Either the accepted fd or -errno, e.g. -EAGAIN if nothing is pending. */
+    peerfd = reply.result;
+    codius_rpc_reply_free(&reply);
 
     return peerfd;
   }
@@ -468,21 +462,20 @@ int uv__close(int fd) {
   // }
   //return rc;
   
-  const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"close\",\"data\":[%d]}";
-  char message[UV_SYNC_MAX_MESSAGE_SIZE];
-  int len;
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, fd);
-  if (len==-1) {
-    printf("Error forming socket message.");
-    abort();
-  }
-  char *resp_buf;
-  size_t resp_len;
-  int result = codius_sync_call(message, len, &resp_buf, &resp_len);
-  if (result==-1) {
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+
+  codius_recv_close(fd);
+
+  codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_CLOSE);
+  codius_rpc_add_int32(&msg, fd);
+
+  if (codius_rpc_call(&msg, &reply) == -1) {
     //TODO-CODIUS: handle error
+    return 0;
   }
-  free(resp_buf);
+  codius_rpc_reply_free(&reply);
 
   return 0;
 }
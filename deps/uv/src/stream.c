@@ -58,7 +58,6 @@ struct uv__stream_select_s {
 };
 #endif /* defined(__APPLE__) */
 
-static void uv__stream_connect(uv_stream_t*);
 static void uv__write(uv_stream_t* stream);
 static void uv__read(uv_stream_t* stream);
 static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events);
@@ -84,6 +83,7 @@ void uv__stream_init(uv_loop_t* loop,
   QUEUE_INIT(&stream->write_queue);
   QUEUE_INIT(&stream->write_completed_queue);
   stream->write_queue_size = 0;
+  stream->write_inflight_size = 0;
 
   // if (loop->emfile_fd == -1) {
   //   err = uv__open_cloexec("/", O_RDONLY);
@@ -128,6 +128,7 @@ void uv__stream_destroy(uv_stream_t* stream) {
   assert(stream->flags & UV_CLOSED);
 
   if (stream->connect_req) {
+    uv__work_forget(stream->loop, &stream->connect_req->work_req);
     uv__req_unregister(stream->loop, stream->connect_req);
     stream->connect_req->cb(stream->connect_req, -ECANCELED);
     stream->connect_req = NULL;
@@ -139,6 +140,8 @@ void uv__stream_destroy(uv_stream_t* stream) {
 
     req = QUEUE_DATA(q, uv_write_t, queue);
     req->error = -ECANCELED;
+    if (req->work_req.done != NULL)
+      uv__work_forget(stream->loop, &req->work_req);
 
     QUEUE_INSERT_TAIL(&stream->write_completed_queue, &req->queue);
   }
@@ -224,7 +227,10 @@ void uv__server_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
       return;
 #endif /* defined(UV_HAVE_KQUEUE) */
 
-    err = uv__accept(uv__stream_fd(stream));
+    if (stream->type == UV_TCP)
+      err = uv__tcp_accept((uv_tcp_t*) stream);
+    else
+      err = uv__accept(uv__stream_fd(stream));
     if (err < 0) {
       if (err == -EAGAIN || err == -EWOULDBLOCK)
         return;  /* Not an error. */
@@ -288,6 +294,8 @@ int uv_accept(uv_stream_t* server, uv_stream_t* client) {
         uv__close(server->accepted_fd);
         goto done;
       }
+      if (client->type == UV_TCP && server->type == UV_TCP)
+        uv__tcp_accepted((uv_tcp_t*) server, (uv_tcp_t*) client);
       break;
 
     // case UV_UDP:
@@ -453,6 +461,166 @@ static int uv__getiovmax() {
 #endif
 }
 
+/* Bytes of TCP writes a stream keeps with the host at a time. */
+#define UV__CODIUS_WRITE_WINDOW (1024 * 1024)
+
+/* Bytes of queued TCP write requests coalesced into one call. */
+#define UV__CODIUS_WRITE_BATCH (64 * 1024)
+
+
+/* Marks a request that rides along with the call of the request before it.
+ * Never called; the completion goes to the first request of the batch.
+ */
+static void uv__write_batched(struct uv__work* w,
+                              int status,
+                              const char* buf,
+                              size_t buf_len) {
+  abort();
+}
+
+
+/* Whether the request after q in the write queue is in the same batch. */
+static int uv__write_batch_next(uv_stream_t* stream, QUEUE* q) {
+  q = QUEUE_NEXT(q);
+  return q != &stream->write_queue &&
+         QUEUE_DATA(q, uv_write_t, queue)->work_req.done == uv__write_batched;
+}
+
+static void uv__write_done(struct uv__work* w,
+                           int status,
+                           const char* buf,
+                           size_t buf_len) {
+  uv_write_t* req = container_of(w, uv_write_t, work_req);
+  uv_stream_t* stream = req->handle;
+  codius_rpc_reply_t reply;
+  QUEUE* q;
+  QUEUE* next;
+  ssize_t n;
+  size_t size;
+  int more;
+
+  /* uv__stream_destroy cancels whatever is still queued. */
+  if (uv__is_closing(stream))
+    return;
+
+  q = &req->queue;
+  size = 0;
+  do {
+    size += uv__write_req_size(QUEUE_DATA(q, uv_write_t, queue));
+  } while (uv__write_batch_next(stream, q) && (q = QUEUE_NEXT(q)));
+  stream->write_inflight_size -= size;
+
+  /* Number of bytes the host socket took for the whole batch or -errno. */
+  if (status != 0)
+    n = status;
+  else if (buf == NULL ||
+           -1==codius_rpc_reply_parse(&reply, (char*) buf, buf_len))
+    n = -EIO;
+  else
+    n = reply.result;
+
+  /* The rest of a short write can't go out in order anymore, the batches
+   * behind it may already be with the host. The host answers with all or
+   * nothing, so fail the batch rather than resend its tail after them.
+   */
+  if (n >= 0 && (size_t) n != size)
+    n = -EIO;
+
+  q = &req->queue;
+  do {
+    req = QUEUE_DATA(q, uv_write_t, queue);
+    more = uv__write_batch_next(stream, q);
+    next = QUEUE_NEXT(q);
+    req->work_req.done = NULL;
+
+    if (n < 0) {
+      req->error = n;
+    } else {
+      stream->write_queue_size -= uv__write_req_size(req);
+      req->write_index = req->nbufs;
+    }
+    uv__write_req_finish(req);
+  } while (more && (q = next));
+}
+
+
+/* TCP writes go to the host as async calls, several per stream, so a large
+ * write does not hold up the loop. Each completes once the host socket has
+ * flushed it, which keeps the bytes the host still buffers in
+ * write_queue_size, and frees window for the requests behind it.
+ *
+ * Small requests queued back to back, like the headers and body chunks of
+ * an HTTP response, share one call of up to UV__CODIUS_WRITE_BATCH bytes.
+ */
+static void uv__write_submit(uv_stream_t* stream) {
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  uv_write_t* req;
+  uv_write_t* r;
+  QUEUE* q;
+  QUEUE* end;
+  size_t size;
+  int iovmax;
+  int iovcnt;
+  int i;
+  unsigned int k;
+
+  assert(sizeof(uv_buf_t) == sizeof(struct iovec));
+  iovmax = uv__getiovmax();
+
+  q = QUEUE_NEXT(&stream->write_queue);
+  while (q != &stream->write_queue &&
+         stream->write_inflight_size < UV__CODIUS_WRITE_WINDOW) {
+    req = QUEUE_DATA(q, uv_write_t, queue);
+    assert(req->handle == stream);
+
+    /* Already with the host. */
+    if (req->work_req.done != NULL) {
+      q = QUEUE_NEXT(q);
+      continue;
+    }
+
+    /* Take the requests behind this one while they fit the batch. */
+    size = uv__write_req_size(req);
+    iovcnt = 1 + req->nbufs - req->write_index;
+    for (end = QUEUE_NEXT(q); end != &stream->write_queue; end = QUEUE_NEXT(end)) {
+      r = QUEUE_DATA(end, uv_write_t, queue);
+      /* Never take a request that is already with the host. */
+      if (r->work_req.done != NULL)
+        break;
+      if (size + uv__write_req_size(r) > UV__CODIUS_WRITE_BATCH ||
+          iovcnt + (int) (r->nbufs - r->write_index) > iovmax)
+        break;
+      size += uv__write_req_size(r);
+      iovcnt += r->nbufs - r->write_index;
+    }
+
+    codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_WRITE);
+    codius_rpc_add_int32(&msg, uv__stream_fd(stream));
+    if (-1==codius_rpc_msg_finish(&msg))
+      abort();
+
+    /* The bufs are sent as the raw payload of the frame. */
+    struct iovec iov[iovcnt];
+
+    iov[0].iov_base = msg.base;
+    iov[0].iov_len = msg.len;
+    i = 1;
+    for (; q != end; q = QUEUE_NEXT(q)) {
+      r = QUEUE_DATA(q, uv_write_t, queue);
+      for (k = r->write_index; k < r->nbufs; k++)
+        iov[i++] = *(struct iovec*) &r->bufs[k];
+      if (r != req)
+        r->work_req.done = uv__write_batched;
+    }
+
+    stream->write_inflight_size += size;
+    uv__work_submitv(stream->loop, &req->work_req, CODIUS_MAGIC_BYTES_BINARY,
+                     iov, iovcnt, uv__write_done);
+  }
+}
+
+
 static void uv__write(uv_stream_t* stream) {
   struct iovec* iov;
   QUEUE* q;
@@ -461,6 +629,11 @@ static void uv__write(uv_stream_t* stream) {
   int iovcnt;
   ssize_t n;
 
+  if (stream->type == UV_TCP) {
+    uv__write_submit(stream);
+    return;
+  }
+
 start:
   assert(uv__stream_fd(stream) >= 0);
 
@@ -532,38 +705,7 @@ start:
     //   }
     // }
     // while (n == -1 && errno == EINTR);
-    if (stream->type == UV_TCP) {
-      /* Call Socket.write outside the codius sandbox. */
-      const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"write\",\"data\":[%d, \"%.*s\", \"%s\"]}";
-      const char* encoding = "hex";
-      char message [UV_SYNC_MAX_MESSAGE_SIZE];
-      int len;
-      char hex_buf[2*req->bufs[req->write_index].len+1];
-      
-      /* Encode message as hex */
-      int i;
-      for(i=0; i<req->bufs[req->write_index].len; i++) {
-        sprintf(hex_buf+i*2, "%02X", (unsigned char) req->bufs[req->write_index].base[i]);
-      }
-  
-      len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, 
-                      uv__stream_fd(stream), 2*req->bufs[req->write_index].len, hex_buf, encoding);
-      if (len==-1) {
-        printf("Error forming stream message.");
-        abort();
-      }
-      char *resp_buf;
-      size_t resp_len;
-      codius_sync_call(message, len, &resp_buf, &resp_len);
-      n = req->bufs[req->write_index].len;
-      free(resp_buf);
-      // if (resp_len==-1) {
-      //   return -errno;
-      // }
-      // r = uv_parse_json_int(resp_buf, resp_len);
-    } else {
-      n = write(uv__stream_fd(stream), req->bufs[req->write_index].base, req->bufs[req->write_index].len);
-    }
+    n = write(uv__stream_fd(stream), req->bufs[req->write_index].base, req->bufs[req->write_index].len);
   }
 
   if (n < 0) {
@@ -844,48 +986,20 @@ static void uv__read(uv_stream_t* stream) {
     assert(uv__stream_fd(stream) >= 0);
     if (!is_ipc) {
       if (stream->type == UV_TCP) {
-        const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"read\",\"data\":[%d, %d]}";
-        char message[UV_SYNC_MAX_MESSAGE_SIZE];
-        int len;
-        len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, uv__stream_fd(stream), buf.len);
-        if (len==-1) {
-          printf("Error forming socket message.");
-          abort();
-        }
-        char *resp_buf;
-        size_t resp_len;
-        int result = codius_sync_call(message, len, &resp_buf, &resp_len);
-        assert(result != -1);
-
-        char *hex_buf = (char*) calloc(buf.len*2, sizeof(char));
-        jsmntype_t result_type = codius_parse_json_type(resp_buf, resp_len, "result");
-        if (result_type == JSMN_STRING) {
-          nread = codius_parse_json_str(resp_buf, resp_len, "result", hex_buf, buf.len*2);
-          
-          assert(nread >= 0);
-          assert(nread <= buf.len*2);
-
-          //hex to string
-          char *src = hex_buf; 
-          char *dst = buf.base;
-          char *end = buf.base + nread/2;
-          unsigned int u = 0;
-          while (dst < end && sscanf(src, "%2x", &u) == 1) {
-            *dst++ = u;
-            src += 2;
-          }
-  
-          nread = nread / 2;
-        } else {
-          nread = codius_parse_json_int(resp_buf, resp_len, "result");
-          
-          if (nread < 0) {
-            errno = -nread;
-          }
+        /* The host pushes received data into the socket's receive ring, so
+         * reads are served from local memory. The first read sets the ring
+         * up.
+         */
+        if (!codius_recv_active(uv__stream_fd(stream))) {
+          int result = codius_recv_open(uv__stream_fd(stream));
+          assert(result != -1);
         }
-        
-        free(hex_buf);
-        free(resp_buf);
+
+        nread = codius_recv_read(uv__stream_fd(stream), buf.base, buf.len);
+        if (nread == CODIUS_RECV_EOF)
+          nread = 0;
+        else if (nread < 0)
+          errno = -nread;
       } else {
         do {
           nread = read(uv__stream_fd(stream), buf.base, buf.len);
@@ -994,10 +1108,9 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
          stream->type == UV_TTY);
   assert(!(stream->flags & UV_CLOSING));
 
-  if (stream->connect_req) {
-    uv__stream_connect(stream);
+  /* A connect finishes when its completion arrives, see uv__tcp_connect. */
+  if (stream->connect_req)
     return;
-  }
 
   assert(uv__stream_fd(stream) >= 0);
 
@@ -1041,34 +1154,18 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
  * In order to determine if we've errored out or succeeded must call
  * getsockopt.
  */
-static void uv__stream_connect(uv_stream_t* stream) {
+void uv__stream_connect(uv_stream_t* stream) {
   int error;
   uv_connect_t* req = stream->connect_req;
-  socklen_t errorsize = sizeof(int);
 
   assert(stream->type == UV_TCP || stream->type == UV_NAMED_PIPE);
   assert(req);
 
-  if (stream->delayed_error) {
-    /* To smooth over the differences between unixes errors that
-     * were reported synchronously on the first connect can be delayed
-     * until the next tick--which is now.
-     */
-    error = stream->delayed_error;
-    stream->delayed_error = 0;
-  } else {
-    /* Normal situation: we need to get the socket error from the kernel. */
-    assert(uv__stream_fd(stream) >= 0);
-    getsockopt(uv__stream_fd(stream),
-               SOL_SOCKET,
-               SO_ERROR,
-               &error,
-               &errorsize);
-    error = -error;
-  }
-
-  if (error == -EINPROGRESS)
-    return;
+  /* There is no socket error to ask the kernel for; the host reported the
+   * outcome in the completion, which left it in delayed_error.
+   */
+  error = stream->delayed_error;
+  stream->delayed_error = 0;
 
   stream->connect_req = NULL;
   uv__req_unregister(stream->loop, req);
@@ -1076,6 +1173,11 @@ static void uv__stream_connect(uv_stream_t* stream) {
 
   if (req->cb)
     req->cb(req, error);
+
+  /* Send whatever was written while connecting. */
+  if (error == 0 && !uv__is_closing(stream) &&
+      !QUEUE_EMPTY(&stream->write_queue))
+    uv__io_feed(stream->loop, &stream->io_watcher);
 }
 
 
@@ -1124,6 +1226,7 @@ int uv_write2(uv_write_t* req,
   req->handle = stream;
   req->error = 0;
   req->send_handle = send_handle;
+  req->work_req.done = NULL;
   QUEUE_INIT(&req->queue);
 
   req->bufs = req->bufsml;
@@ -1149,7 +1252,8 @@ int uv_write2(uv_write_t* req,
   if (stream->connect_req) {
     /* Still connecting, do nothing. */
   }
-  else if (empty_queue) {
+  else if (empty_queue || stream->type == UV_TCP) {
+    /* TCP writes are pipelined, see uv__write_submit. */
     uv__write(stream);
   }
   else {
@@ -1198,6 +1302,10 @@ int uv_try_write(uv_stream_t* stream,
   if (stream->connect_req != NULL || stream->write_queue_size != 0)
     return -EAGAIN;
 
+  /* TCP writes only ever complete asynchronously. */
+  if (stream->type == UV_TCP)
+    return -EAGAIN;
+
   has_pollout = uv__io_active(&stream->io_watcher, UV__POLLOUT);
 
   r = uv_write(&req, stream, bufs, nbufs, uv_try_write_cb);
@@ -25,18 +25,129 @@
 #include "codius-util.h"
 #include <netinet/in.h>
 
+#include <arpa/inet.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
 
 
+/* Connections accepted per NET_ACCEPT_BATCH call. */
+#define UV__TCP_ACCEPT_BATCH 32
+
+typedef struct uv__tcp_accept_batch_s uv__tcp_accept_batch_t;
+
+/* Connections the host handed over that the server has not passed on yet,
+ * with their peers.
+ */
+struct uv__tcp_accept_batch_s {
+  unsigned int count;
+  unsigned int next;
+  struct {
+    int fd;
+    struct sockaddr_in peer;
+  } conns[UV__TCP_ACCEPT_BATCH];
+};
+
+
 int uv_tcp_init(uv_loop_t* loop, uv_tcp_t* tcp) {
   uv__stream_init(loop, (uv_stream_t*)tcp, UV_TCP);
+  memset(&tcp->peer, 0, sizeof(tcp->peer));
+  tcp->accept_batch = NULL;
   return 0;
 }
 
 
+/* Fetch the connections pending on server, with their peers, in one call. */
+static int uv__tcp_accept_fill(uv_tcp_t* server,
+                               uv__tcp_accept_batch_t* batch) {
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  char address[INET_ADDRSTRLEN];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  const char* address_str;
+  size_t address_len;
+  int32_t fd, family, port;
+  int result;
+
+  codius_rpc_msg_init(&msg, message, sizeof(message),
+                      CODIUS_RPC_NET_ACCEPT_BATCH);
+  codius_rpc_add_int32(&msg, uv__stream_fd(server));
+  codius_rpc_add_int32(&msg, UV__TCP_ACCEPT_BATCH);
+
+  result = codius_rpc_call(&msg, &reply);
+  assert(result != -1);
+
+  result = reply.result;
+  batch->count = 0;
+  batch->next = 0;
+
+  while (result >= 0 && batch->count < UV__TCP_ACCEPT_BATCH &&
+         codius_rpc_get_int32(&reply, &fd) != -1) {
+    if (codius_rpc_get_int32(&reply, &family) == -1 ||
+        codius_rpc_get_int32(&reply, &port) == -1 ||
+        codius_rpc_get_string(&reply, &address_str, &address_len) == -1) {
+      result = -EINVAL;
+      break;
+    }
+
+    batch->conns[batch->count].fd = fd;
+    memset(&batch->conns[batch->count].peer, 0, sizeof(struct sockaddr_in));
+    if (family == AF_INET && address_len < INET_ADDRSTRLEN) {
+      memcpy(address, address_str, address_len);
+      address[address_len] = '\0';
+      batch->conns[batch->count].peer.sin_family = AF_INET;
+      batch->conns[batch->count].peer.sin_port = htons(port);
+      inet_pton(AF_INET, address, &batch->conns[batch->count].peer.sin_addr);
+    }
+    batch->count++;
+  }
+
+  codius_rpc_reply_free(&reply);
+
+  if (result < 0)
+    return result;
+  return batch->count > 0 ? 0 : -EAGAIN;
+}
+
+
+/* The uv__accept of TCP servers. Connections come from the host in batches,
+ * so a burst of them costs one call rather than one per connection plus
+ * three per peer address.
+ */
+int uv__tcp_accept(uv_tcp_t* server) {
+  uv__tcp_accept_batch_t* batch = server->accept_batch;
+  int err;
+
+  if (batch == NULL) {
+    batch = malloc(sizeof(*batch));
+    if (batch == NULL)
+      return -ENOMEM;
+    batch->count = 0;
+    batch->next = 0;
+    server->accept_batch = batch;
+  }
+
+  if (batch->next == batch->count) {
+    err = uv__tcp_accept_fill(server, batch);
+    if (err)
+      return err;
+  }
+
+  return batch->conns[batch->next++].fd;
+}
+
+
+/* Give client the peer of the connection uv__tcp_accept returned last. */
+void uv__tcp_accepted(uv_tcp_t* server, uv_tcp_t* client) {
+  uv__tcp_accept_batch_t* batch = server->accept_batch;
+
+  if (batch != NULL && batch->next > 0)
+    client->peer = batch->conns[batch->next - 1].peer;
+}
+
+
 static int maybe_new_socket(uv_tcp_t* handle, int domain, int flags) {
   int sockfd;
   int err;
@@ -126,21 +237,20 @@ int uv__tcp_bind(uv_tcp_t* tcp,
     assert(0);
   }
 
-  const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"bind\",\"data\":[%d, %d, \"%s\", %d]}";
-  char message [UV_SYNC_MAX_MESSAGE_SIZE];
-  int len;
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, tcp->io_watcher.fd, addr->sa_family,
-                  ip, port);
-  if (len==-1) {
-    printf("Error forming socket message.");
-    abort();
-  }
-  char *resp_buf;
-  size_t resp_len;
-  int result = codius_sync_call(message, len, &resp_buf, &resp_len);
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+
+  codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_BIND);
+  codius_rpc_add_int32(&msg, tcp->io_watcher.fd);
+  codius_rpc_add_int32(&msg, addr->sa_family);
+  codius_rpc_add_string(&msg, ip, strlen(ip));
+  codius_rpc_add_int32(&msg, port);
+
+  int result = codius_rpc_call(&msg, &reply);
   assert(result != -1);
-  r = codius_parse_json_int(resp_buf, resp_len, "result");
-  free(resp_buf);
+  r = reply.result;
+  codius_rpc_reply_free(&reply);
 
   if (addr->sa_family == AF_INET6)
     tcp->flags |= UV_HANDLE_IPV6;
@@ -149,13 +259,37 @@ int uv__tcp_bind(uv_tcp_t* tcp,
 }
 
 
+static void uv__tcp_connect_done(struct uv__work* w,
+                                 int status,
+                                 const char* buf,
+                                 size_t buf_len) {
+  uv_connect_t* req = container_of(w, uv_connect_t, work_req);
+  codius_rpc_reply_t reply;
+
+  /* The completion is only valid during this callback, so the reply does not
+   * hold on to it.
+   */
+  if (status != 0)
+    req->handle->delayed_error = status;
+  else if (buf == NULL ||
+           -1==codius_rpc_reply_parse(&reply, (char*) buf, buf_len))
+    req->handle->delayed_error = -EIO;
+  else
+    req->handle->delayed_error = reply.result < 0 ? reply.result : 0;
+
+  if (req->handle->delayed_error != 0)
+    memset(&((uv_tcp_t*) req->handle)->peer, 0, sizeof(struct sockaddr_in));
+
+  uv__stream_connect(req->handle);
+}
+
+
 int uv__tcp_connect(uv_connect_t* req,
                     uv_tcp_t* handle,
                     const struct sockaddr* addr,
                     unsigned int addrlen,
                     uv_connect_cb cb) {
   int err;
-  int r;
 
   assert(handle->type == UV_TCP);
 
@@ -176,38 +310,31 @@ int uv__tcp_connect(uv_connect_t* req,
   //              be different.
   assert(addr->sa_family == AF_INET);
 
-  const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"connect\",\"data\":[%d, %d, %d, %d]}";
-  char message [UV_SYNC_MAX_MESSAGE_SIZE];
-  int len;
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, uv__stream_fd(handle), addr->sa_family, ((struct sockaddr_in*)addr)->sin_addr.s_addr, ((struct sockaddr_in*)addr)->sin_port);
-  if (len==-1) {
-    printf("Error forming socket message.");
-    abort();
-  }
-  char *resp_buf;
-  size_t resp_len;
-  int result = codius_sync_call(message, len, &resp_buf, &resp_len);
-  assert(result != -1);
-  r = codius_parse_json_int(resp_buf, resp_len, "result");
-  free(resp_buf);
-
-  if (r == -1) {
-    if (errno == EINPROGRESS)
-      ; /* not an error */
-    else if (errno == ECONNREFUSED)
-    /* If we get a ECONNREFUSED wait until the next tick to report the
-     * error. Solaris wants to report immediately--other unixes want to
-     * wait.
-     */
-      handle->delayed_error = -errno;
-    else
-      return -errno;
-  }
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
 
-  // Successful codius_sync_call == UV_CONNECT event
-  // Call the callback
+  codius_rpc_msg_init(&msg, message, sizeof(message), CODIUS_RPC_NET_CONNECT);
+  codius_rpc_add_int32(&msg, uv__stream_fd(handle));
+  codius_rpc_add_int32(&msg, addr->sa_family);
+  codius_rpc_add_int32(&msg, ((struct sockaddr_in*)addr)->sin_addr.s_addr);
+  codius_rpc_add_int32(&msg, ((struct sockaddr_in*)addr)->sin_port);
+
+  if (-1==codius_rpc_msg_finish(&msg))
+    return -ENOBUFS;
+
+  memcpy(&handle->peer, addr, sizeof(handle->peer));
+
+  uv__req_init(handle->loop, req, UV_CONNECT);
+  req->cb = cb;
   req->handle = (uv_stream_t*) handle;
-  cb(req, 0);
+  QUEUE_INIT(&req->queue);
+  handle->connect_req = req;
+
+  /* The handshake runs on the host while the loop goes on; the completion
+   * finishes the request in uv__tcp_connect_done.
+   */
+  uv__work_submit(handle->loop, &req->work_req, CODIUS_MAGIC_BYTES_BINARY,
+                  msg.base, msg.len, uv__tcp_connect_done);
 
   return 0;
 }
@@ -264,76 +391,77 @@ int uv_tcp_getpeername(const uv_tcp_t* handle,
 
   //*namelen = (int) socklen;
 
+  /* Accepted and connected sockets know their peer already. */
+  if (handle->peer.sin_family == AF_INET && handle->connect_req == NULL) {
+    memcpy(name, &handle->peer, sizeof(handle->peer));
+    *namelen = sizeof(handle->peer);
+    return 0;
+  }
+
   struct sockaddr_in ip4_addr;
 
   memset (&ip4_addr, 0, sizeof(ip4_addr));
 
-  const char* frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"getRemoteFamily\",\"data\":[%d]}";
-  char message [UV_SYNC_MAX_MESSAGE_SIZE];
-  int len;
-  len = snprintf(message, UV_SYNC_MAX_MESSAGE_SIZE, frame, uv__stream_fd(handle));
-  if (len==-1) {
-    printf("Error forming getRemoteFamily message.");
-    abort();
-  }
-  char *resp_buf;
-  size_t resp_len;
-  int result = codius_sync_call(message, len, &resp_buf, &resp_len);
+  char message[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  int result;
+
+  codius_rpc_msg_init(&msg, message, sizeof(message),
+                      CODIUS_RPC_NET_GET_REMOTE_FAMILY);
+  codius_rpc_add_int32(&msg, uv__stream_fd(handle));
+  result = codius_rpc_call(&msg, &reply);
   assert(result != -1);
-  codius_parse_json_int(resp_buf, resp_len, "result");
-  ip4_addr.sin_family = codius_parse_json_int(resp_buf, resp_len, "result");
-  
-  free(resp_buf);
-
-  frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"getRemotePort\",\"data\":[%d]}";
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, uv__stream_fd(handle));
-  if (len==-1) {
-    printf("Error forming getRemotePort message.");
-    abort();
-  }
-  result = codius_sync_call(message, len, &resp_buf, &resp_len);
+  ip4_addr.sin_family = reply.result;
+  codius_rpc_reply_free(&reply);
+
+  codius_rpc_msg_init(&msg, message, sizeof(message),
+                      CODIUS_RPC_NET_GET_REMOTE_PORT);
+  codius_rpc_add_int32(&msg, uv__stream_fd(handle));
+  result = codius_rpc_call(&msg, &reply);
   assert(result != -1);
-  codius_parse_json_int(resp_buf, resp_len, "result");
-  ip4_addr.sin_port = htons(codius_parse_json_int(resp_buf, resp_len, "result"));
-  
-  free(resp_buf);
-
-  frame = "{\"type\":\"api\",\"api\":\"net\",\"method\":\"getRemoteAddress\",\"data\":[%d]}";
-  len = snprintf (message, UV_SYNC_MAX_MESSAGE_SIZE, frame, uv__stream_fd(handle));
-  if (len==-1) {
-    printf("Error forming getremoteaddress message.");
-    abort();
-  }
-  
-  result = codius_sync_call(message, len, &resp_buf, &resp_len);
+  ip4_addr.sin_port = htons(reply.result);
+  codius_rpc_reply_free(&reply);
+
+  codius_rpc_msg_init(&msg, message, sizeof(message),
+                      CODIUS_RPC_NET_GET_REMOTE_ADDRESS);
+  codius_rpc_add_int32(&msg, uv__stream_fd(handle));
+  result = codius_rpc_call(&msg, &reply);
   assert(result != -1);
-  jsmntype_t result_type = codius_parse_json_type(resp_buf, resp_len, "result");
-  if (result_type == JSMN_STRING) {
-    char address[15];
-    memset(&address, 0, sizeof(address));
-    len = codius_parse_json_str(resp_buf, resp_len, "result", &address, 14);
-    assert(len >0);
-    assert(len <= 14);
-
-    inet_pton(ip4_addr.sin_family, &address, &ip4_addr.sin_addr);
-
-    struct sockaddr *socket_addr = (struct sockaddr *)&ip4_addr;
-    name->sa_family = socket_addr->sa_family;
-    int i;
-    for (i=0; i<sizeof(socket_addr->sa_data); i++) {
-      name->sa_data[i] = socket_addr->sa_data[i];
-    }
 
-    *namelen = sizeof(*name);
-  } else {
-    len = codius_parse_json_int(resp_buf, resp_len, "result");    
-    if (len < 0) {
-      errno = -len;
-    }
-    return len;
+  const char *address_str;
+  size_t address_len;
+  if (reply.result < 0) {
+    result = reply.result;
+    codius_rpc_reply_free(&reply);
+    errno = -result;
+    return result;
+  }
+
+  if (codius_rpc_get_string(&reply, &address_str, &address_len) == -1 ||
+      address_len >= INET_ADDRSTRLEN) {
+    codius_rpc_reply_free(&reply);
+    return -EINVAL;
   }
-  
-  free(resp_buf);
+
+  char address[INET_ADDRSTRLEN];
+  memcpy(address, address_str, address_len);
+  address[address_len] = '\0';
+  codius_rpc_reply_free(&reply);
+
+  inet_pton(ip4_addr.sin_family, address, &ip4_addr.sin_addr);
+
+  if (ip4_addr.sin_family == AF_INET)
+    ((uv_tcp_t*) handle)->peer = ip4_addr;
+
+  struct sockaddr *socket_addr = (struct sockaddr *)&ip4_addr;
+  name->sa_family = socket_addr->sa_family;
+  int i;
+  for (i=0; i<sizeof(socket_addr->sa_data); i++) {
+    name->sa_data[i] = socket_addr->sa_data[i];
+  }
+
+  *namelen = sizeof(*name);
 
   return 0;
 }
@@ -451,5 +579,15 @@ int uv_tcp_simultaneous_accepts(uv_tcp_t* handle, int enable) {
 
 
 void uv__tcp_close(uv_tcp_t* handle) {
+  uv__tcp_accept_batch_t* batch = handle->accept_batch;
+
+  /* Connections nobody took are closed with the server. */
+  if (batch != NULL) {
+    while (batch->next < batch->count)
+      uv__close(batch->conns[batch->next++].fd);
+    free(batch);
+    handle->accept_batch = NULL;
+  }
+
   uv__stream_close((uv_stream_t*)handle);
 }
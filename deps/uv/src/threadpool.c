@@ -22,6 +22,7 @@
 
 #include "uv-common.h"
 #include "internal.h"
+#include "codius-util.h"
 
 #include <stdlib.h>
 #include <limits.h>
@@ -30,7 +31,6 @@
 
 #define MAX_THREADPOOL_SIZE 128
 #define CODIUS_ASYNC_IO_FD 3
-#define CODIUS_MAGIC_BYTES 0xC0D105FE
 
 static uv_once_t once = UV_ONCE_INIT;
 static uv_cond_t cond;
@@ -85,46 +85,23 @@ static void uv__cancelled(struct uv__work* w) {
   abort();
 }
 
+/* The host pushes completions to async calls as they finish; dispatch every
+ * one that has arrived.
+ */
 static void uv__codius_async_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
-  size_t bytes_read;
-  codius_rpc_header_t rpc_header;
-  const int fd = 3;
-
-  const char* message = "{\"type\":\"request_async_response\"}";
-  
-  // char resp_buf[UV_SYNC_MAX_MESSAGE_SIZE];
-  // int resp_len;
-  // resp_len = uv_sync_call(message, len, resp_buf, sizeof(resp_buf));
-
-  rpc_header.magic_bytes = CODIUS_MAGIC_BYTES;
-  rpc_header.callback_id = 0;
-  rpc_header.size = strlen(message);
-  
-  if (-1==write(fd, &rpc_header, sizeof(rpc_header)) ||
-      -1==write(fd, message, strlen(message))) {
-    perror("write()");
-    //TYPE_ERROR("Error writing to sync fd 4");
-    return -1;
-  }
-  
-  bytes_read = read(fd, &rpc_header, sizeof(rpc_header));
-  if (rpc_header.magic_bytes!=CODIUS_MAGIC_BYTES) {
-    //TYPE_ERROR("Error reading sync fd 4, invalid header");
-    return -1;
-  }
-  
-  // No asynchronous responses found.
-  if (rpc_header.size==0) {
-    return;
-  }
-
-  char buf[rpc_header.size];
-  bytes_read = read(fd, &buf, rpc_header.size);
-
-  callback_list_t *cb_list;
-  if (bytes_read && bytes_read!=-1) {
-    cb_list = find_callback(loop, rpc_header.callback_id);
-    cb_list->work->done(cb_list->work, 0, buf, rpc_header.size);
+  callback_list_t* cb_list;
+  uint32_t callback_id;
+  const char* buf;
+  size_t buf_len;
+
+  while (codius_next_completion(&callback_id, &buf, &buf_len)) {
+    cb_list = find_callback(loop, callback_id);
+    if (cb_list == NULL)
+      continue;
+
+    RB_REMOVE(callback_root, CAST(&loop->async_callbacks), cb_list);
+    cb_list->work->done(cb_list->work, 0, buf, buf_len);
+    free(cb_list);
   }
 }
 
@@ -188,9 +165,26 @@ int uv_codius_async_init(uv_loop_t* loop) {
 
 void uv__work_submit(uv_loop_t* loop,
                      struct uv__work* w,
+                     uint32_t magic_bytes,
                      const char *buf,
                      size_t buf_len,
                      void (*done)(struct uv__work* w, int status, const char *buf, size_t buf_len)) {
+  struct iovec iov;
+
+  iov.iov_base = (char*) buf;
+  iov.iov_len = buf_len;
+
+  uv__work_submitv(loop, w, magic_bytes, &iov, 1, done);
+}
+
+
+/* Like uv__work_submit, with the frame body gathered from body_cnt pieces. */
+void uv__work_submitv(uv_loop_t* loop,
+                      struct uv__work* w,
+                      uint32_t magic_bytes,
+                      const struct iovec *body,
+                      int body_cnt,
+                      void (*done)(struct uv__work* w, int status, const char *buf, size_t buf_len)) {
   // uv_once(&once, init_once);
   w->loop = loop;
   w->done = done;
@@ -207,12 +201,27 @@ void uv__work_submit(uv_loop_t* loop,
   c->work = w;
   RB_INSERT(callback_root, CAST(&loop->async_callbacks), c);
 
-  unsigned long magic_bytes = CODIUS_MAGIC_BYTES;
-  if (-1==write(CODIUS_ASYNC_IO_FD, &magic_bytes, sizeof(magic_bytes)) ||
-      -1==write(CODIUS_ASYNC_IO_FD, &c->id, sizeof(c->id)) ||
-      -1==write(CODIUS_ASYNC_IO_FD, &buf_len, sizeof(buf_len)) ||
-      -1==write(CODIUS_ASYNC_IO_FD, buf, buf_len)) {
-    //TODO-CODIUS Throw some error
+  /* No completion will ever come for a call the host did not get. */
+  if (-1==codius_write_frame(magic_bytes, c->id, body, body_cnt)) {
+    RB_REMOVE(callback_root, CAST(&loop->async_callbacks), c);
+    free(c);
+    w->done(w, UV_EIO, NULL, 0);
+  }
+}
+
+
+/* Drop the callback of a call whose request is going away. Its completion is
+ * ignored when it arrives.
+ */
+void uv__work_forget(uv_loop_t* loop, struct uv__work* w) {
+  callback_list_t* c;
+
+  RB_FOREACH(c, callback_root, CAST(&loop->async_callbacks)) {
+    if (c->work == w) {
+      RB_REMOVE(callback_root, CAST(&loop->async_callbacks), c);
+      free(c);
+      return;
+    }
   }
 }
 
@@ -314,7 +323,22 @@ int uv_queue_work(uv_loop_t* loop,
   uv__req_init(loop, req, UV_WORK);
   req->loop = loop;
   req->after_work_cb = after_work_cb;
-  uv__work_submit(loop, &req->work_req, buf, buf_len, uv__queue_done);
+  uv__work_submit(loop, &req->work_req, CODIUS_MAGIC_BYTES, buf, buf_len,
+                  uv__queue_done);
+  return 0;
+}
+
+
+int uv_queue_binary_work(uv_loop_t* loop,
+                         uv_work_t* req,
+                         const char *buf,
+                         size_t buf_len,
+                         uv_after_work_cb after_work_cb) {
+  uv__req_init(loop, req, UV_WORK);
+  req->loop = loop;
+  req->after_work_cb = after_work_cb;
+  uv__work_submit(loop, &req->work_req, CODIUS_MAGIC_BYTES_BINARY, buf, buf_len,
+                  uv__queue_done);
   return 0;
 }
 
@@ -101,10 +101,20 @@ int uv__getaddrinfo_translate_error(int sys_err);    /* EAI_* error. */
 
 void uv__work_submit(uv_loop_t* loop,
                      struct uv__work *w,
+                     uint32_t magic_bytes,
                      const char *buf,
                      size_t buf_len,
                      void (*done)(struct uv__work *w, int status, const char *buf, size_t buf_len));
 
+void uv__work_submitv(uv_loop_t* loop,
+                      struct uv__work *w,
+                      uint32_t magic_bytes,
+                      const struct iovec *body,
+                      int body_cnt,
+                      void (*done)(struct uv__work *w, int status, const char *buf, size_t buf_len));
+
+void uv__work_forget(uv_loop_t* loop, struct uv__work *w);
+
 void uv__work_done(uv_async_t* handle);
 
 size_t uv__count_bufs(const uv_buf_t bufs[], unsigned int nbufs);
@@ -13,6 +13,7 @@
 #include "disasm.h"
 #include "assembler.h"
 #include "codegen.h"
+#include "sampler.h"
 #include "arm/constants-arm.h"
 #include "arm/simulator-arm.h"
 
@@ -679,6 +680,7 @@ void Simulator::FlushOnePage(v8::internal::HashMap* i_cache,
   CachePage* cache_page = GetCachePage(i_cache, page);
   char* valid_bytemap = cache_page->ValidityByte(offset);
   memset(valid_bytemap, CachePage::LINE_INVALID, size >> CachePage::kLineShift);
+  cache_page->FlushDecoded(offset, size);
 }
 
 
@@ -719,6 +721,7 @@ Simulator::Simulator(Isolate* isolate) : isolate_(isolate) {
     i_cache_ = new v8::internal::HashMap(&ICacheMatch);
     isolate_->set_simulator_i_cache(i_cache_);
   }
+  memset(decoded_pages_, 0, sizeof(decoded_pages_));
   Initialize(isolate);
   // Set up simulator support first. Some of this information is needed to
   // setup the architecture state.
@@ -726,6 +729,7 @@ Simulator::Simulator(Isolate* isolate) : isolate_(isolate) {
   stack_ = reinterpret_cast<char*>(malloc(stack_size));
   pc_modified_ = false;
   icount_ = 0;
+  sample_icount_ = 0;
   break_pc_ = NULL;
   break_instr_ = 0;
 
@@ -1226,7 +1230,12 @@ void Simulator::Format(Instruction* instr, const char* format) {
 // Checks if the current instruction should be executed based on its
 // condition bits.
 bool Simulator::ConditionallyExecute(Instruction* instr) {
-  switch (instr->ConditionField()) {
+  return ConditionPassed(instr->ConditionField());
+}
+
+
+bool Simulator::ConditionPassed(Condition cond) {
+  switch (cond) {
     case eq: return z_flag_;
     case ne: return !z_flag_;
     case cs: return c_flag_;
@@ -3658,12 +3667,119 @@ void Simulator::InstructionDecode(Instruction* instr) {
 }
 
 
+// Fills in the record for instr. Everything that only depends on the
+// instruction bits is worked out here once: the condition, the handler for
+// the instruction type and whether it is a stop.
+void Simulator::Decode(DecodedInstruction* decoded, Instruction* instr) {
+  decoded->bits = instr->InstructionBits();
+  decoded->is_stop = instr->IsStop();
+  if (instr->ConditionField() == kSpecialCondition) {
+    decoded->condition = al;
+    decoded->handler = &Simulator::DecodeSpecialCondition;
+    return;
+  }
+  decoded->condition = instr->ConditionField();
+  switch (instr->TypeValue()) {
+    case 0:
+    case 1:
+      decoded->handler = &Simulator::DecodeType01;
+      break;
+    case 2:
+      decoded->handler = &Simulator::DecodeType2;
+      break;
+    case 3:
+      decoded->handler = &Simulator::DecodeType3;
+      break;
+    case 4:
+      decoded->handler = &Simulator::DecodeType4;
+      break;
+    case 5:
+      decoded->handler = &Simulator::DecodeType5;
+      break;
+    case 6:
+      decoded->handler = &Simulator::DecodeType6;
+      break;
+    case 7:
+      decoded->handler = &Simulator::DecodeType7;
+      break;
+    default:
+      UNREACHABLE();
+  }
+}
+
+
+CachePage* Simulator::GetDecodedPage(intptr_t page) {
+  DecodedPageEntry* entry = &decoded_pages_[
+      (page >> CachePage::kPageShift) & (kDecodedPageCacheSize - 1)];
+  if (entry->page != page || entry->cache_page == NULL) {
+    entry->page = page;
+    entry->cache_page = GetCachePage(i_cache_, reinterpret_cast<void*>(page));
+    entry->cache_page->AllocateDecoded();
+  }
+  return entry->cache_page;
+}
+
+
+// Executes instructions from instr on like InstructionDecode, dispatching
+// straight to the handler of each record. Execution stays on the page for as
+// long as control falls through, so only the first instruction of a block
+// pays for finding its page. Returns once an instruction sets the pc or the
+// end of the page is reached.
+void Simulator::ExecuteBlock(Instruction* instr) {
+  intptr_t address = reinterpret_cast<intptr_t>(instr);
+  CachePage* cache_page = GetDecodedPage(address & ~CachePage::kPageMask);
+  int offset = address & CachePage::kPageMask;
+
+  for (;;) {
+    DecodedInstruction* decoded = cache_page->Decoded(offset);
+    if (decoded->handler == NULL ||
+        decoded->bits != instr->InstructionBits()) {
+      Decode(decoded, instr);
+    }
+
+    icount_++;
+    pc_modified_ = false;
+    if (decoded->condition == al || ConditionPassed(decoded->condition)) {
+      (this->*decoded->handler)(instr);
+    } else if (decoded->is_stop) {
+      set_pc(get_pc() + 2 * Instruction::kInstrSize);
+    }
+    if (pc_modified_) return;
+
+    // Fall through without going through set_register, which would flag the
+    // pc as modified.
+    instr = reinterpret_cast<Instruction*>(
+        reinterpret_cast<intptr_t>(instr) + Instruction::kInstrSize);
+    registers_[pc] = reinterpret_cast<int32_t>(instr);
+    offset += Instruction::kInstrSize;
+    if (offset == CachePage::kPageSize) return;
+  }
+}
+
+
 void Simulator::Execute() {
   // Get the PC to simulate. Cannot use the accessor here as we need the
   // raw PC value and not the one used as input to arithmetic instructions.
   int program_counter = get_pc();
 
-  if (::v8::internal::FLAG_stop_sim_at == 0) {
+  if (::v8::internal::FLAG_stop_sim_at == 0 &&
+      !::v8::internal::FLAG_trace_sim &&
+      !::v8::internal::FLAG_check_icache) {
+    // Fastest version of the dispatch loop, executing pre-decoded
+    // instructions a block at a time.
+    while (program_counter != end_sim_pc) {
+      ExecuteBlock(reinterpret_cast<Instruction*>(program_counter));
+      // Profiling can't rely on interrupting this thread with a signal, so
+      // take stack samples here, between blocks.
+      if (static_cast<uint32_t>(icount_) -
+          static_cast<uint32_t>(sample_icount_) >=
+          static_cast<uint32_t>(::v8::internal::FLAG_sim_sample_interval)) {
+        sample_icount_ = icount_;
+        Sampler::SampleSimulator(isolate_);
+      }
+      program_counter = get_pc();
+    }
+  } else if (::v8::internal::FLAG_stop_sim_at == 0) {
     // Fast version of the dispatch loop without checking whether the simulator
     // should be stopping at a particular executed instruction.
     while (program_counter != end_sim_pc) {
@@ -70,6 +70,23 @@ class SimulatorStack : public v8::internal::AllStatic {
 namespace v8 {
 namespace internal {
 
+class Simulator;
+
+// An instruction decoded once for repeated execution. The record remembers
+// the instruction bits it was decoded from and is only used while they still
+// match, so patched code is never executed through a stale record.
+struct DecodedInstruction {
+  typedef void (Simulator::*Handler)(Instruction* instr);
+
+  Instr bits;
+  Condition condition;
+  // NULL if the record has not been filled in or was flushed.
+  Handler handler;
+  // A non taken conditional stop must skip its inlined message address.
+  bool is_stop;
+};
+
+
 class CachePage {
  public:
   static const int LINE_VALID = 0;
@@ -82,10 +99,14 @@ class CachePage {
   static const int kLineLength = 1 << kLineShift;
   static const int kLineMask = kLineLength - 1;
 
-  CachePage() {
+  CachePage() : decoded_(NULL) {
     memset(&validity_map_, LINE_INVALID, sizeof(validity_map_));
   }
 
+  ~CachePage() {
+    DeleteArray(decoded_);
+  }
+
   char* ValidityByte(int offset) {
     return &validity_map_[offset >> kLineShift];
   }
@@ -94,8 +115,32 @@ class CachePage {
     return &data_[offset];
   }
 
+  // The records are only allocated when code on the page is first run
+  // through Simulator::ExecuteBlock, most pages of the i-cache never are.
+  void AllocateDecoded() {
+    if (decoded_ == NULL) {
+      decoded_ = NewArray<DecodedInstruction>(kDecodedSize);
+      memset(decoded_, 0, kDecodedSize * sizeof(decoded_[0]));
+    }
+  }
+
+  DecodedInstruction* Decoded(int offset) {
+    ASSERT(decoded_ != NULL);
+    return &decoded_[offset >> Instruction::kInstrSizeLog2];
+  }
+
+  void FlushDecoded(int offset, int size) {
+    if (decoded_ == NULL) return;
+    DecodedInstruction* decoded = Decoded(offset);
+    for (int i = 0; i < (size >> Instruction::kInstrSizeLog2); i++) {
+      decoded[i].handler = NULL;
+    }
+  }
+
  private:
   char data_[kPageSize];   // The cached data.
+  static const int kDecodedSize = kPageSize >> Instruction::kInstrSizeLog2;
+  DecodedInstruction* decoded_;  // One per instruction, or NULL.
   static const int kValidityMapSize = kPageSize >> kLineShift;
   char validity_map_[kValidityMapSize];  // One byte per line.
 };
@@ -251,6 +296,7 @@ class Simulator {
   // Checks if the current instruction should be executed based on its
   // condition bits.
   inline bool ConditionallyExecute(Instruction* instr);
+  inline bool ConditionPassed(Condition cond);
 
   // Helper functions to set the conditional flags in the architecture state.
   void SetNZFlags(int32_t val);
@@ -334,6 +380,12 @@ class Simulator {
   // Executes one instruction.
   void InstructionDecode(Instruction* instr);
 
+  // Executes a block of instructions through their pre-decoded records. Used
+  // instead of InstructionDecode unless tracing or checking the i-cache.
+  void ExecuteBlock(Instruction* instr);
+  inline CachePage* GetDecodedPage(intptr_t page);
+  void Decode(DecodedInstruction* decoded, Instruction* instr);
+
   // ICache.
   static void CheckICache(v8::internal::HashMap* i_cache, Instruction* instr);
   static void FlushOnePage(v8::internal::HashMap* i_cache, intptr_t start,
@@ -390,6 +442,8 @@ class Simulator {
   char* stack_;
   bool pc_modified_;
   int icount_;
+  // Instruction count at the last stack sample taken for the profiler.
+  int sample_icount_;
 
   // Debugger input.
   char* last_debugger_input_;
@@ -397,6 +451,15 @@ class Simulator {
   // Icache simulation
   v8::internal::HashMap* i_cache_;
 
+  // Recently used cache pages holding pre-decoded instructions, indexed by
+  // page number, to avoid a hash map lookup per executed instruction.
+  static const int kDecodedPageCacheSize = 64;
+  struct DecodedPageEntry {
+    intptr_t page;
+    CachePage* cache_page;
+  };
+  DecodedPageEntry decoded_pages_[kDecodedPageCacheSize];
+
   // Registered breakpoints.
   Instruction* break_pc_;
   Instr break_instr_;
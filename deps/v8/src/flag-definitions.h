@@ -569,6 +569,9 @@ DEFINE_bool(debug_sim, false, "Enable debugging the simulator")
 DEFINE_bool(check_icache, false,
             "Check icache flushes in ARM and MIPS simulator")
 DEFINE_int(stop_sim_at, 0, "Simulator stop after x number of instructions")
+DEFINE_int(sim_sample_interval, 100000,
+           "Simulated instructions between stack samples taken by the "
+           "simulator itself while profiling")
 #ifdef V8_TARGET_ARCH_ARM64
 DEFINE_int(sim_stack_alignment, 16,
            "Stack alignment in bytes in simulator. This must be a power of two "
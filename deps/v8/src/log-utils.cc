@@ -67,7 +67,11 @@ void Log::OpenTemporaryFile() {
 
 void Log::OpenFile(const char* name) {
   ASSERT(!IsEnabled());
+#if V8_OS_NACL
+  output_handle_ = OS::OpenHostLogFile(name);
+#else
   output_handle_ = OS::FOpen(name, OS::LogFileOpenMode);
+#endif
 }
 
 
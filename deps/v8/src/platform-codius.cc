@@ -127,7 +127,6 @@ double OS::LocalTimeOffset(TimezoneCache* cache) {
     fflush(stdout);
     return 0;
   }
-  free(resp_buf);
 
   return static_cast<double>(t.tm_gmtoff * msPerSecond -
                              (t.tm_isdst > 0 ? 3600 * msPerSecond : 0));
@@ -453,4 +452,127 @@ bool VirtualMemory::HasLazyCommits() {
   return true;
 }
 
+
+// Host log files buffer everything written to them and send it to the host in
+// one call per flush. The buffers are shared with the profiler thread, which
+// writes the tick log but must not use the host channel itself.
+class HostLogFile {
+ public:
+  explicit HostLogFile(const char* name)
+      : name_(StrDup(name)), data_(NULL), length_(0), capacity_(0),
+        sent_(false), next_(NULL) {}
+
+  ~HostLogFile() {
+    DeleteArray(name_);
+    free(data_);
+  }
+
+  void Append(const char* buf, size_t size) {
+    if (length_ + size > capacity_) {
+      size_t capacity = Max(capacity_ * 2, length_ + size);
+      char* data = static_cast<char*>(realloc(data_, capacity));
+      if (data == NULL) return;
+      data_ = data;
+      capacity_ = capacity;
+    }
+    OS::MemCopy(data_ + length_, buf, size);
+    length_ += size;
+  }
+
+  // The first call replaces the file on the host, later ones append to it.
+  void Send() {
+    char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+    codius_rpc_msg_t msg;
+    codius_rpc_reply_t reply;
+    struct iovec iov;
+
+    if (length_ == 0 && sent_) return;
+
+    codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_LOG_WRITE);
+    codius_rpc_add_string(&msg, name_, strlen(name_));
+    codius_rpc_add_int32(&msg, sent_ ? 1 : 0);
+    iov.iov_base = data_;
+    iov.iov_len = length_;
+    if (codius_rpc_callv(&msg, &iov, 1, NULL, 0, &reply) == 0) {
+      codius_rpc_reply_free(&reply);
+    }
+    length_ = 0;
+    sent_ = true;
+  }
+
+  size_t length() const { return length_; }
+
+  HostLogFile* next() const { return next_; }
+  void set_next(HostLogFile* next) { next_ = next; }
+
+ private:
+  char* name_;
+  char* data_;
+  size_t length_;
+  size_t capacity_;
+  bool sent_;
+  HostLogFile* next_;
+};
+
+
+// Buffered log data is sent once there is at least this much of it.
+static const size_t kHostLogFlushSize = 64 * KB;
+
+static LazyMutex host_log_mutex = LAZY_MUTEX_INITIALIZER;
+static HostLogFile* host_log_files = NULL;
+
+
+static ssize_t HostLogWrite(void* cookie, const char* buf, size_t size) {
+  LockGuard<Mutex> lock_guard(host_log_mutex.Pointer());
+  reinterpret_cast<HostLogFile*>(cookie)->Append(buf, size);
+  return size;
+}
+
+
+static int HostLogClose(void* cookie) {
+  HostLogFile* file = reinterpret_cast<HostLogFile*>(cookie);
+  LockGuard<Mutex> lock_guard(host_log_mutex.Pointer());
+  if (host_log_files == file) {
+    host_log_files = file->next();
+  } else {
+    HostLogFile* prev = host_log_files;
+    while (prev->next() != file) prev = prev->next();
+    prev->set_next(file->next());
+  }
+  file->Send();
+  delete file;
+  return 0;
+}
+
+
+FILE* OS::OpenHostLogFile(const char* name) {
+  cookie_io_functions_t functions;
+  memset(&functions, 0, sizeof(functions));
+  functions.write = HostLogWrite;
+  functions.close = HostLogClose;
+
+  HostLogFile* file = new HostLogFile(name);
+  FILE* handle = fopencookie(file, "w", functions);
+  if (handle == NULL) {
+    delete file;
+    return NULL;
+  }
+  // The file buffers by itself.
+  setvbuf(handle, NULL, _IONBF, 0);
+
+  LockGuard<Mutex> lock_guard(host_log_mutex.Pointer());
+  file->set_next(host_log_files);
+  host_log_files = file;
+  return handle;
+}
+
+
+void OS::FlushHostLogFiles(bool force) {
+  LockGuard<Mutex> lock_guard(host_log_mutex.Pointer());
+  for (HostLogFile* file = host_log_files; file != NULL; file = file->next()) {
+    if (force || file->length() >= kHostLogFlushSize) file->Send();
+  }
+}
+
+
 } }  // namespace v8::internal
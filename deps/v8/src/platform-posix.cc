@@ -358,7 +358,6 @@ double OS::DaylightSavingsOffset(double time, TimezoneCache*) {
     fflush(stdout);
     return 0;
   }
-  free(resp_buf);
 
   return t.tm_isdst > 0 ? 3600 * msPerSecond : 0;
 }
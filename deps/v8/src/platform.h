@@ -180,6 +180,17 @@ class OS {
   // Log file open mode is platform-dependent due to line ends issues.
   static const char* const LogFileOpenMode;
 
+#if V8_OS_NACL
+  // Opens a log file whose contents go to a file of the same name on the
+  // host, as nothing can be written inside the sandbox.
+  static FILE* OpenHostLogFile(const char* name);
+
+  // Sends what has been written to host log files, if there is enough of it
+  // or force is set. Only the thread running V8 may talk to the host, so log
+  // writes from other threads are buffered until this is called.
+  static void FlushHostLogFiles(bool force);
+#endif
+
   // Print output to console. This is mostly used for debugging output.
   // On platforms that has standard terminal output, the output
   // should go to stdout.
@@ -669,6 +669,26 @@ void Sampler::DecreaseProfilingDepth() {
 }
 
 
+#if defined(USE_SIMULATOR)
+void Sampler::SampleSimulator(Isolate* isolate) {
+  Sampler* sampler = isolate->logger()->sampler();
+  if (sampler == NULL || !sampler->WantsSamples()) return;
+
+  SimulatorHelper helper;
+  if (!helper.Init(sampler, isolate)) return;
+  RegisterState state;
+  helper.FillRegisters(&state);
+  if (state.sp == 0 || state.fp == 0) return;
+  sampler->SampleStack(state);
+
+#if V8_OS_NACL
+  // The profiler thread can't talk to the host, so its log is sent from here.
+  OS::FlushHostLogFiles(false);
+#endif
+}
+#endif  // USE_SIMULATOR
+
+
 void Sampler::SampleStack(const RegisterState& state) {
   TickSample* sample = isolate_->cpu_profiler()->StartTickSample();
   TickSample sample_obj;
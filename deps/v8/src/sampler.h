@@ -80,6 +80,16 @@ class Sampler {
   void IncreaseProfilingDepth();
   void DecreaseProfilingDepth();
 
+  // Whether stack samples are wanted at all, whoever takes them.
+  bool WantsSamples() const { return NoBarrier_Load(&profiling_) > 0; }
+
+#if defined(USE_SIMULATOR)
+  // Samples the stack of the simulator running on the current thread. The
+  // simulator calls this itself every --sim-sample-interval instructions, so
+  // profiling works where the VM thread can't be interrupted by a signal.
+  static void SampleSimulator(Isolate* isolate);
+#endif
+
   // Whether the sampler is running (that is, consumes resources).
   bool IsActive() const { return NoBarrier_Load(&active_); }
 
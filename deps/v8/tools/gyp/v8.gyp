@@ -168,10 +168,18 @@
               ['v8_random_seed!=0', {
                 'mksnapshot_flags': ['--random-seed', '<(v8_random_seed)'],
               }],
+              ['v8_extra_code!=""', {
+                'mksnapshot_flags': ['--extra-code', '<(v8_extra_code)'],
+              }],
             ],
           },
+          'conditions': [
+            ['v8_extra_code!=""', {
+              'inputs': ['<(v8_extra_code)'],
+            }],
+          ],
           'action': [
-            '<@(_inputs)',
+            '<(PRODUCT_DIR)/<(EXECUTABLE_PREFIX)mksnapshot.<(v8_target_arch)<(EXECUTABLE_SUFFIX)',
             '<@(mksnapshot_flags)',
             '<@(_outputs)'
           ],
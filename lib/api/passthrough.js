@@ -1,17 +1,18 @@
 var fs = require('fs');
+var path = require('path');
 var dns = require('dns');
 var net = require('net');
 var crypto = require('crypto');
+var constants = require('constants');
 
 var format = require('../binary/format');
 var RpcParser = require('../binary/rpc_parser').RpcParser;
 
 var FakeSocket = require('../mock/fake_socket').FakeSocket;
+var CodeCache = require('../code_cache').CodeCache;
 
-function AsyncResponse(callback_id, resp_message) {
-  this.callback_id = callback_id;
-  this.message = resp_message;
-}
+// Shared by all sandboxes of this host process, see lib/code_cache.js
+var codeCache = new CodeCache();
 
 var PassthroughApi = function (sandbox) {
   this._sandbox = sandbox;
@@ -21,15 +22,22 @@ var PassthroughApi = function (sandbox) {
   // fs.createReadStream('test.js').pipe(this._sandbox.stdio[0]);
   this._sandbox.stdio[1].pipe(process.stdout);
   this._sandbox.stdio[2].pipe(process.stderr);
-  this._sandbox.stdio[3].pipe(messageParser);
+  this._sandbox.channel.pipe(messageParser);
   
   // We want the first TCP file descriptor to be 5, so that there is no ambiguity
   // with actually existing file descriptors (stdin, out, err, async, sync)
   this._connections = [null, null, null, null, null];
 
+  // Async responses waiting to be pushed to the sandbox.
   this._async_responses = [];
+  this._responses_scheduled = false;
+
+  // Readiness events waiting to be pushed to the sandbox.
+  this._pending_events = {};
+  this._events_scheduled = false;
   
   messageParser.on('message', this.handleCall.bind(this));
+  messageParser.on('call', this.handleBinaryCall.bind(this));
 };
 
 PassthroughApi.prototype.handleCall = function (message_string, callback_id) {
@@ -51,22 +59,6 @@ PassthroughApi.prototype.handleCall = function (message_string, callback_id) {
 		return;
 	}
 
-  if (message.type==='request_async_response') {
-
-    // Pass in the first async response message.
-    var headerBuffer = new Buffer(format.HEADER_SIZE);
-    var asyncResponse = this._async_responses.shift();
-
-    headerBuffer.writeUInt32LE(format.MAGIC_BYTES, 0);
-    headerBuffer.writeUInt32LE(asyncResponse ? asyncResponse.callback_id: 0, 4);
-    headerBuffer.writeUInt32LE(asyncResponse ? asyncResponse.message.length : 0, 8);
-    this._sandbox.stdio[3].write(headerBuffer);
-    if (asyncResponse) {
-      this._sandbox.stdio[3].write(asyncResponse.message);
-    }
-    return;
-  }
-
   if (callback_id===0) {
     callback = this.syncCallback.bind(this);
   } else if (callback_id>0) {
@@ -84,47 +76,71 @@ PassthroughApi.prototype.handleCall = function (message_string, callback_id) {
 		args = message.data;
 	}
 	
+  this.dispatch(message.api, method, args, callback);
+};
+
+PassthroughApi.prototype.handleBinaryCall = function (call, callback_id) {
+  if (!call.api) {
+    throw new Error('Unknown binary method id: ' + call.id);
+  }
+
+  var callback;
+  if (callback_id===0) {
+    callback = this.binarySyncCallback.bind(this);
+  } else if (callback_id>0) {
+    callback = this.binaryAsyncCallback.bind(this, callback_id);
+  } else {
+    throw new Error('Invalid callback_id: ' + callback_id);
+  }
+
+  this.dispatch(call.api, call.method, call.args, callback);
+};
+
+PassthroughApi.prototype.dispatch = function (api, method, args, callback) {
+  var sock;
+
 	args.push(callback);
 
 	if (typeof args[0]==='string' && args[0].indexOf('/') === 0) {
 	  args[0] = '.' + args[0];
 	}
 
-  switch(message.api) {
+  switch(api) {
     case 'fs':
-      fs[method].apply(null, args);
+      if (method === 'read' && args.length === 4) {
+        this.read(args[0], args[1], args[2], callback);
+      } else if (method === 'scan') {
+        this.scan(args[0], callback);
+      } else if (method === 'batch') {
+        this.batch(args.slice(0, -1), callback);
+      } else {
+        fs[method].apply(null, args);
+      }
       break;
     case 'dns':
       dns[method].apply(null, args);
       break;
     case 'net':
-      var sock;
       switch (method) {
     		case 'socket':
     			sock = new FakeSocket(args[0], args[1], args[2]);
       		var connectionId = this._connections.length;
       		this._connections.push(sock);
+          sock.onreadable = this.pushEvent.bind(this, connectionId,
+                                                format.EVENT_READABLE);
+          sock.ondata = this.pushData.bind(this, connectionId);
+          sock.onwritable = this.pushEvent.bind(this, connectionId,
+                                                format.EVENT_WRITABLE);
     			args[3](null, connectionId);
     			break;
         case 'accept':
-          sock = this._connections[args[0]];
-          var peer = sock.accept();
-          if (peer) {
-            var peer_sock = new FakeSocket(FakeSocket.AF_INET, FakeSocket.SOCK_STREAM, 0);
-            peer_sock._socket = peer;
-            peer_sock._socket.on('data', function(data) {
-              peer_sock._buffer.push(data);
-            });
-            peer_sock._socket.on('end', function () {
-              peer_sock._eof = true;
-            });
-            var connectionId = this._connections.length;
-            this._connections.push(peer_sock);
-            callback(null, connectionId);
-          } else {
-            // EAGAIN (no data, try again later)
-            callback(null, -11);
-          }
+          var peer_sock = this.acceptConnection(args[0]);
+          // EAGAIN (no data, try again later)
+          callback(null, peer_sock ? peer_sock.connectionId : -11);
+          break;
+        case 'acceptBatch':
+          callback(null, this.acceptBatch(args[0], args[1]));
+          break;
         case 'write':
           if (args[2]==="hex") {
             args[1] = new Buffer(args[1], "hex");
@@ -144,8 +160,15 @@ PassthroughApi.prototype.handleCall = function (message_string, callback_id) {
           sock = this._connections[args[0]];
     			sock[method].apply(sock, args.slice(1));
     			break;
+        case 'poll':
+          callback(null, this.poll(args[0]));
+          break;
+        case 'credit':
+          this._connections[args[0]].grant(args[1]);
+          callback(null, 0);
+          break;
     		default:
-    			callback(new Error('Unhandled net method: ' + message.method));
+    			callback(new Error('Unhandled net method: ' + method));
     	}
       break;
     case 'crypto':
@@ -165,14 +188,275 @@ PassthroughApi.prototype.handleCall = function (message_string, callback_id) {
           crypto.randomBytes.apply(null, args);
           break;
         default:
-    			callback(new Error('Unhandled net method: ' + message.method));
+    			callback(new Error('Unhandled crypto method: ' + method));
+      }
+      break;
+    case 'log':
+      switch (method) {
+        case 'write':
+          // Profiler logs from the sandbox, kept in the sandbox's log
+          // directory. (name, append, data)
+          var logDir = this._sandbox._logDir;
+          var append = args[1];
+          var data = args[2];
+          if (!/^[\w.-]+\.log$/.test(args[0])) {
+            callback(new Error('Invalid log file name: ' + args[0]));
+            break;
+          }
+          var logPath = path.join(logDir, args[0]);
+          fs.mkdir(logDir, function (error) {
+            if (error && error.code !== 'EEXIST') {
+              callback(error);
+            } else if (append) {
+              fs.appendFile(logPath, data, callback);
+            } else {
+              fs.writeFile(logPath, data, callback);
+            }
+          });
+          break;
+        default:
+          callback(new Error('Unhandled log method: ' + method));
+      }
+      break;
+    case 'cache':
+      var manifestHash = this._sandbox.manifestHash;
+      switch (method) {
+        case 'get':
+          // (path), an empty result if nothing is cached
+          var data = manifestHash && codeCache.get(manifestHash, args[0]);
+          callback(null, data || new Buffer(0));
+          break;
+        case 'put':
+          // (path, data)
+          if (manifestHash) {
+            codeCache.put(manifestHash, args[0], new Buffer(args[1]));
+          }
+          callback(null);
+          break;
+        default:
+          callback(new Error('Unhandled cache method: ' + method));
+      }
+      break;
+    case 'sandbox':
+      switch (method) {
+        case 'load':
+          // A parked sandbox is ready for its contract. Code caching is only
+          // on for contracts with a manifest hash.
+          callback(null, [this._sandbox.manifestHash ? 1 : 0,
+                          this._sandbox.filePath]);
+          break;
+        default:
+          callback(new Error('Unhandled sandbox method: ' + method));
       }
       break;
     default:
-      callback(new Error('Unhandled api type: ' + message.api));
+      callback(new Error('Unhandled api type: ' + api));
   }
 };
 
+/**
+ * Read raw bytes for the sandbox.
+ *
+ * Called as (fd, length, position), without the encoding of the legacy string
+ * interface. The bytes read are returned as a Buffer, which a binary response
+ * carries as its payload with the byte count as the result. A negative
+ * position reads from the current position.
+ */
+PassthroughApi.prototype.read = function (fd, length, position, callback) {
+  var buffer = new Buffer(length);
+
+  if (position < 0) {
+    position = null;
+  }
+
+  fs.read(fd, buffer, 0, length, position, function (error, bytesRead) {
+    if (error) {
+      callback(error);
+    } else {
+      callback(null, buffer.slice(0, bytesRead));
+    }
+  });
+};
+
+/**
+ * Read from fd until the end of the file.
+ *
+ * Reads from position if it is not negative, otherwise from the current
+ * position. Calls back with a Buffer of the data.
+ */
+function readToEnd(fd, position, callback) {
+  var chunks = [];
+  var total = 0;
+
+  if (position < 0) {
+    position = null;
+  }
+
+  fs.fstat(fd, function (error, stats) {
+    if (error) return callback(error);
+
+    // The size is just a hint, files can change while they are read.
+    (function next() {
+      var buffer = new Buffer(Math.max(stats.size - total, 8192));
+      fs.read(fd, buffer, 0, buffer.length, position, function (error, bytesRead) {
+        if (error) return callback(error);
+        if (bytesRead === 0) return callback(null, Buffer.concat(chunks, total));
+        chunks.push(buffer.slice(0, bytesRead));
+        total += bytesRead;
+        if (position !== null) {
+          position += bytesRead;
+        }
+        next();
+      });
+    })();
+  });
+}
+
+/**
+ * Run a batch of fs calls for the sandbox, see CODIUS_RPC_FS_BATCH.
+ *
+ * Calls back with the results and values of the calls, and a Buffer of the
+ * data read, or with the error of the first call that failed. The error's
+ * batchMethod is the method id of that call.
+ */
+PassthroughApi.prototype.batch = function (args, callback) {
+  var self = this;
+  var values = [];
+  var data = [];
+  var opened = [];
+  var lastFd = null;
+  var i = 0;
+
+  function fd(value) {
+    return value === format.FS_BATCH_FD ? lastFd : value;
+  }
+
+  function fail(method, error) {
+    error.batchMethod = method;
+    // Don't leave the files of a failed batch open.
+    opened.forEach(function (openedFd) {
+      fs.close(openedFd, function () {});
+    });
+    callback(error);
+  }
+
+  (function next() {
+    if (i === args.length) {
+      return callback(null, values, Buffer.concat(data));
+    }
+
+    var method = args[i++];
+    var call = format.METHODS[method] || {};
+    switch (call.api === 'fs' && call.method) {
+      case 'open':
+        var file = args[i];
+        if (typeof file === 'string' && file.indexOf('/') === 0) {
+          file = '.' + file;
+        }
+        fs.open(file, args[i + 1], args[i + 2], function (error, result) {
+          if (error) return fail(method, error);
+          opened.push(lastFd = result);
+          values.push(result);
+          next();
+        });
+        i += 3;
+        break;
+      case 'close':
+        var closeFd = fd(args[i++]);
+        fs.close(closeFd, function (error) {
+          if (error) return fail(method, error);
+          if (opened.indexOf(closeFd) !== -1) {
+            opened.splice(opened.indexOf(closeFd), 1);
+          }
+          values.push(0);
+          next();
+        });
+        break;
+      case 'read':
+        var readFd = fd(args[i]);
+        var length = args[i + 1];
+        var position = args[i + 2];
+        var done = function (error, buffer) {
+          if (error) return fail(method, error);
+          data.push(buffer);
+          values.push(buffer.length);
+          next();
+        };
+        if (length < 0) {
+          readToEnd(readFd, position, done);
+        } else {
+          self.read(readFd, length, position, done);
+        }
+        i += 3;
+        break;
+      case 'fstat':
+        fs.fstat(fd(args[i++]), function (error, stats) {
+          if (error) return fail(method, error);
+          values.push(0);
+          Array.prototype.push.apply(values, statsValues(stats));
+          next();
+        });
+        break;
+      default:
+        fail(method, new Error('Unhandled fs batch method: ' + method));
+    }
+  })();
+};
+
+// Most entries a single scan answers with, the sandbox asks again for
+// directories left out.
+var SCAN_MAX_ENTRIES = 10000;
+
+/**
+ * Stat a whole directory tree for the sandbox's stat cache.
+ *
+ * Answers with a flat list of (relative path, complete, ...stat values) per
+ * entry, depth first, starting with the directory itself as "". Complete is
+ * 1 if the entries of a directory follow; symlinked directories are not
+ * descended into.
+ */
+PassthroughApi.prototype.scan = function (dir, callback) {
+  var result = [];
+  var count = 0;
+
+  function visit(name, file, done) {
+    fs.lstat(file, function (error, lstats) {
+      if (error) return done(error);
+      fs.stat(file, function (error, stats) {
+        // Dangling symlinks don't exist as far as stat is concerned.
+        if (error) return done(error.code === 'ENOENT' ? null : error);
+
+        var descend = lstats.isDirectory() && count < SCAN_MAX_ENTRIES;
+        var values = [name, descend ? 1 : 0].concat(statsValues(stats));
+        Array.prototype.push.apply(result, values);
+        count++;
+
+        if (!descend) return done(null);
+        fs.readdir(file, function (error, names) {
+          if (error) return done(error);
+          names.sort();
+          (function next(i) {
+            if (i === names.length) return done(null);
+            var childName = name ? name + '/' + names[i] : names[i];
+            visit(childName, path.join(file, names[i]), function (error) {
+              if (error) return done(error);
+              next(i + 1);
+            });
+          })(0);
+        });
+      });
+    });
+  }
+
+  visit('', dir, function (error) {
+    if (error) {
+      callback(error);
+    } else {
+      callback(null, result);
+    }
+  });
+};
+
 PassthroughApi.prototype.asyncCallback	= function (callback_id, error, result, result2) {
   var response = {
 		type: 'callback',
@@ -184,8 +468,146 @@ PassthroughApi.prototype.asyncCallback	= function (callback_id, error, result, r
   var responseBuffer = new Buffer(responseString, 'utf-8');
   // console.log("<<<", responseString);
 
-  // Store the asynchronous response message to be retrieved by a synchronous request.
-  this._async_responses.push(new AsyncResponse(callback_id, responseBuffer));
+  this.pushResponse(callback_id, responseBuffer);
+};
+
+/**
+ * Send an async response to the sandbox.
+ *
+ * Responses that complete together are sent as one completion frame once
+ * the current call has been answered.
+ */
+PassthroughApi.prototype.pushResponse = function (callback_id, message) {
+  var self = this;
+
+  self._async_responses.push({ callback_id: callback_id, message: message });
+
+  if (self._responses_scheduled) return;
+  self._responses_scheduled = true;
+
+  setImmediate(function () {
+    var responses = self._async_responses;
+
+    self._async_responses = [];
+    self._responses_scheduled = false;
+    self._sandbox.channel.write(format.encodeCompletions(responses));
+  });
+};
+
+/**
+ * Accept a pending connection on listening socket fd and register it, or
+ * return null if there is none.
+ */
+PassthroughApi.prototype.acceptConnection = function (fd) {
+  var peer = this._connections[fd].accept();
+  if (!peer) {
+    return null;
+  }
+
+  var peer_sock = new FakeSocket(FakeSocket.AF_INET, FakeSocket.SOCK_STREAM, 0);
+  peer_sock._attach(peer);
+  var connectionId = this._connections.length;
+  this._connections.push(peer_sock);
+  peer_sock.connectionId = connectionId;
+  peer_sock.onreadable = this.pushEvent.bind(this, connectionId,
+                                             format.EVENT_READABLE);
+  peer_sock.ondata = this.pushData.bind(this, connectionId);
+  peer_sock.onwritable = this.pushEvent.bind(this, connectionId,
+                                             format.EVENT_WRITABLE);
+  return peer_sock;
+};
+
+/**
+ * Accept up to max pending connections on fd.
+ *
+ * The result lists fd, peer family, peer port and peer address of each, so
+ * the sandbox needs no further calls to learn about its peers. EAGAIN if
+ * nothing is pending.
+ */
+PassthroughApi.prototype.acceptBatch = function (fd, max) {
+  var values = [];
+  var peer_sock;
+
+  while (values.length < max * 4 && (peer_sock = this.acceptConnection(fd))) {
+    values.push(peer_sock.connectionId, FakeSocket.AF_INET,
+                peer_sock._socket.remotePort, peer_sock._socket.remoteAddress);
+  }
+
+  // EAGAIN (no data, try again later)
+  return values.length ? values : -11;
+};
+
+/**
+ * Answer a batched readiness query.
+ *
+ * The request is a list of (int32 fd, uint32 events) pairs, the response a
+ * bitmap with bit i set if entry i is ready for any of its events. Sockets
+ * are writable unless they wait for their host socket to drain.
+ */
+PassthroughApi.prototype.poll = function (request) {
+  var count = Math.floor(request.length / 8);
+  var bitmap = new Buffer(Math.ceil(count / 8));
+
+  bitmap.fill(0);
+
+  for (var i = 0; i < count; i++) {
+    var fd = request.readInt32LE(i * 8);
+    var events = request.readUInt32LE(i * 8 + 4);
+    var ready = 0;
+
+    if (fd === 3) {
+      ready = this._async_responses.length ? format.EVENT_READABLE : 0;
+    } else if (this._connections[fd]) {
+      if (this._connections[fd].isWritable()) {
+        ready |= format.EVENT_WRITABLE;
+      }
+      if (this._connections[fd].isReadable()) {
+        ready |= format.EVENT_READABLE;
+      }
+    }
+
+    if (ready & events) {
+      bitmap[i >> 3] |= 1 << (i & 7);
+    }
+  }
+
+  return bitmap;
+};
+
+/**
+ * Tell the sandbox that fd may be ready.
+ *
+ * Events are collected and sent in a single frame once the current call has
+ * been answered, so a sandbox blocked in uv__io_poll wakes up once per batch.
+ */
+PassthroughApi.prototype.pushEvent = function (fd, events) {
+  var self = this;
+
+  self._pending_events[fd] = (self._pending_events[fd] || 0) | events;
+
+  if (self._events_scheduled) return;
+  self._events_scheduled = true;
+
+  setImmediate(function () {
+    var pending = self._pending_events;
+    var list = Object.keys(pending).map(function (fd) {
+      return { fd: Number(fd), events: pending[fd] };
+    });
+
+    self._pending_events = {};
+    self._events_scheduled = false;
+    self._sandbox.channel.write(format.encodeEvents(list));
+  });
+};
+
+/**
+ * Push data received on fd into its receive ring in the sandbox.
+ *
+ * The socket only pushes as much as the sandbox granted credit for, so the
+ * ring never overflows. A non-zero status ends the stream.
+ */
+PassthroughApi.prototype.pushData = function (fd, data, status) {
+  this._sandbox.channel.write(format.encodeData(fd, status, data));
 };
 
 
@@ -203,12 +625,74 @@ PassthroughApi.prototype.syncCallback	= function (error, result, result2) {
 	// console.log("<<<", responseString);
 	
 	//console.log(responseString);
-  var headerBuffer = new Buffer(format.HEADER_SIZE);
-  headerBuffer.writeUInt32LE(format.MAGIC_BYTES, 0);
-  headerBuffer.writeUInt32LE(0, 4);
-  headerBuffer.writeUInt32LE(responseBuffer.length, 8);
-  this._sandbox.stdio[3].write(headerBuffer);
-  this._sandbox.stdio[3].write(responseBuffer);
+  format.writeFrames(this._sandbox.channel, format.MAGIC_BYTES, responseBuffer);
+};
+
+/**
+ * Get the values of a stats object in the order of the fs.Stats constructor
+ * in the sandbox, with times in milliseconds.
+ */
+function statsValues(stats) {
+  var birthtime = stats.birthtime || stats.ctime;
+
+  return [
+    stats.dev, stats.mode, stats.nlink, stats.uid, stats.gid, stats.rdev,
+    stats.blksize || 0, stats.ino, stats.size, stats.blocks || 0,
+    stats.atime.getTime(), stats.mtime.getTime(), stats.ctime.getTime(),
+    birthtime.getTime()
+  ];
+}
+
+/**
+ * Encode a callback result as a binary response body.
+ *
+ * Errors become a negative errno result followed by the error code string,
+ * the path, if any, and for a batch the method id of the call that failed.
+ * Numbers are returned as the result itself, Buffers as the
+ * payload, stats and arrays as one value per field or element and anything
+ * else as a single value. An array with a Buffer gives values and a payload.
+ */
+PassthroughApi.prototype.encodeBinaryResult = function (error, result, result2) {
+  if (error) {
+    var errno = constants[error.code] || constants.EIO;
+    var values = [String(error.code || error.message)];
+    if (error.path) {
+      values.push(error.path);
+    }
+    // Which call of a batch failed, see CODIUS_RPC_FS_BATCH.
+    if (error.batchMethod !== undefined) {
+      values.push(error.batchMethod);
+    }
+    return format.encodeResponse(-errno, values);
+  } else if (Array.isArray(result) && Buffer.isBuffer(result2)) {
+    return format.encodeResponse(0, result, result2);
+  } else if (result instanceof fs.Stats) {
+    return format.encodeResponse(0, statsValues(result));
+  } else if (Array.isArray(result)) {
+    return format.encodeResponse(0, result);
+  } else if (result2 !== undefined) {
+    return format.encodeResponse(0, [result, result2]);
+  } else if (typeof result === 'number') {
+    return format.encodeResponse(result);
+  } else if (Buffer.isBuffer(result)) {
+    // Raw bytes go in the payload, with their length as the result.
+    return format.encodeResponse(result.length, [], result);
+  } else if (result === undefined || result === null) {
+    return format.encodeResponse(0);
+  } else {
+    return format.encodeResponse(0, [result]);
+  }
+};
+
+PassthroughApi.prototype.binaryAsyncCallback = function (callback_id, error, result, result2) {
+  this.pushResponse(callback_id, this.encodeBinaryResult(error, result, result2));
+};
+
+PassthroughApi.prototype.binarySyncCallback = function (error, result, result2) {
+  var responseBuffer = this.encodeBinaryResult(error, result, result2);
+
+  format.writeFrames(this._sandbox.channel, format.MAGIC_BYTES_BINARY,
+                     responseBuffer);
 };
 
 exports.PassthroughApi = PassthroughApi;
\ No newline at end of file
@@ -1,2 +1,256 @@
 exports.HEADER_SIZE = 12;
-exports.MAGIC_BYTES = 0xC0D105FE;
\ No newline at end of file
+exports.MAGIC_BYTES = 0xC0D105FE;
+exports.MAGIC_BYTES_BINARY = 0xC0D1B1FE;
+exports.MAGIC_BYTES_EVENT = 0xC0D1E7FE;
+exports.MAGIC_BYTES_COMPLETION = 0xC0D1C0FE;
+exports.MAGIC_BYTES_CONTINUATION = 0xC0D1CCFE;
+exports.MAGIC_BYTES_DATA = 0xC0D1DAFE;
+
+// Largest frame body a response is split into, see codius-util.h
+exports.FRAME_CHUNK_SIZE = 65536;
+
+// Readiness event flags, see codius-util.h
+exports.EVENT_READABLE = 1;
+exports.EVENT_WRITABLE = 2;
+
+// Size of a socket's receive ring in the sandbox, see codius-util.h
+exports.RECV_WINDOW = 262144;
+
+// Stands for the descriptor opened earlier in the same fs batch
+exports.FS_BATCH_FD = -2;
+
+// Value type tags of the binary encoding, see codius-util.h
+var TYPE_INT32 = exports.TYPE_INT32 = 1;
+var TYPE_DOUBLE = exports.TYPE_DOUBLE = 2;
+var TYPE_STRING = exports.TYPE_STRING = 3;
+
+// Binary method ids, keep in sync with codius_rpc_method_t in codius-util.h
+// Methods marked with payload receive the raw payload of the request as their
+// last argument.
+var METHODS = exports.METHODS = {
+  0x0101: { api: 'fs', method: 'open' },
+  0x0102: { api: 'fs', method: 'close' },
+  0x0103: { api: 'fs', method: 'read' },
+  0x0104: { api: 'fs', method: 'stat' },
+  0x0105: { api: 'fs', method: 'lstat' },
+  0x0106: { api: 'fs', method: 'fstat' },
+  0x0107: { api: 'fs', method: 'readdir' },
+  0x0108: { api: 'fs', method: 'scan' },
+  0x0109: { api: 'fs', method: 'batch' },
+  0x0201: { api: 'net', method: 'socket' },
+  0x0202: { api: 'net', method: 'accept' },
+  0x0203: { api: 'net', method: 'close' },
+  0x0204: { api: 'net', method: 'bind' },
+  0x0205: { api: 'net', method: 'connect' },
+  0x0206: { api: 'net', method: 'read' },
+  0x0207: { api: 'net', method: 'write', payload: true },
+  0x0208: { api: 'net', method: 'getRemoteFamily' },
+  0x0209: { api: 'net', method: 'getRemoteAddress' },
+  0x020A: { api: 'net', method: 'getRemotePort' },
+  0x020B: { api: 'net', method: 'poll', payload: true },
+  0x020C: { api: 'net', method: 'credit' },
+  0x020D: { api: 'net', method: 'acceptBatch' },
+  0x0401: { api: 'log', method: 'write', payload: true },
+  0x0501: { api: 'cache', method: 'get' },
+  0x0502: { api: 'cache', method: 'put', payload: true },
+  0x0601: { api: 'sandbox', method: 'load' }
+};
+
+/**
+ * Write a response body to stream as one or more frames.
+ *
+ * Bodies larger than FRAME_CHUNK_SIZE are split: every frame but the last
+ * carries MAGIC_BYTES_CONTINUATION, and the last one magic. The sandbox
+ * reads them back a chunk at a time.
+ */
+exports.writeFrames = function (stream, magic, body) {
+  var offset = 0;
+
+  do {
+    var size = Math.min(body.length - offset, exports.FRAME_CHUNK_SIZE);
+    var last = offset + size === body.length;
+    var header = new Buffer(exports.HEADER_SIZE);
+
+    header.writeUInt32LE(last ? magic : exports.MAGIC_BYTES_CONTINUATION, 0);
+    header.writeUInt32LE(0, 4);
+    header.writeUInt32LE(size, 8);
+    stream.write(header);
+    stream.write(body.slice(offset, offset + size));
+    offset += size;
+  } while (offset < body.length);
+};
+
+/**
+ * Decode a binary request body.
+ *
+ * Layout: uint32 method | uint32 count | value * count | payload
+ */
+exports.decodeRequest = function (buffer) {
+  var method = buffer.readUInt32LE(0);
+  var count = buffer.readUInt32LE(4);
+  var offset = 8;
+  var args = [];
+
+  for (var i = 0; i < count; i++) {
+    var type = buffer.readUInt32LE(offset);
+    offset += 4;
+    switch (type) {
+      case TYPE_INT32:
+        args.push(buffer.readInt32LE(offset));
+        offset += 4;
+        break;
+      case TYPE_DOUBLE:
+        args.push(buffer.readDoubleLE(offset));
+        offset += 8;
+        break;
+      case TYPE_STRING:
+        var length = buffer.readUInt32LE(offset);
+        offset += 4;
+        args.push(buffer.toString('utf8', offset, offset + length));
+        offset += length;
+        break;
+      default:
+        throw new Error('Invalid binary value type: ' + type);
+    }
+  }
+
+  var def = METHODS[method];
+  if (def && def.payload) {
+    args.push(buffer.slice(offset));
+  }
+
+  return {
+    id: method,
+    api: def ? def.api : null,
+    method: def ? def.method : null,
+    args: args
+  };
+};
+
+function encodedValueLength(value) {
+  if (typeof value === 'number') {
+    return (value | 0) === value ? 8 : 12;
+  } else if (Buffer.isBuffer(value)) {
+    return 8 + value.length;
+  } else {
+    return 8 + Buffer.byteLength(String(value), 'utf8');
+  }
+}
+
+/**
+ * Encode a binary response body.
+ *
+ * Layout: int32 result | uint32 count | value * count | payload
+ *
+ * Integers that fit in 32 bits are sent as int32, other numbers as double and
+ * everything else as a string.
+ */
+exports.encodeResponse = function (result, values, payload) {
+  values = values || [];
+
+  var length = 8;
+  values.forEach(function (value) {
+    length += encodedValueLength(value);
+  });
+
+  var buffer = new Buffer(length + (payload ? payload.length : 0));
+  buffer.writeInt32LE(result, 0);
+  buffer.writeUInt32LE(values.length, 4);
+
+  var offset = 8;
+  values.forEach(function (value) {
+    if (typeof value === 'number' && (value | 0) === value) {
+      buffer.writeUInt32LE(TYPE_INT32, offset);
+      buffer.writeInt32LE(value, offset + 4);
+      offset += 8;
+    } else if (typeof value === 'number') {
+      buffer.writeUInt32LE(TYPE_DOUBLE, offset);
+      buffer.writeDoubleLE(value, offset + 4);
+      offset += 12;
+    } else {
+      var bytes = Buffer.isBuffer(value) ? value : new Buffer(String(value), 'utf8');
+      buffer.writeUInt32LE(TYPE_STRING, offset);
+      buffer.writeUInt32LE(bytes.length, offset + 4);
+      bytes.copy(buffer, offset + 8);
+      offset += 8 + bytes.length;
+    }
+  });
+
+  if (payload) {
+    payload.copy(buffer, offset);
+  }
+
+  return buffer;
+};
+
+/**
+ * Encode a readiness event frame, header included.
+ *
+ * Layout: (int32 fd | uint32 events) * n
+ */
+exports.encodeEvents = function (events) {
+  var buffer = new Buffer(exports.HEADER_SIZE + events.length * 8);
+  var offset = exports.HEADER_SIZE;
+
+  buffer.writeUInt32LE(exports.MAGIC_BYTES_EVENT, 0);
+  buffer.writeUInt32LE(0, 4);
+  buffer.writeUInt32LE(events.length * 8, 8);
+
+  events.forEach(function (event) {
+    buffer.writeInt32LE(event.fd, offset);
+    buffer.writeUInt32LE(event.events, offset + 4);
+    offset += 8;
+  });
+
+  return buffer;
+};
+
+/**
+ * Encode a completion frame, header included.
+ *
+ * Layout: (uint32 callback_id | uint32 size | message * size) * n
+ */
+exports.encodeCompletions = function (responses) {
+  var size = 0;
+
+  responses.forEach(function (response) {
+    size += 8 + response.message.length;
+  });
+
+  var buffer = new Buffer(exports.HEADER_SIZE + size);
+  var offset = exports.HEADER_SIZE;
+
+  buffer.writeUInt32LE(exports.MAGIC_BYTES_COMPLETION, 0);
+  buffer.writeUInt32LE(0, 4);
+  buffer.writeUInt32LE(size, 8);
+
+  responses.forEach(function (response) {
+    buffer.writeUInt32LE(response.callback_id, offset);
+    buffer.writeUInt32LE(response.message.length, offset + 4);
+    response.message.copy(buffer, offset + 8);
+    offset += 8 + response.message.length;
+  });
+
+  return buffer;
+};
+
+/**
+ * Encode a data frame pushing received socket data, header included.
+ *
+ * Layout: int32 fd | int32 status | data
+ */
+exports.encodeData = function (fd, status, data) {
+  var size = 8 + (data ? data.length : 0);
+  var buffer = new Buffer(exports.HEADER_SIZE + size);
+
+  buffer.writeUInt32LE(exports.MAGIC_BYTES_DATA, 0);
+  buffer.writeUInt32LE(0, 4);
+  buffer.writeUInt32LE(size, 8);
+  buffer.writeInt32LE(fd, exports.HEADER_SIZE);
+  buffer.writeInt32LE(status, exports.HEADER_SIZE + 4);
+  if (data) {
+    data.copy(buffer, exports.HEADER_SIZE + 8);
+  }
+
+  return buffer;
+};
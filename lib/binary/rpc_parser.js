@@ -23,16 +23,23 @@ RpcParser.prototype.onheader = function (buffer, output) {
   header.callback_id = buffer.readUInt32LE(4);
   header.size = buffer.readUInt32LE(8);
   
-  if (header.magic !== format.MAGIC_BYTES) {
+  if (header.magic !== format.MAGIC_BYTES &&
+      header.magic !== format.MAGIC_BYTES_BINARY) {
     throw new Error("Magic bytes don't match (received: "+buffer.slice(0, 4).toString('hex')+')');
   }
   this.emit('header', header);
 
-  this._bytes(header.size, this.onbody.bind(this, header.callback_id));
+  this._bytes(header.size, this.onbody.bind(this, header));
 };
 
-RpcParser.prototype.onbody = function (callback_id, buffer) {
-  this.emit('message', buffer.toString('utf-8'), callback_id);
+RpcParser.prototype.onbody = function (header, buffer) {
+  // The magic bytes tell us how the sandbox encoded this message. Responses
+  // must be sent back in the same encoding.
+  if (header.magic === format.MAGIC_BYTES_BINARY) {
+    this.emit('call', format.decodeRequest(buffer), header.callback_id);
+  } else {
+    this.emit('message', buffer.toString('utf-8'), header.callback_id);
+  }
 
   this._bytes(format.HEADER_SIZE, this.onheader); 
 };
@@ -0,0 +1,261 @@
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var util = require('util');
+var Duplex = require('stream').Duplex;
+
+// Layout of the shared memory transport, see codius-util.h
+var SHM_MAGIC = exports.SHM_MAGIC = 0xC0D15A4E;
+var CACHE_LINE_SIZE = 64;
+var RING_HEADER_SIZE = 4 * CACHE_LINE_SIZE;
+var HEAD = 0;
+var TAIL = CACHE_LINE_SIZE;
+var CONSUMER_WAITING = 2 * CACHE_LINE_SIZE;
+var PRODUCER_WAITING = 3 * CACHE_LINE_SIZE;
+
+// Looks at the request ring again this many times after it ran empty before
+// asking the sandbox for a doorbell.
+var SPIN = 8;
+
+var DEFAULT_RING_SIZE = 1024 * 1024;
+
+/**
+ * Create the shared file for a sandbox, see "Shared memory transport" in
+ * codius-util.h.
+ *
+ * The file goes in /dev/shm if there is one, and is unlinked right away, so
+ * only the open descriptor keeps it.
+ *
+ * @param {Number} [ringSize] Bytes per ring, a power of two (default 1 MiB)
+ * @returns {Object} { fd, ringSize }
+ */
+exports.allocate = function (ringSize) {
+  ringSize = ringSize || DEFAULT_RING_SIZE;
+  if (ringSize & (ringSize - 1)) {
+    throw new Error('Ring size must be a power of two: ' + ringSize);
+  }
+
+  var dir = fs.existsSync('/dev/shm') ? '/dev/shm' : os.tmpdir();
+  var file = path.join(dir, 'codius-' + process.pid + '-' +
+                            Math.random().toString(36).slice(2));
+  var fd = fs.openSync(file, 'wx+', 384);  // 0600
+  fs.unlinkSync(file);
+
+  var size = CACHE_LINE_SIZE + 2 * (RING_HEADER_SIZE + ringSize);
+  fs.ftruncateSync(fd, size);
+
+  // Every field starts out as 0 with its check.
+  [CACHE_LINE_SIZE, CACHE_LINE_SIZE + RING_HEADER_SIZE + ringSize]
+    .forEach(function (ring) {
+      [HEAD, TAIL, CONSUMER_WAITING, PRODUCER_WAITING].forEach(function (field) {
+        storeField(fd, ring + field, 0);
+      });
+    });
+
+  // The magic goes last, the sandbox ignores the file without it.
+  var header = new Buffer(8);
+  header.writeUInt32LE(SHM_MAGIC, 0);
+  header.writeUInt32LE(ringSize, 4);
+  fs.writeSync(fd, header, 0, 8, 0);
+
+  return { fd: fd, ringSize: ringSize };
+};
+
+var fieldBuffer = new Buffer(8);
+
+function storeField(fd, offset, value) {
+  fieldBuffer.writeUInt32LE(value >>> 0, 0);
+  fieldBuffer.writeUInt32LE(~value >>> 0, 4);
+  fs.writeSync(fd, fieldBuffer, 0, 8, offset);
+}
+
+// Read a field once its value and check agree, see codius-util.h.
+function loadField(fd, offset) {
+  for (;;) {
+    fs.readSync(fd, fieldBuffer, 0, 8, offset);
+    var value = fieldBuffer.readUInt32LE(0);
+    if (fieldBuffer.readUInt32LE(4) === (~value >>> 0)) {
+      return value;
+    }
+  }
+}
+
+/**
+ * The host's end of the shared memory transport of a sandbox.
+ *
+ * Reads as the byte stream of the sandbox's requests and takes the byte
+ * stream of responses, just like the sandbox's fd 3 does without the
+ * transport. doorbell is that fd 3, which only carries wake-ups then.
+ *
+ * The host has no mapping of the file and goes through positional reads and
+ * writes instead, so every access is a system call. What the transport saves
+ * is the sandbox's side: while the host keeps up, the sandbox moves its
+ * frames without any.
+ *
+ * @param {Number} fd The file from allocate
+ * @param {Number} ringSize
+ * @param {Stream} doorbell
+ */
+function ShmChannel(fd, ringSize, doorbell) {
+  var self = this;
+
+  Duplex.call(self);
+
+  self._fd = fd;
+  self._ringSize = ringSize;
+  self._request = CACHE_LINE_SIZE;
+  self._requestData = self._request + RING_HEADER_SIZE;
+  self._response = self._requestData + ringSize;
+  self._responseData = self._response + RING_HEADER_SIZE;
+  self._doorbell = doorbell;
+
+  // Only we write the request tail and the response head.
+  self._requestTail = 0;
+  self._responseHead = 0;
+
+  // Responses waiting for space in the ring, with their write callbacks.
+  self._pending = [];
+  self._spins = 0;
+  self._spin_scheduled = false;
+  self._closed = false;
+
+  doorbell.on('data', function () {
+    self._service();
+  });
+  doorbell.on('end', function () {
+    self._close();
+  });
+  doorbell.on('close', function () {
+    self._close();
+  });
+
+  // The sandbox may have sent requests before we got here.
+  self._service();
+}
+util.inherits(ShmChannel, Duplex);
+
+ShmChannel.prototype._read = function () {
+  // Requests are pushed as they are found in the ring.
+};
+
+ShmChannel.prototype._write = function (chunk, encoding, callback) {
+  this._pending.push({ data: chunk, offset: 0, callback: callback });
+  this._flush();
+};
+
+ShmChannel.prototype._ring = function () {
+  this._doorbell.write(new Buffer(1));
+};
+
+ShmChannel.prototype._close = function () {
+  if (this._closed) return;
+  this._closed = true;
+  fs.closeSync(this._fd);
+  this.push(null);
+};
+
+/**
+ * Take the requests out of the ring and push responses into it.
+ */
+ShmChannel.prototype._service = function () {
+  if (this._closed) return;
+
+  var fd = this._fd;
+  var size = this._ringSize;
+  var tail = this._requestTail;
+  var head = loadField(fd, this._request + HEAD);
+  var avail = (head - tail) >>> 0;
+
+  if (avail > size) {
+    this.emit('error', new Error('Invalid request ring head: ' + head));
+    return;
+  }
+
+  if (avail > 0) {
+    var data = new Buffer(avail);
+    var offset = tail & (size - 1);
+    var first = Math.min(avail, size - offset);
+
+    fs.readSync(fd, data, 0, first, this._requestData + offset);
+    if (first < avail) {
+      fs.readSync(fd, data, first, avail - first, this._requestData);
+    }
+    this._requestTail = (tail + avail) >>> 0;
+    storeField(fd, this._request + TAIL, this._requestTail);
+    if (loadField(fd, this._request + PRODUCER_WAITING)) {
+      this._ring();
+    }
+    this.push(data);
+  }
+
+  this._flush();
+  this._spin(avail > 0);
+};
+
+/**
+ * Keep looking at the request ring for a few turns of the event loop after
+ * it had data, then ask for a doorbell and check once more.
+ */
+ShmChannel.prototype._spin = function (busy) {
+  var self = this;
+
+  if (busy) {
+    self._spins = 0;
+    storeField(self._fd, self._request + CONSUMER_WAITING, 0);
+  } else if (self._spins >= SPIN) {
+    return;
+  }
+
+  if (self._spin_scheduled) return;
+  self._spin_scheduled = true;
+
+  setImmediate(function () {
+    self._spin_scheduled = false;
+    if (self._closed) return;
+
+    if (++self._spins === SPIN) {
+      storeField(self._fd, self._request + CONSUMER_WAITING, 1);
+    }
+    self._service();
+  });
+};
+
+ShmChannel.prototype._flush = function () {
+  var fd = this._fd;
+  var size = this._ringSize;
+  var wrote = false;
+
+  while (this._pending.length) {
+    var head = this._responseHead;
+    var space = size - ((head - loadField(fd, this._response + TAIL)) >>> 0);
+
+    if (space === 0) {
+      // Ask for a doorbell once there is space, then look again.
+      storeField(fd, this._response + PRODUCER_WAITING, 1);
+      space = size - ((head - loadField(fd, this._response + TAIL)) >>> 0);
+      if (space === 0) break;
+    }
+    storeField(fd, this._response + PRODUCER_WAITING, 0);
+
+    var entry = this._pending[0];
+    var offset = head & (size - 1);
+    var n = Math.min(entry.data.length - entry.offset, space, size - offset);
+
+    fs.writeSync(fd, entry.data, entry.offset, n, this._responseData + offset);
+    this._responseHead = (head + n) >>> 0;
+    storeField(fd, this._response + HEAD, this._responseHead);
+    wrote = true;
+
+    entry.offset += n;
+    if (entry.offset === entry.data.length) {
+      this._pending.shift();
+      entry.callback();
+    }
+  }
+
+  if (wrote && loadField(fd, this._response + CONSUMER_WAITING)) {
+    this._ring();
+  }
+};
+
+exports.ShmChannel = ShmChannel;
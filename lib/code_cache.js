@@ -0,0 +1,117 @@
+/**
+ * Compiled code cache data of contract modules, by manifest hash and module
+ * path.
+ *
+ * The cache lives in memory and is per host process: it is shared by all
+ * sandboxes the process runs, so later runs of a contract can use it, and it
+ * is gone when the process exits. Entries are evicted least recently used
+ * first, so that no contract holds more than maxManifestBytes and all of them
+ * together no more than maxBytes.
+ *
+ * Takes these options:
+ *   maxManifestBytes - bytes kept for one manifest hash (default 8 MiB)
+ *   maxBytes         - bytes kept in total (default 64 MiB)
+ */
+function CodeCache(opts) {
+  if (!opts) {
+    opts = {};
+  }
+
+  this._maxManifestBytes = opts.maxManifestBytes || 8 * 1024 * 1024;
+  this._maxBytes = opts.maxBytes || 64 * 1024 * 1024;
+  this._bytes = 0;
+
+  // Entries by manifest hash and path, least recently used first. Object
+  // keys keep their insertion order, so a use moves a key to the end.
+  this._entries = {};
+  // Per manifest hash: its bytes and its keys in _entries, in the same order.
+  this._manifests = {};
+}
+
+function entryKey(manifestHash, path) {
+  return manifestHash + '\0' + path;
+}
+
+/**
+ * Get the cache data of a module.
+ *
+ * @returns {Buffer} The data, or null if there is none
+ */
+CodeCache.prototype.get = function (manifestHash, path) {
+  var key = entryKey(manifestHash, path);
+  var entry = this._entries[key];
+
+  if (!entry) {
+    return null;
+  }
+
+  this._touch(key, entry);
+  return entry.data;
+};
+
+/**
+ * Store the cache data of a module, evicting older entries to make room.
+ * Data larger than a contract's share is not kept at all.
+ */
+CodeCache.prototype.put = function (manifestHash, path, data) {
+  var key = entryKey(manifestHash, path);
+  var manifest;
+
+  if (this._entries[key]) {
+    this._remove(key);
+  }
+  if (data.length > this._maxManifestBytes || data.length > this._maxBytes) {
+    return;
+  }
+
+  manifest = this._manifests[manifestHash];
+  while (manifest && manifest.bytes + data.length > this._maxManifestBytes) {
+    this._remove(firstKey(manifest.keys));
+    manifest = this._manifests[manifestHash];
+  }
+  while (this._bytes + data.length > this._maxBytes) {
+    this._remove(firstKey(this._entries));
+  }
+
+  manifest = this._manifests[manifestHash];
+  if (!manifest) {
+    manifest = this._manifests[manifestHash] = { bytes: 0, keys: {} };
+  }
+
+  this._entries[key] = { manifestHash: manifestHash, data: data };
+  manifest.keys[key] = true;
+  manifest.bytes += data.length;
+  this._bytes += data.length;
+};
+
+CodeCache.prototype._touch = function (key, entry) {
+  var keys = this._manifests[entry.manifestHash].keys;
+
+  delete this._entries[key];
+  this._entries[key] = entry;
+  delete keys[key];
+  keys[key] = true;
+};
+
+CodeCache.prototype._remove = function (key) {
+  var entry = this._entries[key];
+  var manifest = this._manifests[entry.manifestHash];
+
+  delete this._entries[key];
+  delete manifest.keys[key];
+  manifest.bytes -= entry.data.length;
+  this._bytes -= entry.data.length;
+
+  if (!firstKey(manifest.keys)) {
+    delete this._manifests[entry.manifestHash];
+  }
+};
+
+function firstKey(object) {
+  for (var key in object) {
+    return key;
+  }
+  return null;
+}
+
+exports.CodeCache = CodeCache;
@@ -0,0 +1,162 @@
+var fs = require('fs');
+var path = require('path');
+
+// Layout of the contract image, see "Contract image" in codius-util.h
+var MAGIC = exports.MAGIC = 0xC0D11A6E;
+var VERSION = exports.VERSION = 1;
+var HEADER_SIZE = 32;
+var ENTRY_SIZE = 40;
+
+/**
+ * Collect the directories and regular files below dir, depth first.
+ *
+ * Symlinks and special files are left out, so nothing outside dir can end up
+ * in the image.
+ */
+function collect(dir, sandboxPath, list) {
+  var stats = fs.lstatSync(dir);
+
+  if (!stats.isDirectory() && !stats.isFile()) {
+    return;
+  }
+
+  list.push({
+    path: new Buffer(sandboxPath, 'utf8'),
+    hostPath: dir,
+    stats: stats,
+    children: []
+  });
+
+  if (stats.isDirectory()) {
+    fs.readdirSync(dir).forEach(function (name) {
+      var child = sandboxPath === '/' ? '/' + name : sandboxPath + '/' + name;
+      collect(path.join(dir, name), child, list);
+    });
+  }
+}
+
+function comparePaths(a, b) {
+  var n = Math.min(a.length, b.length);
+
+  for (var i = 0; i < n; i++) {
+    if (a[i] !== b[i]) {
+      return a[i] - b[i];
+    }
+  }
+  return a.length - b.length;
+}
+
+function align(offset, to) {
+  return Math.ceil(offset / to) * to;
+}
+
+/**
+ * Build an image of the contract files in dir.
+ *
+ * Inside the sandbox, dir appears at root (an absolute path), and every path
+ * below root is served from the image without asking the host.
+ *
+ * @param {String} dir Directory on the host
+ * @param {String} root Where the sandbox sees it
+ * @returns {Buffer} The image
+ */
+exports.build = function (dir, root) {
+  var entries = [];
+
+  root = path.normalize(root);
+  if (root.charAt(0) !== '/') {
+    throw new Error('Image root must be an absolute path: ' + root);
+  }
+  if (root.length > 1 && root.charAt(root.length - 1) === '/') {
+    root = root.slice(0, -1);
+  }
+
+  collect(dir, root, entries);
+  if (!entries.length || !entries[0].stats.isDirectory()) {
+    throw new Error('Not a directory: ' + dir);
+  }
+
+  // Sorted by path the root comes first, and each directory's children come
+  // in order of their names.
+  entries.sort(function (a, b) {
+    return comparePaths(a.path, b.path);
+  });
+
+  var index = {};
+  entries.forEach(function (entry, i) {
+    index[entry.path.toString('utf8')] = i;
+  });
+  entries.forEach(function (entry, i) {
+    if (i === 0) return;
+    var p = entry.path.toString('utf8');
+    var parent = p.slice(0, p.lastIndexOf('/')) || '/';
+    entries[index[parent]].children.push(i);
+  });
+
+  // Header, entries, children table, paths, then file data.
+  var childrenOffset = HEADER_SIZE + entries.length * ENTRY_SIZE;
+  var childrenCount = entries.length - 1;
+  var offset = childrenOffset + childrenCount * 4;
+
+  entries.forEach(function (entry) {
+    entry.pathOffset = offset;
+    offset += entry.path.length;
+  });
+  entries.forEach(function (entry) {
+    if (entry.stats.isFile()) {
+      offset = align(offset, 8);
+      entry.dataOffset = offset;
+      offset += entry.stats.size;
+    } else {
+      entry.dataOffset = 0;
+    }
+  });
+
+  var image = new Buffer(offset);
+  image.fill(0);
+
+  image.writeUInt32LE(MAGIC, 0);
+  image.writeUInt32LE(VERSION, 4);
+  image.writeUInt32LE(entries.length, 8);
+  image.writeUInt32LE(childrenOffset, 12);
+  image.writeUInt32LE(childrenCount, 16);
+
+  var child = 0;
+  entries.forEach(function (entry, i) {
+    var pos = HEADER_SIZE + i * ENTRY_SIZE;
+    var isFile = entry.stats.isFile();
+
+    image.writeUInt32LE(entry.pathOffset, pos);
+    image.writeUInt32LE(entry.path.length, pos + 4);
+    image.writeUInt32LE(entry.stats.mode, pos + 8);
+    image.writeUInt32LE(isFile ? entry.stats.size : 0, pos + 12);
+    image.writeUInt32LE(entry.dataOffset, pos + 16);
+    image.writeUInt32LE(child, pos + 20);
+    image.writeUInt32LE(entry.children.length, pos + 24);
+    image.writeDoubleLE(entry.stats.mtime.getTime(), pos + 32);
+
+    entry.children.forEach(function (c) {
+      image.writeUInt32LE(c, childrenOffset + child * 4);
+      child++;
+    });
+
+    entry.path.copy(image, entry.pathOffset);
+    if (isFile) {
+      var fd = fs.openSync(entry.hostPath, 'r');
+      try {
+        fs.readSync(fd, image, entry.dataOffset, entry.stats.size, 0);
+      } finally {
+        fs.closeSync(fd);
+      }
+    }
+  });
+
+  return image;
+};
+
+/**
+ * Build an image of dir, see build, and write it to file.
+ */
+exports.writeSync = function (file, dir, root) {
+  fs.writeFileSync(file, exports.build(dir, root));
+};
@@ -1,4 +1,5 @@
 var net = require('net');
+var format = require('../binary/format');
 
 var FakeSocket = function (domain, type, protocol) {
   if (domain !== FakeSocket.AF_INET) {
@@ -17,14 +18,111 @@ var FakeSocket = function (domain, type, protocol) {
   this._buffer = [];
   this._sockets_to_accept = [];
   this._eof = false;
+
+  // Received data is pushed to the sandbox once it has granted credit.
+  this._push = false;
+  this._credit = 0;
+  this._bufferedBytes = 0;
+  this._eofPushed = false;
+
+  // Set while the host socket buffers more than it wants to.
+  this._needDrain = false;
+
+  // Called when the socket may have become readable.
+  this.onreadable = null;
+
+  // Called with (data, status) to push received data in push mode.
+  this.ondata = null;
+
+  // Called when the socket has drained and is writable again.
+  this.onwritable = null;
 }
 
 FakeSocket.AF_INET = 2;
 
 FakeSocket.SOCK_STREAM = 1;
 
+FakeSocket.prototype._readable = function () {
+  if (this.onreadable) {
+    this.onreadable();
+  }
+};
+
+/**
+ * Start buffering what arrives on socket.
+ */
+FakeSocket.prototype._attach = function (socket) {
+  var self = this;
+
+  self._socket = socket;
+
+  socket.on('data', function(data) {
+    self._buffer.push(data);
+    self._bufferedBytes += data.length;
+
+    // Stop reading from the network while the sandbox lags behind.
+    if (self._bufferedBytes > format.RECV_WINDOW) {
+      socket.pause();
+    }
+
+    self._push ? self._flush() : self._readable();
+  });
+
+  socket.on('end', function () {
+    self._eof = true;
+    self._push ? self._flush() : self._readable();
+  });
+
+  socket.on('drain', function () {
+    self._needDrain = false;
+    if (self.onwritable) {
+      self.onwritable();
+    }
+  });
+};
+
+/**
+ * Allow bytes more to be pushed, switching to push mode on the first call.
+ */
+FakeSocket.prototype.grant = function (bytes) {
+  this._push = true;
+  this._credit += bytes;
+  this._flush();
+};
+
+/**
+ * Push as much buffered data as the credit allows, then the end of the
+ * stream once everything before it went out.
+ */
+FakeSocket.prototype._flush = function () {
+  var self = this;
+
+  while (self._buffer.length && self._credit > 0) {
+    var buffer = self._buffer.shift();
+    if (buffer.length > self._credit) {
+      self._buffer.unshift(buffer.slice(self._credit));
+      buffer = buffer.slice(0, self._credit);
+    }
+
+    self._credit -= buffer.length;
+    self._bufferedBytes -= buffer.length;
+    self.ondata(buffer, 0);
+  }
+
+  if (!self._buffer.length && self._eof && !self._eofPushed) {
+    self._eofPushed = true;
+    // UV_EOF (end of file)
+    self.ondata(null, -4095);
+  }
+
+  if (self._socket && self._bufferedBytes <= format.RECV_WINDOW) {
+    self._socket.resume();
+  }
+};
+
 FakeSocket.prototype.connect = function (family, address, port, callback) {
   var self = this;
+  var answered = false;
 
   if (family != FakeSocket.AF_INET) {
     throw new Error("Unsupported socket family: "+family);
@@ -39,24 +137,23 @@ FakeSocket.prototype.connect = function (family, address, port, callback) {
   
   // Convert endianness
   port = (port >> 8 & 0xff) + (port << 8 & 0xffff);
-  self._socket = net.createConnection({
+  self._attach(net.createConnection({
     port: port, 
     host: addressArray.join('.')
-  });
+  }));
   self._socket.once('connect', function (e) {
     // console.log('FakeSocket connected to ' + addressArray.join('.') + ':' + port);
+    answered = true;
     callback(null, 0);
   });
-
-  self._socket.on('data', function(data) {
-    self._buffer.push(data);
-  });
-  
-  self._socket.on('end', function () {
-    self._eof = true;
-  });
   
   self._socket.on('error', function(error){
+    // A failed handshake is the answer to the connect call.
+    if (!answered) {
+      answered = true;
+      callback(error);
+      return;
+    }
     console.log('socket error: ', error);
   });
 };
@@ -85,6 +182,7 @@ FakeSocket.prototype.bind = function (family, address, port, callback) {
 
     // We have a connection - a socket object will be assigned to the connection with accept()
     self._sockets_to_accept.push(sock);
+    self._readable();
 
     // console.log('Fake socket server connected to: ' + sock.remoteAddress +':'+ sock.remotePort);
       
@@ -96,9 +194,22 @@ FakeSocket.prototype.bind = function (family, address, port, callback) {
 FakeSocket.prototype.accept = function() {
   var self = this;
 
-  return self._sockets_to_accept.shift();
+  var sock = self._sockets_to_accept.shift();
+  if (self._sockets_to_accept.length) {
+    self._readable();
+  }
+  return sock;
 }
 
+FakeSocket.prototype.isReadable = function () {
+  // In push mode, received data is already on its way to the sandbox.
+  if (this._push) {
+    return this._sockets_to_accept.length > 0;
+  }
+  return this._buffer.length > 0 || this._eof ||
+         this._sockets_to_accept.length > 0;
+};
+
 FakeSocket.prototype.read = function (maxBytes, callback) {
   var self = this;
 
@@ -117,15 +228,46 @@ FakeSocket.prototype.read = function (maxBytes, callback) {
     self._buffer.unshift(buffer.slice(maxBytes));
     buffer = buffer.slice(0, maxBytes);
   }
+  self._bufferedBytes -= buffer.length;
+
+  // Room again for what the network has to give.
+  if (self._socket && self._bufferedBytes <= format.RECV_WINDOW) {
+    self._socket.resume();
+  }
+
+  callback(null, buffer);
+
+  // Whatever is left (including EOF) needs another read.
+  if (self._buffer.length || self._eof) {
+    self._readable();
+  }
+};
 
-  callback(null, buffer.toString('hex'));
+FakeSocket.prototype.isWritable = function () {
+  return !this._needDrain;
 };
 
-FakeSocket.prototype.write = function (stringToWrite, callback) {
+/**
+ * Write data, answering once the socket has flushed it, so the sandbox
+ * counts what is buffered here as still queued. The answer is all of data's
+ * length or an error, the sandbox fails a write that comes back short.
+ */
+FakeSocket.prototype.write = function (data, callback) {
   var self = this;
 
-  self._socket.write(stringToWrite);
-  callback(null);
+  if (!Buffer.isBuffer(data)) {
+    data = new Buffer(data);
+  }
+
+  if (!self._socket.write(data, function (error) {
+        if (error) {
+          callback(error);
+        } else {
+          callback(null, data.length);
+        }
+      })) {
+    self._needDrain = true;
+  }
 }
 
 FakeSocket.prototype.close = function (callback) {
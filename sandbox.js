@@ -3,6 +3,7 @@ var spawn = require('child_process').spawn;
 var util = require('util');
 var path = require('path');
 var EventEmitter = require('events').EventEmitter;
+var shm = require('./lib/binary/shm_channel');
 
 // TODO: Make these configurable
 var NACL_SDK_ROOT = process.env.NACL_SDK_ROOT;
@@ -38,14 +39,29 @@ function Sandbox(opts) {
 	}
 
 	self.stdio = null;
+	// Where the API reads requests and writes responses, fd 3 or the shared
+	// memory transport on top of it
+	self.channel = null;
 	self._timeout = opts.timeout || 1000;
 	self._apiClass = opts.api || null;
 	self._disableNaCl = opts.disableNaCl || false;
 	self._enableGdb = opts.enableGdb || false;
 	self._enableValgrind = opts.enableValgrind || false;
+	self._pool = opts.pool || null;
+	// Contract image file, see lib/image.js
+	self._image = opts.image || null;
+	// Where log files the sandbox writes (e.g. V8's --prof log) end up
+	self._logDir = path.resolve(opts.logDir || 'logs');
+	// Talk to the sandbox through rings in shared memory (disableNaCl only),
+	// true or the size of each ring, see lib/binary/shm_channel.js
+	self._sharedMemory = opts.sharedMemory || false;
 
 	self._native_client_child = null;
 
+	// Identifies the contract being run, e.g. to key its code cache.
+	self.manifestHash = null;
+	self.filePath = null;
+
 }
 util.inherits(Sandbox, EventEmitter);
 
@@ -58,13 +74,28 @@ util.inherits(Sandbox, EventEmitter);
 Sandbox.prototype.run = function(manifest_hash, file_path) {
 	var self = this;
 
-	// Create new sandbox
-	self._native_client_child = self.spawnChildToRunCode(file_path, self._disableNaCl);
+	self.manifestHash = manifest_hash;
+	self.filePath = file_path;
+
+	// Use a parked sandbox if the pool has one started the same way, it asks
+	// the API for file_path
+	self._native_client_child = (self._pool && self._pool.take(self)) ||
+		self.spawnChildToRunCode(file_path, self._disableNaCl);
 	self._native_client_child.on('exit', function(code){
 		self.emit('exit', code);
 	});
 	self.stdio = self._native_client_child.stdio;
 
+	var region = self._native_client_child.codiusShm;
+	if (region) {
+		// The channel owns the region from here on
+		self._native_client_child.codiusShm = null;
+		self.channel = new shm.ShmChannel(region.fd, region.ringSize,
+		                                  self.stdio[3]);
+	} else {
+		self.channel = self.stdio[3];
+	}
+
 	if (this._apiClass) {
 		this._api = new this._apiClass(this);
 	}
@@ -78,7 +109,14 @@ Sandbox.prototype.spawnChildToRunCode = function (code, disableNaCl) {
 	var cmd = disableNaCl ? RUN_CONTRACT_COMMAND_NONACL : RUN_CONTRACT_COMMAND;
 	var args = disableNaCl ? RUN_CONTRACT_ARGS_NONACL.slice() : RUN_CONTRACT_ARGS.slice();
 
-	args.push(code);
+	// Modules can only use the host's code cache under a manifest hash. A
+	// parked sandbox learns whether to use it along with its contract.
+	if (code && this.manifestHash) {
+		args.push('--code-cache');
+	}
+
+	// Without code, start up and wait for the host to name a contract
+	args.push(code || '--park');
 
 	if (this._enableGdb) {
 		args.unshift(cmd);
@@ -93,16 +131,57 @@ Sandbox.prototype.spawnChildToRunCode = function (code, disableNaCl) {
   var env = {
     TEST:'/this/test/file'
   }
-	var child = spawn(cmd, args, {
-    env: env,
-	  stdio: [
+	var stdio = [
 	    'pipe',
 	    'pipe',
 	    'pipe',
 	    'pipe'
-	    ] 
+	    ];
+	var imageFd = null;
+	var region = null;
+
+	// Hand the contract image to the sandbox as fd 4
+	if (this._image) {
+		imageFd = fs.openSync(this._image, 'r');
+		stdio.push(imageFd);
+		if (disableNaCl) {
+			env.CODIUS_IMAGE_FD = '4';
+		} else {
+			var nexeArgs = args.indexOf('--');
+			args.splice(nexeArgs, 0, '-h', '4:4', '-E', 'CODIUS_IMAGE_FD=4');
+		}
+	}
+
+	// Hand the shared memory region to the sandbox as the next fd. Native
+	// Client can't map it, so sandboxes under it stay on fd 3.
+	if (this._sharedMemory && disableNaCl) {
+		region = shm.allocate(typeof this._sharedMemory === 'number' ?
+		                      this._sharedMemory : undefined);
+		env.CODIUS_SHM_FD = String(stdio.length);
+		stdio.push(region.fd);
+	}
+
+	var child = spawn(cmd, args, {
+    env: env,
+	  stdio: stdio
 	  });
 
+	if (imageFd !== null) {
+		fs.closeSync(imageFd);
+	}
+
+	// Sandbox.run hands the region to a ShmChannel, until then it dies with
+	// the child
+	if (region) {
+		child.codiusShm = region;
+		child.on('exit', function () {
+			if (child.codiusShm) {
+				fs.closeSync(child.codiusShm.fd);
+				child.codiusShm = null;
+			}
+		});
+	}
+
 	return child;
 }
 
@@ -120,4 +199,157 @@ Sandbox.prototype.kill = function(message){
 	self._native_client_child.kill(message);
 };
 
+/**
+ * Pool of sandboxes started ahead of time.
+ *
+ * Each one is parked right before loading its main module, so a contract run
+ * from the pool doesn't wait for the sandbox to start, link, initialize V8
+ * and bootstrap node. Taken sandboxes are replaced in the background.
+ *
+ * Takes the options of Sandbox, plus:
+ *   size   - number of sandboxes to keep parked (default 2)
+ *   maxAge - milliseconds after which a parked sandbox is replaced
+ *            (default 60000)
+ */
+function SandboxPool(opts) {
+	var self = this;
+
+	if (!opts) {
+		opts = {};
+	}
+
+	self._size = typeof opts.size === 'number' ? opts.size : 2;
+	self._maxAge = opts.maxAge || 60000;
+	self._spawner = new Sandbox(opts);
+	self._parked = [];
+	self._fill_scheduled = false;
+	self._closed = false;
+
+	self.fill();
+}
+
+/**
+ * Start sandboxes until the pool is full.
+ */
+SandboxPool.prototype.fill = function () {
+	while (!this._closed && this._parked.length < this._size) {
+		this._park();
+	}
+};
+
+SandboxPool.prototype._scheduleFill = function () {
+	var self = this;
+
+	if (self._fill_scheduled) return;
+	self._fill_scheduled = true;
+
+	setImmediate(function () {
+		self._fill_scheduled = false;
+		self.fill();
+	});
+};
+
+SandboxPool.prototype._park = function () {
+	var self = this;
+	var child = self._spawner.spawnChildToRunCode(null, self._spawner._disableNaCl);
+	var entry = {
+		child: child,
+		timer: null,
+		onExit: function () {
+			self._remove(entry);
+			self._scheduleFill();
+		}
+	};
+
+	child.on('exit', entry.onExit);
+
+	entry.timer = setTimeout(function () {
+		self._remove(entry);
+		child.kill('SIGKILL');
+		self._scheduleFill();
+	}, self._maxAge);
+	entry.timer.unref();
+
+	self._parked.push(entry);
+};
+
+SandboxPool.prototype._remove = function (entry) {
+	var index = this._parked.indexOf(entry);
+
+	if (index !== -1) {
+		this._parked.splice(index, 1);
+	}
+	clearTimeout(entry.timer);
+	entry.child.removeListener('exit', entry.onExit);
+};
+
+function spawnOptions(sandbox) {
+	var disableNaCl = sandbox._disableNaCl;
+
+	if (typeof disableNaCl==='string') {
+		disableNaCl = parseInt(disableNaCl);
+	}
+
+	return {
+		image: sandbox._image && path.resolve(sandbox._image),
+		disableNaCl: !!disableNaCl,
+		enableGdb: !!sandbox._enableGdb,
+		enableValgrind: !!sandbox._enableValgrind,
+		sharedMemory: !!disableNaCl && sandbox._sharedMemory || false
+	};
+}
+
+/**
+ * Tell if the pool's sandboxes are started the way sandbox would start its
+ * own: with the same image, and the same NaCl, gdb, valgrind and shared
+ * memory settings.
+ *
+ * @param {Sandbox} sandbox
+ */
+SandboxPool.prototype.matches = function (sandbox) {
+	var ours = spawnOptions(this._spawner);
+	var theirs = spawnOptions(sandbox);
+
+	return Object.keys(ours).every(function (key) {
+		return ours[key] === theirs[key];
+	});
+};
+
+/**
+ * Take a parked sandbox out of the pool.
+ *
+ * @param {Sandbox} [sandbox] Only take one that matches this sandbox
+ * @returns {ChildProcess} Parked child, or null if none is ready
+ */
+SandboxPool.prototype.take = function (sandbox) {
+	if (sandbox && !this.matches(sandbox)) {
+		return null;
+	}
+
+	var entry = this._parked.shift();
+
+	if (!entry) {
+		return null;
+	}
+	this._remove(entry);
+	this._scheduleFill();
+
+	return entry.child;
+};
+
+/**
+ * Kill the parked sandboxes and stop refilling the pool.
+ */
+SandboxPool.prototype.close = function () {
+	var parked = this._parked;
+
+	this._closed = true;
+	this._parked = [];
+	parked.forEach(function (entry) {
+		this._remove(entry);
+		entry.child.kill('SIGKILL');
+	}, this);
+};
+
 module.exports = Sandbox;
+module.exports.Pool = SandboxPool;
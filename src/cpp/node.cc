@@ -31,6 +31,7 @@
 #endif
 
 #include "codius_version.h"
+#include "codius-util.h"
 #include "env.h"
 #include "env-inl.h"
 #include "string_bytes.h"
@@ -93,6 +94,13 @@ static node_module* modlist_addon;
 // process-relative uptime base, initialized at start-up
 static uint64_t prog_start_time;
 
+// --park: wait for the host to hand over a contract after bootstrap
+static bool park_for_contract = false;
+
+// --code-cache: keep compile data of modules with the host, see
+// CODIUS_RPC_CACHE_GET
+bool code_cache_enabled = false;
+
 static Isolate* node_isolate = NULL;
 
 int WRITE_UTF8_FLAGS = v8::String::HINT_MANY_WRITES_EXPECTED |
@@ -1360,6 +1368,46 @@ static void Uptime(const FunctionCallbackInfo<Value>& args) {
 }
 
 
+// Block until the host assigns a contract to this parked sandbox. Returns
+// the main module followed by its arguments.
+static void WaitForContract(const FunctionCallbackInfo<Value>& args) {
+  Environment* env = Environment::GetCurrent(args.GetIsolate());
+  HandleScope scope(env->isolate());
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  int32_t code_cache;
+
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_SANDBOX_LOAD);
+  if (codius_rpc_call(&msg, &reply) == -1 || reply.result < 0) {
+    return env->ThrowError("Unable to get a contract from the host.");
+  }
+
+  if (codius_rpc_get_int32(&reply, &code_cache) == -1) {
+    codius_rpc_reply_free(&reply);
+    return env->ThrowError("Invalid contract from the host.");
+  }
+  code_cache_enabled = code_cache != 0;
+
+  Local<Array> argv = Array::New(env->isolate(), reply.count - 1);
+  for (uint32_t i = 0; i < reply.count - 1; i++) {
+    const char* str;
+    size_t len;
+    if (codius_rpc_get_string(&reply, &str, &len) == -1) {
+      codius_rpc_reply_free(&reply);
+      return env->ThrowError("Invalid contract from the host.");
+    }
+    argv->Set(i, String::NewFromUtf8(env->isolate(),
+                                     str,
+                                     String::kNormalString,
+                                     len));
+  }
+  codius_rpc_reply_free(&reply);
+
+  args.GetReturnValue().Set(argv);
+}
+
+
 void MemoryUsage(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args.GetIsolate());
   HandleScope scope(env->isolate());
@@ -1900,6 +1948,11 @@ void SetupProcessObject(Environment* env,
   READONLY_PROPERTY(process, "pid", Integer::New(env->isolate(), getpid()));
   READONLY_PROPERTY(process, "features", GetFeatures(env));
 
+  // --park
+  if (park_for_contract) {
+    READONLY_PROPERTY(process, "_park", True(env->isolate()));
+  }
+
   process->SetAccessor(env->need_imm_cb_string(),
       NeedImmediateCallbackGetter,
       NeedImmediateCallbackSetter);
@@ -1955,6 +2008,7 @@ void SetupProcessObject(Environment* env,
   //NODE_SET_METHOD(process, "dlopen", DLOpen);
 
   NODE_SET_METHOD(process, "uptime", Uptime);
+  NODE_SET_METHOD(process, "_waitForContract", WaitForContract);
   NODE_SET_METHOD(process, "memoryUsage", MemoryUsage);
 
   NODE_SET_METHOD(process, "binding", Binding);
@@ -1990,7 +2044,8 @@ void Load(Environment* env) {
 
   // Compile, execute the src/node.js file. (Which was included as static C
   // string in node_natives.h. 'natve_node' is the string containing that
-  // source code.)
+  // source code.) When V8's startup snapshot already carries it compiled,
+  // see tools/js2snapshot.py, use that function instead.
 
   TryCatch try_catch;
 
@@ -1999,8 +2054,12 @@ void Load(Environment* env) {
   // are not safe to ignore.
   try_catch.SetVerbose(false);
 
-  Local<String> script_name = FIXED_ONE_BYTE_STRING(env->isolate(), "node.js");
-  Local<Value> f_value = ExecuteString(env, MainSource(env), script_name);
+  Local<Value> f_value = SnapshotMain(env);
+  if (!f_value->IsFunction()) {
+    Local<String> script_name =
+        FIXED_ONE_BYTE_STRING(env->isolate(), "node.js");
+    f_value = ExecuteString(env, MainSource(env), script_name);
+  }
   if (try_catch.HasCaught())  {
     ReportException(env, try_catch);
     exit(10);
@@ -2057,6 +2116,9 @@ static void PrintHelp() {
          "  --trace-deprecation  show stack traces on deprecations\n"
          "  --v8-options         print v8 command line options\n"
          "  --max-stack-size=val set max v8 stack size (bytes)\n"
+         "  --park               start up, then wait for the host to name\n"
+         "                       the script to run\n"
+         "  --code-cache         keep compile data of modules with the host\n"
          "\n"
          "Environment variables:\n"
 #ifdef _WIN32
@@ -2121,6 +2183,10 @@ static void ParseArgs(int* argc,
     } else if (strcmp(arg, "--v8-options") == 0) {
       new_v8_argv[new_v8_argc] = "--help";
       new_v8_argc += 1;
+    } else if (strcmp(arg, "--park") == 0) {
+      park_for_contract = true;
+    } else if (strcmp(arg, "--code-cache") == 0) {
+      code_cache_enabled = true;
     } else {
       // V8 option.  Pass through as-is.
       new_v8_argv[new_v8_argc] = arg;
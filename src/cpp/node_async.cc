@@ -1,8 +1,11 @@
 #include "node.h"
 #include "node_async.h"
+#include "node_internals.h"
 
 #include "env.h"
 #include "env-inl.h"
+#include "queue.h"
+#include "util.h"
 #include "v8.h"
 
 #include <unistd.h>
@@ -12,11 +15,13 @@ namespace node {
 namespace Async {
 
 using v8::Context;
+using v8::Exception;
 using v8::Function;
 using v8::FunctionCallbackInfo;
 using v8::FunctionTemplate;
 using v8::Handle;
 using v8::HandleScope;
+using v8::Integer;
 using v8::Isolate;
 using v8::Local;
 using v8::Object;
@@ -32,8 +37,24 @@ struct Async_req
   Isolate* isolate;
     
   Persistent<Function> callback;
+
+  // Binary calls only.
+  Environment* env;
+  const char *syscall;
+  ReplyDecoder decoder;
+  Persistent<Object> context;
+
+  // Calls answered inside the sandbox, see PostReply.
+  char *response;
+  size_t response_length;
+  QUEUE member;
 };
 
+// Replies waiting to be completed from the event loop.
+static QUEUE local_replies = { &local_replies, &local_replies };
+static uv_idle_t local_replies_idle;
+static bool local_replies_idle_initialized = false;
+
 void AsyncAfter(uv_work_t* req, int something, const char *buf, size_t buf_len)
 {
   Handle<Object> response;
@@ -121,6 +142,187 @@ void PostMessage(Environment* env, const char *data, size_t data_length, Handle<
   uv_queue_work(env->event_loop(), req, data, data_length, AsyncAfter);
 }
 
+// Name of a call in a batch, see CODIUS_RPC_FS_BATCH.
+static const char* BatchSyscall(codius_rpc_reply_t* reply) {
+  int32_t method;
+
+  if (-1==codius_rpc_get_int32(reply, &method))
+    return "batch";
+
+  switch (method) {
+    case CODIUS_RPC_FS_OPEN:
+      return "open";
+    case CODIUS_RPC_FS_CLOSE:
+      return "close";
+    case CODIUS_RPC_FS_READ:
+      return "read";
+    case CODIUS_RPC_FS_FSTAT:
+      return "fstat";
+    default:
+      return "batch";
+  }
+}
+
+Local<Value> RpcError(Environment* env, codius_rpc_reply_t* reply,
+                      const char* syscall) {
+  const char *code = "EIO";
+  size_t code_len = 3;
+  const char *path;
+  size_t path_len;
+  bool has_path;
+
+  codius_rpc_get_string(reply, &code, &code_len);
+  has_path = 0==codius_rpc_get_string(reply, &path, &path_len);
+  if (syscall == NULL)
+    syscall = BatchSyscall(reply);
+
+  Local<String> estring = String::NewFromUtf8(env->isolate(), code,
+                                              String::kNormalString, code_len);
+  Local<String> message =
+      String::Concat(estring, FIXED_ONE_BYTE_STRING(env->isolate(), ", "));
+  message = String::Concat(message, OneByteString(env->isolate(), syscall));
+
+  Local<String> path_str;
+  if (has_path) {
+    path_str = String::NewFromUtf8(env->isolate(), path,
+                                   String::kNormalString, path_len);
+    message =
+        String::Concat(message, FIXED_ONE_BYTE_STRING(env->isolate(), " '"));
+    message = String::Concat(message, path_str);
+    message =
+        String::Concat(message, FIXED_ONE_BYTE_STRING(env->isolate(), "'"));
+  }
+
+  Local<Value> e = Exception::Error(message);
+  Local<Object> obj = e->ToObject();
+  obj->Set(env->errno_string(), Integer::New(env->isolate(), reply->result));
+  obj->Set(env->code_string(), estring);
+  obj->Set(env->syscall_string(), OneByteString(env->isolate(), syscall));
+  if (has_path)
+    obj->Set(env->path_string(), path_str);
+
+  return e;
+}
+
+static void AsyncCallAfter(uv_work_t* req, int status,
+                           const char *buf, size_t buf_len)
+{
+  Async_req *data = static_cast<Async_req*>(req->data);
+  Environment* env = data->env;
+  HandleScope scope(env->isolate());
+  codius_rpc_reply_t reply;
+
+  Local<Value> args[] = {
+    v8::Null(env->isolate()),
+    v8::Undefined(env->isolate())
+  };
+
+  // The completion is only valid during this callback and is not ours to
+  // free, so the reply must not hold on to it.
+  if (status != 0 || buf == NULL ||
+      -1==codius_rpc_reply_parse(&reply, const_cast<char*>(buf), buf_len)) {
+    args[0] = Exception::Error(
+        FIXED_ONE_BYTE_STRING(env->isolate(), "Invalid binary RPC response"));
+  } else {
+    reply.buf = NULL;
+    if (reply.result < 0) {
+      args[0] = RpcError(env, &reply, data->syscall);
+    } else {
+      args[1] = data->decoder(env, &reply,
+                              Local<Object>::New(env->isolate(),
+                                                 data->context));
+    }
+  }
+
+  TryCatch try_catch;
+
+  Local<Function> callback_fn = Local<Function>::New(env->isolate(),
+                                                     data->callback);
+  callback_fn->Call(env->context()->Global(), ARRAY_SIZE(args), args);
+
+  if (try_catch.HasCaught())
+    FatalException(try_catch);
+
+  data->callback.Reset();
+  data->context.Reset();
+  delete req;
+  delete data;
+}
+
+void PostCall(Environment* env, codius_rpc_msg_t* msg,
+              const char* syscall, ReplyDecoder decoder,
+              Handle<Object> context, Handle<Function> callback) {
+  if (-1==codius_rpc_msg_finish(msg))
+    return env->ThrowError("Binary RPC message too large");
+
+  Async_req* request = new Async_req;
+
+  request->data = msg->base;
+  request->data_length = msg->len;
+  request->isolate = env->isolate();
+  request->callback.Reset(env->isolate(), callback);
+  request->env = env;
+  request->syscall = syscall;
+  request->decoder = decoder;
+  request->context.Reset(env->isolate(), context);
+
+  uv_work_t* req = new uv_work_t();
+  req->data = request;
+
+  uv_queue_binary_work(env->event_loop(), req, msg->base, msg->len,
+                       AsyncCallAfter);
+}
+
+static void LocalRepliesIdle(uv_idle_t* handle) {
+  QUEUE replies;
+
+  // Replies posted by the callbacks wait for the next iteration.
+  QUEUE_INIT(&replies);
+  if (!QUEUE_EMPTY(&local_replies)) {
+    QUEUE* q = QUEUE_HEAD(&local_replies);
+    QUEUE_SPLIT(&local_replies, q, &replies);
+  }
+  uv_idle_stop(handle);
+
+  while (!QUEUE_EMPTY(&replies)) {
+    QUEUE* q = QUEUE_HEAD(&replies);
+    QUEUE_REMOVE(q);
+
+    Async_req* data = QUEUE_DATA(q, Async_req, member);
+    char* response = data->response;
+    uv_work_t* req = new uv_work_t();
+    req->data = data;
+    AsyncCallAfter(req, 0, response, data->response_length);
+    delete[] response;
+  }
+}
+
+void PostReply(Environment* env, const char* response, size_t response_length,
+               const char* syscall, ReplyDecoder decoder,
+               Handle<Object> context, Handle<Function> callback) {
+  Async_req* request = new Async_req;
+
+  request->data = NULL;
+  request->data_length = 0;
+  request->isolate = env->isolate();
+  request->callback.Reset(env->isolate(), callback);
+  request->env = env;
+  request->syscall = syscall;
+  request->decoder = decoder;
+  request->context.Reset(env->isolate(), context);
+  request->response = new char[response_length];
+  request->response_length = response_length;
+  memcpy(request->response, response, response_length);
+
+  if (!local_replies_idle_initialized) {
+    uv_idle_init(env->event_loop(), &local_replies_idle);
+    local_replies_idle_initialized = true;
+  }
+
+  QUEUE_INSERT_TAIL(&local_replies, &request->member);
+  uv_idle_start(&local_replies_idle, LocalRepliesIdle);
+}
+
 static void PostMessage(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args.GetIsolate());
   HandleScope scope(env->isolate());
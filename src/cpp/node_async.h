@@ -26,16 +26,45 @@
 #include "v8.h"
 
 #include "env.h"
+#include "codius-util.h"
 
 namespace node {
 namespace Async {
 
 using v8::Function;
 using v8::Handle;
+using v8::Local;
+using v8::Object;
+using v8::Value;
 
 NODE_EXTERN void PostMessage(Environment* env, const char *data, size_t data_length,
                         Handle<Function> callback);
 
+// Turns a successful binary response into the result passed to the callback.
+// context is the object handed to PostCall, kept alive until the response.
+typedef Local<Value> (*ReplyDecoder)(Environment* env,
+                                     codius_rpc_reply_t* reply,
+                                     Handle<Object> context);
+
+// Send a binary call built with codius_rpc_msg_init. The callback receives
+// (error, result), with error built by RpcError from the syscall name.
+NODE_EXTERN void PostCall(Environment* env, codius_rpc_msg_t* msg,
+                          const char* syscall, ReplyDecoder decoder,
+                          Handle<Object> context, Handle<Function> callback);
+
+// Complete a binary call that was answered without the host, from the next
+// iteration of the event loop. response is copied.
+NODE_EXTERN void PostReply(Environment* env, const char* response,
+                           size_t response_length, const char* syscall,
+                           ReplyDecoder decoder, Handle<Object> context,
+                           Handle<Function> callback);
+
+// Build the exception for a failed binary response. The host sends the error
+// code and, if there is one, the path as values. A NULL syscall is for batch
+// calls, whose error names the call that failed by its method id.
+NODE_EXTERN Local<Value> RpcError(Environment* env, codius_rpc_reply_t* reply,
+                                  const char* syscall);
+
 }  // namespace Async
 }  // namespace node
 
@@ -28,6 +28,10 @@
 #include "env-inl.h"
 #include "util.h"
 #include "util-inl.h"
+#include "codius-util.h"
+
+#include <limits.h>  // PATH_MAX
+#include <string.h>
 
 namespace node {
 
@@ -229,9 +233,18 @@ class ContextifyContext {
                                              GlobalPropertyIndexedAccessCheck);
 
     Local<Context> ctx = Context::New(env->isolate(), NULL, object_template);
-    if (!ctx.IsEmpty())
+    if (!ctx.IsEmpty()) {
       ctx->SetSecurityToken(env->context()->GetSecurityToken());
 
+      // Every context comes out of the startup snapshot with node's
+      // precompiled natives on its global, see tools/js2snapshot.py. They are
+      // only for bootstrapping the main context. Force the delete so that it
+      // goes past the interceptors to the global itself.
+      Context::Scope context_scope(ctx);
+      ctx->Global()->ForceDelete(
+          FIXED_ONE_BYTE_STRING(env->isolate(), "__codius_natives"));
+    }
+
     env->AssignToContext(ctx);
 
     return scope.Escape(ctx);
@@ -470,15 +483,20 @@ class ContextifyScript : public BaseObject {
     Local<String> code = args[0]->ToString();
     Local<String> filename = GetFilenameArg(args, 1);
     bool display_errors = GetDisplayErrorsArg(args, 1);
+    bool code_cache = GetCodeCacheArg(args, 1);
     if (try_catch.HasCaught()) {
       try_catch.ReThrow();
       return;
     }
 
     ScriptOrigin origin(filename);
-    ScriptCompiler::Source source(code, origin);
-    Local<UnboundScript> v8_script =
-        ScriptCompiler::CompileUnbound(env->isolate(), &source);
+    Local<UnboundScript> v8_script;
+    if (code_cache) {
+      v8_script = CompileWithCodeCache(env, code, origin, filename);
+    } else {
+      ScriptCompiler::Source source(code, origin);
+      v8_script = ScriptCompiler::CompileUnbound(env->isolate(), &source);
+    }
 
     if (v8_script.IsEmpty()) {
       if (display_errors) {
@@ -604,6 +622,94 @@ class ContextifyScript : public BaseObject {
   }
 
 
+  // Without a manifest hash the host keeps no cache data, so don't ask.
+  static bool GetCodeCacheArg(const FunctionCallbackInfo<Value>& args,
+                              const int i) {
+    if (!code_cache_enabled || !args[i]->IsObject()) {
+      return false;
+    }
+
+    Local<String> key = FIXED_ONE_BYTE_STRING(args.GetIsolate(), "codeCache");
+    Local<Value> value = args[i].As<Object>()->Get(key);
+
+    return value->BooleanValue();
+  }
+
+
+  // Ask the host for the cache data it keeps for this module of the running
+  // contract. Returns NULL if there is none.
+  static ScriptCompiler::CachedData* GetCodeCache(const Utf8Value& path) {
+    char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE + PATH_MAX];
+    codius_rpc_msg_t msg;
+    codius_rpc_reply_t reply;
+    ScriptCompiler::CachedData* data = NULL;
+
+    codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_CACHE_GET);
+    codius_rpc_add_string(&msg, *path, path.length());
+    if (codius_rpc_call(&msg, &reply) == -1)
+      return NULL;
+
+    if (reply.result >= 0 && reply.payload_len > 0) {
+      uint8_t* bytes = new uint8_t[reply.payload_len];
+      memcpy(bytes, reply.payload, reply.payload_len);
+      data = new ScriptCompiler::CachedData(
+          bytes,
+          static_cast<int>(reply.payload_len),
+          ScriptCompiler::CachedData::BufferOwned);
+    }
+    codius_rpc_reply_free(&reply);
+    return data;
+  }
+
+
+  static void PutCodeCache(const Utf8Value& path,
+                           const ScriptCompiler::CachedData* data) {
+    char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE + PATH_MAX];
+    codius_rpc_msg_t msg;
+    codius_rpc_reply_t reply;
+    struct iovec iov;
+
+    codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_CACHE_PUT);
+    codius_rpc_add_string(&msg, *path, path.length());
+    iov.iov_base = const_cast<uint8_t*>(data->data);
+    iov.iov_len = data->length;
+    if (codius_rpc_callv(&msg, &iov, 1, NULL, 0, &reply) == 0)
+      codius_rpc_reply_free(&reply);
+  }
+
+
+  // Compile a contract module with the cache data the host kept from an
+  // earlier run of the same contract. Without usable data, compile from
+  // scratch and hand the data produced along the way to the host.
+  static Local<UnboundScript> CompileWithCodeCache(Environment* env,
+                                                   Local<String> code,
+                                                   const ScriptOrigin& origin,
+                                                   Local<String> filename) {
+    Utf8Value path(filename);
+
+    ScriptCompiler::CachedData* cached = GetCodeCache(path);
+    if (cached != NULL) {
+      // Data V8 can't use fails the compilation, in which case we start over.
+      TryCatch try_catch;
+      ScriptCompiler::Source source(code, origin, cached);
+      Local<UnboundScript> v8_script =
+          ScriptCompiler::CompileUnbound(env->isolate(), &source);
+      if (!v8_script.IsEmpty())
+        return v8_script;
+    }
+
+    ScriptCompiler::Source source(code, origin);
+    Local<UnboundScript> v8_script =
+        ScriptCompiler::CompileUnbound(env->isolate(),
+                                       &source,
+                                       ScriptCompiler::kProduceDataToCache);
+    const ScriptCompiler::CachedData* data = source.GetCachedData();
+    if (!v8_script.IsEmpty() && data != NULL && data->length > 0)
+      PutCodeCache(path, data);
+    return v8_script;
+  }
+
+
   static Local<String> GetFilenameArg(const FunctionCallbackInfo<Value>& args,
                                       const int i) {
     Local<String> defaultFilename =
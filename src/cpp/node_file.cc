@@ -29,7 +29,9 @@
 #include "env.h"
 #include "env-inl.h"
 #include "string_bytes.h"
+#include "tree.h"
 #include "util.h"
+#include "codius-util.h"
 
 #include <fcntl.h>
 #include <sys/types.h>
@@ -61,6 +63,7 @@ using v8::Local;
 using v8::Number;
 using v8::Object;
 using v8::String;
+using v8::Undefined;
 using v8::Value;
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -84,190 +87,105 @@ static inline bool IsInt64(double x) {
   return x == static_cast<double>(static_cast<int64_t>(x));
 }
 
-#define SYNC_RESULT !response->Get(String::NewFromUtf8(                       \
-                                     env->isolate(), "error"))->IsNull() ? -1 :\
-                                     response->Get(String::NewFromUtf8(\
-                                                  env->isolate(),             \
-                                                  "result"))->Int32Value()
+// Binary calls are built on the stack. Enough for a path and a few scalars.
+#define FS_MESSAGE_SIZE (4096 + CODIUS_RPC_SMALL_MESSAGE_SIZE)
 
-struct codius_rpc_header {
-  unsigned long magic_bytes;
-  unsigned long callback_id;
-  unsigned long size;
-};
+static void AddString(codius_rpc_msg_t* msg, Handle<Value> value) {
+  node::Utf8Value str(value);
+  codius_rpc_add_string(msg, *str, str.length());
+}
+
+// A file position, or -1 for the current position if it isn't a number.
+static void AddPosition(codius_rpc_msg_t* msg, Handle<Value> value) {
+  if (value->IsInt32())
+    codius_rpc_add_int32(msg, value->Int32Value());
+  else if (value->IsNumber())
+    codius_rpc_add_double(msg, value->NumberValue());
+  else
+    codius_rpc_add_int32(msg, -1);
+}
+
+// Responses to calls answered from the contract image. Like the shared RPC
+// response buffer, they are only valid until the next call.
+static char image_response[64 * 1024];
 
-static int Sync_Call(Environment* env, const char* func, 
-                     const FunctionCallbackInfo<Value>& args,
-                     Handle<Object>* response) {
+// A response payload goes to dst if it is not NULL, see codius_rpc_callv.
+static int Sync_Call(Environment* env, codius_rpc_msg_t* msg,
+                     const char* syscall, char* dst, size_t dst_len,
+                     codius_rpc_reply_t* reply) {
   // If you hit this assertion, you forgot to enter the v8::Context first.
   assert(env->context() == env->isolate()->GetCurrentContext());
-  size_t bytes_read;
-  const int fd = 3;
-  Local<Object> message = Object::New(env->isolate());
-  Handle<Array> params;
-  
-  // Use legacy string interface for read so buffer isn't passed in:
-  // (fd, length, position, encoding)
-  if (0==strcmp(func, "read")) {
-    params = Array::New(env->isolate(), 4);
-    params->Set(0, args[0]);
-    params->Set(1, args[3]);
-    params->Set(2, args[4]);
-    params->Set(3, String::NewFromUtf8(env->isolate(), "utf8"));
-  } else {
-    params = Array::New(env->isolate(), args.Length());
-    for (int i=0; i<args.Length(); ++i) {
-      params->Set(i, args[i]);
-    }
-  }
 
-  message->Set(String::NewFromUtf8(env->isolate(), "type"),
-               String::NewFromUtf8(env->isolate(), "api"));
-  message->Set(String::NewFromUtf8(env->isolate(), "api"),
-               String::NewFromUtf8(env->isolate(), "fs"));
-  message->Set(String::NewFromUtf8(env->isolate(), "method"),
-               String::NewFromUtf8(env->isolate(), func));
-  message->Set(String::NewFromUtf8(env->isolate(), "data"),
-               params);
-               
-  // Stringify the JSON message.
-  Local<Object> global = env->context()->Global();
-  Handle<Object> JSON = global->Get(String::NewFromUtf8(
-                                      env->isolate(), "JSON"))->ToObject();
-  Handle<Function> JSON_stringify = Handle<Function>::Cast(JSON->Get(
-                                      String::NewFromUtf8(env->isolate(),
-                                                          "stringify")));
-  Local<Value> stringify_args[] = { message };
-  Local<Value> message_json = JSON_stringify->Call(JSON, 1, stringify_args);
-  node::Utf8Value message_v(message_json);
-  if (!message_v.length()) {
-    TYPE_ERROR("error converting json to string");
+  // Files in the contract image are served without asking the host.
+  int local = codius_image_call(msg, image_response, sizeof(image_response),
+                                dst, dst_len, reply);
+  if (!local && -1==codius_rpc_callv(msg, NULL, 0, dst, dst_len, reply)) {
+    TYPE_ERROR("Error making binary RPC call");
     return -1;
   }
 
-  const unsigned long codius_magic_bytes = 0xC0D105FE;
-  codius_rpc_header rpc_header;
-  rpc_header.magic_bytes = codius_magic_bytes;
-  rpc_header.callback_id = 0;
-  rpc_header.size = message_v.length();
-  
-  if (-1==write(fd, &rpc_header, sizeof(rpc_header)) ||
-      -1==write(fd, *message_v, strlen(*message_v))) {
-    perror("write()");
-    TYPE_ERROR("Error writing to sync fd 4");
+  if (reply->result < 0) {
+    env->isolate()->ThrowException(Async::RpcError(env, reply, syscall));
     return -1;
   }
-  
-  bytes_read = read(fd, &rpc_header, sizeof(rpc_header));
-  if (rpc_header.magic_bytes!=codius_magic_bytes) {
-    TYPE_ERROR("Error reading sync fd 4, invalid header");
-  }
-  
-  char resp_buf[rpc_header.size];
-  char *p_resp=resp_buf;
-  bytes_read = 0;
-  int to_read = sizeof(resp_buf);
-  do {
-    bytes_read = read(fd, p_resp, to_read);
-    p_resp+=bytes_read;
-    to_read-=bytes_read;
-  } while (to_read > 0);
-
-  assert(to_read==0);
-
-  Local<String> response_str = String::NewFromUtf8(env->isolate(), resp_buf, 
-                                                   String::kNormalString,
-                                                   sizeof(resp_buf));
-
-  // Parse the response.
-  Handle<Function> JSON_parse = Handle<Function>::Cast(JSON->Get(
-                                  String::NewFromUtf8(env->isolate(),
-                                                      "parse")));
-
-  Local<Value> parse_args[] = { response_str };
-  *response = Handle<Object> (JSON_parse->Call(JSON, 1, parse_args)->ToObject());
-  Handle<Value> resp_err = (*response)->Get(String::NewFromUtf8(env->isolate(),
-                                                                "error"));
-  if (!resp_err->IsNull()) {
-    Handle<Object> resp_obj = resp_err->ToObject();
-
-    Local<String> estring = 
-        resp_obj->Get(String::NewFromUtf8(env->isolate(), "code"))->ToString();
-    
-    //TODO-CODIUS Get the error message using only the error code.    
-    Local<String> message = String::NewFromUtf8(env->isolate(), func);
-    Local<String> path = 
-        resp_obj->Get(String::NewFromUtf8(env->isolate(), "path"))->ToString();
-    
-    Local<String> cons1 =
-        String::Concat(estring, FIXED_ONE_BYTE_STRING(env->isolate(), ", "));
-    Local<String> cons2 = 
-        String::Concat(cons1, message);
-    Local<String> cons3 =
-        String::Concat(cons2, FIXED_ONE_BYTE_STRING(env->isolate(), " '"));
-    Local<String> cons4 =
-        String::Concat(cons3, path);
-    Local<String> cons5 =
-        String::Concat(cons4, FIXED_ONE_BYTE_STRING(env->isolate(), "'"));
-
-    env->ThrowError(env->isolate(), *Utf8Value(cons5));
 
-    return -1;
-  }
-  
   return 0;
 }
 
-static int Async_Call(Environment* env, const char* func,
-                      Handle<Function> callback,
-                      const FunctionCallbackInfo<Value>& args) {
-  // If you hit this assertion, you forgot to enter the v8::Context first.
-  assert(env->context() == env->isolate()->GetCurrentContext());
-  Local<Object> message = Object::New(env->isolate());
-  Handle<Array> params;
-  
-  // Use legacy string interface for read so buffer isn't passed in:
-  // (fd, length, position, encoding)
-  if (0==strcmp(func, "read")) {
-    params = Array::New(env->isolate(), 4);
-    params->Set(0, args[0]);
-    params->Set(1, args[3]);
-    params->Set(2, args[4]);
-    params->Set(3, String::NewFromUtf8(env->isolate(), "utf8"));
+// Send an asynchronous call, unless the contract image can answer it. Room
+// is made for payload_len bytes of read data in that case.
+static void Post(Environment* env, codius_rpc_msg_t* msg, const char* syscall,
+                 Async::ReplyDecoder decoder, Handle<Object> context,
+                 Handle<Function> callback, size_t payload_len) {
+  char* buf = image_response;
+  size_t buf_size = sizeof(image_response);
+  codius_rpc_reply_t reply;
+
+  if (payload_len > buf_size - CODIUS_RPC_SMALL_MESSAGE_SIZE) {
+    buf_size = CODIUS_RPC_SMALL_MESSAGE_SIZE + payload_len;
+    buf = new char[buf_size];
+  }
+
+  if (codius_image_call(msg, buf, buf_size, NULL, 0, &reply)) {
+    Async::PostReply(env, buf, reply.payload + reply.payload_len - buf,
+                     syscall, decoder, context, callback);
   } else {
-    params = Array::New(env->isolate(), args.Length()-1);
-    for (int i=0; i<args.Length()-1; ++i) {
-      params->Set(i, args[i]);
-    }
+    Async::PostCall(env, msg, syscall, decoder, context, callback);
   }
 
-  message->Set(String::NewFromUtf8(env->isolate(), "type"),
-               String::NewFromUtf8(env->isolate(), "api"));
-  message->Set(String::NewFromUtf8(env->isolate(), "api"),
-               String::NewFromUtf8(env->isolate(), "fs"));
-  message->Set(String::NewFromUtf8(env->isolate(), "method"),
-               String::NewFromUtf8(env->isolate(), func));
-  message->Set(String::NewFromUtf8(env->isolate(), "data"),
-               params);
-
-  // Stringify the JSON message.
-  Local<Object> global = env->context()->Global();
-  Handle<Object> JSON = global->Get(String::NewFromUtf8(
-                                      env->isolate(), "JSON"))->ToObject();
-  Handle<Function> JSON_stringify = Handle<Function>::Cast(JSON->Get(
-                                      String::NewFromUtf8(env->isolate(),
-                                                          "stringify")));
-  Local<Value> stringify_args[] = { message };
-  Local<Value> message_json = JSON_stringify->Call(JSON, 1, stringify_args);
-  node::Utf8Value message_v(message_json);
-  if (!message_v.length()) {
-    TYPE_ERROR("error converting json to string");
-    return -1;
+  if (buf != image_response)
+    delete[] buf;
+}
+
+// Make the call asynchronously if callback is a function. Otherwise wait for
+// the response and return the decoded result.
+static void Call(Environment* env, codius_rpc_msg_t* msg, const char* syscall,
+                 Async::ReplyDecoder decoder, Handle<Object> context,
+                 Handle<Value> callback,
+                 const FunctionCallbackInfo<Value>& args) {
+  if (callback->IsFunction()) {
+    Post(env, msg, syscall, decoder, context,
+         Handle<Function>::Cast(callback), 0);
+    return;
   }
-  
-  Async::PostMessage(env, *message_v, message_v.length(), callback);
-  
-  return 0;
+
+  codius_rpc_reply_t reply;
+  if (-1==Sync_Call(env, msg, syscall, NULL, 0, &reply))
+    return;
+
+  args.GetReturnValue().Set(decoder(env, &reply, context));
+}
+
+static Local<Value> DecodeUndefined(Environment* env,
+                                    codius_rpc_reply_t* reply,
+                                    Handle<Object> context) {
+  return Undefined(env->isolate());
+}
+
+static Local<Value> DecodeResult(Environment* env,
+                                 codius_rpc_reply_t* reply,
+                                 Handle<Object> context) {
+  return Integer::New(env->isolate(), reply->result);
 }
 
 
@@ -279,34 +197,29 @@ static void Close(const FunctionCallbackInfo<Value>& args) {
     return THROW_BAD_ARGS;
   }
 
-  Handle<Object> response;
-  Sync_Call(env, "close", args, &response);
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_CLOSE);
+  codius_rpc_add_int32(&msg, args[0]->Int32Value());
+
+  Call(env, &msg, "close", DecodeUndefined, Handle<Object>(), args[1], args);
 }
 
 
-Local<Value> BuildStatsObject(Environment* env, const Handle<Object> src) {
+// The host sends the stats in the order of the fs.Stats constructor
+// arguments, so they are passed on as they are decoded.
+#define STATS_VALUE_COUNT 14
+
+static Local<Value> NewStatsObject(Environment* env,
+                                   const double values[STATS_VALUE_COUNT]) {
   // If you hit this assertion, you forgot to enter the v8::Context first.
   assert(env->context() == env->isolate()->GetCurrentContext());
 
   EscapableHandleScope handle_scope(env->isolate());
-  
-  // Pass stats as the first argument, this is the object we are modifying.
-  Local<Value> argv[] = {
-    src->Get(String::NewFromUtf8(env->isolate(), "dev")),
-    src->Get(String::NewFromUtf8(env->isolate(), "mode")),
-    src->Get(String::NewFromUtf8(env->isolate(), "nlink")),
-    src->Get(String::NewFromUtf8(env->isolate(), "uid")),
-    src->Get(String::NewFromUtf8(env->isolate(), "gid")),
-    src->Get(String::NewFromUtf8(env->isolate(), "rdev")),
-    src->Get(String::NewFromUtf8(env->isolate(), "blksize")),
-    src->Get(String::NewFromUtf8(env->isolate(), "ino")),
-    src->Get(String::NewFromUtf8(env->isolate(), "size")),
-    src->Get(String::NewFromUtf8(env->isolate(), "blocks")),
-    src->Get(String::NewFromUtf8(env->isolate(), "atim_msec")),
-    src->Get(String::NewFromUtf8(env->isolate(), "mtim_msec")),
-    src->Get(String::NewFromUtf8(env->isolate(), "ctim_msec")),
-    src->Get(String::NewFromUtf8(env->isolate(), "birthtim_msec"))
-  };
+
+  Local<Value> argv[STATS_VALUE_COUNT];
+  for (size_t i = 0; i < ARRAY_SIZE(argv); i++)
+    argv[i] = Number::New(env->isolate(), values[i]);
 
   // Call out to JavaScript to create the stats object.
   Local<Value> stats =
@@ -318,6 +231,18 @@ Local<Value> BuildStatsObject(Environment* env, const Handle<Object> src) {
   return handle_scope.Escape(stats);
 }
 
+static Local<Value> BuildStatsObject(Environment* env,
+                                     codius_rpc_reply_t* reply,
+                                     Handle<Object> context) {
+  double values[STATS_VALUE_COUNT];
+  for (size_t i = 0; i < ARRAY_SIZE(values); i++) {
+    if (-1==codius_rpc_get_number(reply, &values[i]))
+      return Local<Value>();
+  }
+
+  return NewStatsObject(env, values);
+}
+
 
 static void Stat(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args.GetIsolate());
@@ -327,21 +252,13 @@ static void Stat(const FunctionCallbackInfo<Value>& args) {
     return TYPE_ERROR("path required");
   if (!args[0]->IsString())
     return TYPE_ERROR("path must be a string");
-  
-  node::Utf8Value path(args[0]);
-  
-  if (args[1]->IsFunction()) {
-    Async_Call(env, "stat", Handle<Function>::Cast(args[1]), args);
-  } else {
-    Handle<Object> response;
-    if (-1==Sync_Call(env, "stat", args, &response))
-      return;
-    
-    //What if response.result is empty?
-    args.GetReturnValue().Set(
-      BuildStatsObject(env, 
-        response->Get(String::NewFromUtf8(env->isolate(), "result"))->ToObject()));
-  }
+
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_STAT);
+  AddString(&msg, args[0]);
+
+  Call(env, &msg, "stat", BuildStatsObject, Handle<Object>(), args[1], args);
 }
 
 static void LStat(const FunctionCallbackInfo<Value>& args) {
@@ -353,16 +270,12 @@ static void LStat(const FunctionCallbackInfo<Value>& args) {
   if (!args[0]->IsString())
     return TYPE_ERROR("path must be a string");
 
-  if (args[1]->IsFunction()) {
-    Async_Call(env, "lstat", Handle<Function>::Cast(args[1]), args);
-  } else {
-    Handle<Object> response;
-    if (-1==Sync_Call(env, "lstat", args, &response))
-      return;
-    args.GetReturnValue().Set(
-      BuildStatsObject(env, 
-        response->Get(String::NewFromUtf8(env->isolate(), "result"))->ToObject()));
-  }
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_LSTAT);
+  AddString(&msg, args[0]);
+
+  Call(env, &msg, "lstat", BuildStatsObject, Handle<Object>(), args[1], args);
 }
 
 static void FStat(const FunctionCallbackInfo<Value>& args) {
@@ -372,16 +285,287 @@ static void FStat(const FunctionCallbackInfo<Value>& args) {
   if (args.Length() < 1 || !args[0]->IsInt32()) {
     return THROW_BAD_ARGS;
   }
-  
-  if (args[1]->IsFunction()) {
-    Async_Call(env, "fstat", Handle<Function>::Cast(args[1]), args);
+
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_FSTAT);
+  codius_rpc_add_int32(&msg, args[0]->Int32Value());
+
+  Call(env, &msg, "fstat", BuildStatsObject, Handle<Object>(), args[1], args);
+}
+
+// Stat cache for module resolution.
+//
+// require() probes many paths that don't exist, and each stat is a round
+// trip to the host. Results are kept for the life of the sandbox: stats of
+// paths that exist, and ENOENT or ENOTDIR for those that don't. A directory
+// that was scanned (see ScanTree) is complete, so a path below it that isn't
+// in the cache doesn't exist either. Keys are normalized absolute paths.
+struct StatCacheEntry {
+  RB_ENTRY(StatCacheEntry) link;
+  char* path;
+  int error;      // 0, or -ENOENT or -ENOTDIR
+  bool complete;  // all children of this directory are in the cache
+  double values[STATS_VALUE_COUNT];
+};
+
+static int CompareStatCacheEntries(StatCacheEntry* a, StatCacheEntry* b) {
+  return strcmp(a->path, b->path);
+}
+
+RB_HEAD(StatCache, StatCacheEntry);
+RB_GENERATE_STATIC(StatCache, StatCacheEntry, link, CompareStatCacheEntries)
+
+static StatCache stat_cache = RB_INITIALIZER(&stat_cache);
+
+static bool IsCacheablePath(const char* path, size_t len) {
+  if (len == 0 || len >= PATH_MAX || path[0] != '/')
+    return false;
+  if (len > 1 && path[len - 1] == '/')
+    return false;
+
+  // No empty, "." or ".." components.
+  for (const char* p = path; p != NULL; p = strchr(p + 1, '/')) {
+    const char* next = p + 1;
+    if (*next == '/' ||
+        (next[0] == '.' && (next[1] == '/' || next[1] == '\0')) ||
+        (next[0] == '.' && next[1] == '.' &&
+         (next[2] == '/' || next[2] == '\0'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static StatCacheEntry* StatCacheFind(const char* path) {
+  StatCacheEntry key;
+  key.path = const_cast<char*>(path);
+  return RB_FIND(StatCache, &stat_cache, &key);
+}
+
+static StatCacheEntry* StatCacheInsert(const char* path, size_t len,
+                                       int error, const double* values) {
+  StatCacheEntry* entry = new StatCacheEntry;
+  entry->path = new char[len + 1];
+  memcpy(entry->path, path, len);
+  entry->path[len] = '\0';
+
+  StatCacheEntry* existing = RB_INSERT(StatCache, &stat_cache, entry);
+  if (existing != NULL) {
+    delete[] entry->path;
+    delete entry;
+    entry = existing;
+  } else {
+    entry->complete = false;
+  }
+
+  entry->error = error;
+  if (error == 0)
+    memcpy(entry->values, values, sizeof(entry->values));
+  else
+    entry->complete = false;
+  return entry;
+}
+
+// Forget everything, for when the sandbox itself changes the file system.
+static void StatCacheClear() {
+  StatCacheEntry* entry;
+  StatCacheEntry* next;
+
+  for (entry = RB_MIN(StatCache, &stat_cache); entry != NULL; entry = next) {
+    next = RB_NEXT(StatCache, &stat_cache, entry);
+    RB_REMOVE(StatCache, &stat_cache, entry);
+    delete[] entry->path;
+    delete entry;
+  }
+}
+
+// Returns the entry for path, or NULL if the cache can't tell. A path that
+// is known not to exist, because of one of its ancestors, is answered with
+// *error alone.
+static StatCacheEntry* StatCacheLookup(const char* path, size_t len,
+                                       int* error) {
+  char ancestor[PATH_MAX];
+
+  *error = 0;
+  StatCacheEntry* entry = StatCacheFind(path);
+  if (entry != NULL)
+    return entry;
+
+  memcpy(ancestor, path, len + 1);
+  for (;;) {
+    char* slash = strrchr(ancestor, '/');
+    if (slash == NULL || slash == ancestor)
+      return NULL;
+    *slash = '\0';
+
+    entry = StatCacheFind(ancestor);
+    if (entry == NULL)
+      continue;
+
+    if (entry->error != 0)
+      *error = entry->error;
+    else if (!S_ISDIR(static_cast<mode_t>(entry->values[1])))
+      *error = -ENOTDIR;
+    else if (entry->complete)
+      *error = -ENOENT;
+    return NULL;
+  }
+}
+
+// Stat path through the host, or the contract image. Returns 0 with the
+// stats in values, or -errno.
+static int StatUncached(const char* path, size_t len,
+                        double values[STATS_VALUE_COUNT]) {
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_STAT);
+  codius_rpc_add_string(&msg, path, len);
+
+  int local = codius_image_call(&msg, image_response, sizeof(image_response),
+                                NULL, 0, &reply);
+  if (!local && -1==codius_rpc_callv(&msg, NULL, 0, NULL, 0, &reply))
+    return -EIO;
+
+  int error = reply.result < 0 ? reply.result : 0;
+  for (size_t i = 0; error == 0 && i < STATS_VALUE_COUNT; i++) {
+    if (-1==codius_rpc_get_number(&reply, &values[i]))
+      error = -EIO;
+  }
+
+  codius_rpc_reply_free(&reply);
+  return error;
+}
+
+// Stat path and remember the answer. Returns the entry, or NULL with *error
+// set if the call failed for a reason that isn't worth remembering.
+static StatCacheEntry* StatCacheFill(const char* path, size_t len,
+                                     int* error) {
+  double values[STATS_VALUE_COUNT];
+
+  *error = StatUncached(path, len, values);
+  if (*error == 0 || *error == -ENOENT || *error == -ENOTDIR)
+    return StatCacheInsert(path, len, *error, values);
+  return NULL;
+}
+
+// Like stat, but answered from the cache where possible. Synchronous only.
+// Returns the stats, or undefined if there is nothing at path.
+static void StatCached(const FunctionCallbackInfo<Value>& args) {
+  Environment* env = Environment::GetCurrent(args.GetIsolate());
+  HandleScope scope(env->isolate());
+
+  if (args.Length() < 1)
+    return TYPE_ERROR("path required");
+  if (!args[0]->IsString())
+    return TYPE_ERROR("path must be a string");
+
+  node::Utf8Value path(args[0]);
+  StatCacheEntry* entry = NULL;
+  int error = 0;
+
+  if (IsCacheablePath(*path, path.length())) {
+    entry = StatCacheLookup(*path, path.length(), &error);
+    if (entry == NULL && error == 0)
+      entry = StatCacheFill(*path, path.length(), &error);
   } else {
-    Handle<Object> response;
-    Sync_Call(env, "fstat", args, &response);
-    args.GetReturnValue().Set(
-      BuildStatsObject(env, 
-        response->Get(String::NewFromUtf8(env->isolate(), "result"))->ToObject()));
+    // Leave it to the host to make sense of the path.
+    double values[STATS_VALUE_COUNT];
+    if (StatUncached(*path, path.length(), values) == 0)
+      args.GetReturnValue().Set(NewStatsObject(env, values));
+    return;
   }
+
+  if (entry != NULL && entry->error == 0)
+    args.GetReturnValue().Set(NewStatsObject(env, entry->values));
+}
+
+// Fetch the stats of a whole directory tree in one call, typically a
+// node_modules directory, so that probing it is answered from the cache.
+// Trees that are already known, or known not to exist, aren't fetched again.
+static void ScanTree(const FunctionCallbackInfo<Value>& args) {
+  Environment* env = Environment::GetCurrent(args.GetIsolate());
+  HandleScope scope(env->isolate());
+
+  if (args.Length() < 1)
+    return TYPE_ERROR("path required");
+  if (!args[0]->IsString())
+    return TYPE_ERROR("path must be a string");
+
+  node::Utf8Value path(args[0]);
+  if (!IsCacheablePath(*path, path.length()))
+    return;
+
+  int error;
+  StatCacheEntry* root = StatCacheLookup(*path, path.length(), &error);
+  if (error != 0 || (root != NULL && (root->error != 0 || root->complete)))
+    return;
+
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+
+  // Trees in the contract image are served locally anyway, and the host
+  // doesn't see them the same way.
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_STAT);
+  AddString(&msg, args[0]);
+  if (codius_image_call(&msg, image_response, sizeof(image_response),
+                        NULL, 0, &reply))
+    return;
+
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_SCAN);
+  AddString(&msg, args[0]);
+  if (-1==codius_rpc_callv(&msg, NULL, 0, NULL, 0, &reply))
+    return;
+
+  if (reply.result == -ENOENT || reply.result == -ENOTDIR) {
+    StatCacheInsert(*path, path.length(), reply.result, NULL);
+  } else if (reply.result >= 0) {
+    char entry_path[PATH_MAX];
+    memcpy(entry_path, *path, path.length());
+
+    // Each entry is a path relative to the scanned directory ("" for the
+    // directory itself), a flag telling if its children follow and its stats.
+    for (uint32_t i = 0; i + 2 + STATS_VALUE_COUNT <= reply.count;
+         i += 2 + STATS_VALUE_COUNT) {
+      const char* name;
+      size_t name_len;
+      int32_t complete;
+      double values[STATS_VALUE_COUNT];
+      size_t len = path.length();
+
+      if (-1==codius_rpc_get_string(&reply, &name, &name_len) ||
+          -1==codius_rpc_get_int32(&reply, &complete))
+        break;
+      size_t j;
+      for (j = 0; j < ARRAY_SIZE(values); j++) {
+        if (-1==codius_rpc_get_number(&reply, &values[j]))
+          break;
+      }
+      if (j < ARRAY_SIZE(values))
+        break;
+
+      if (name_len > 0) {
+        if (len + 1 + name_len >= sizeof(entry_path))
+          continue;
+        entry_path[len++] = '/';
+        memcpy(entry_path + len, name, name_len);
+        len += name_len;
+      }
+      entry_path[len] = '\0';
+
+      // Only trust what the host sent in normalized form.
+      if (!IsCacheablePath(entry_path, len))
+        continue;
+      StatCacheEntry* entry = StatCacheInsert(entry_path, len, 0, values);
+      entry->complete = complete != 0 &&
+                        S_ISDIR(static_cast<mode_t>(values[1]));
+    }
+  }
+
+  codius_rpc_reply_free(&reply);
 }
 
 //static void Symlink(const FunctionCallbackInfo<Value>& args) {
@@ -557,6 +741,23 @@ static void FStat(const FunctionCallbackInfo<Value>& args) {
 //  SYNC_CALL(mkdir, *path, *path, mode)
 //}
 
+static Local<Value> DecodeNames(Environment* env,
+                                codius_rpc_reply_t* reply,
+                                Handle<Object> context) {
+  Local<Array> names = Array::New(env->isolate(), reply->count);
+  const char* name;
+  size_t name_len;
+
+  for (uint32_t i = 0; i < reply->count; i++) {
+    if (-1==codius_rpc_get_string(reply, &name, &name_len))
+      break;
+    names->Set(i, String::NewFromUtf8(env->isolate(), name,
+                                      String::kNormalString, name_len));
+  }
+
+  return names;
+}
+
 static void ReadDir(const FunctionCallbackInfo<Value>& args) {
   Environment* env = Environment::GetCurrent(args.GetIsolate());
   HandleScope scope(env->isolate());
@@ -566,17 +767,12 @@ static void ReadDir(const FunctionCallbackInfo<Value>& args) {
   if (!args[0]->IsString())
     return TYPE_ERROR("path must be a string");
 
-  if (args[1]->IsFunction()) {
-    Async_Call(env, "readdir", Handle<Function>::Cast(args[1]), args);
-  } else {
-    Handle<Object> response;
-    if (-1==Sync_Call(env, "readdir", args, &response))
-      return;
-    
-    Local<Array> names = Handle<Array>::Cast(response->Get(String::NewFromUtf8(env->isolate(), "result")));
-  
-    args.GetReturnValue().Set(names);
-  }
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_READDIR);
+  AddString(&msg, args[0]);
+
+  Call(env, &msg, "readdir", DecodeNames, Handle<Object>(), args[1], args);
 }
 
 static void Open(const FunctionCallbackInfo<Value>& args) {
@@ -597,18 +793,18 @@ static void Open(const FunctionCallbackInfo<Value>& args) {
   if (!args[2]->IsInt32())
     return TYPE_ERROR("mode must be an int");
 
-  if (args[3]->IsFunction()) {
-    Async_Call(env, "open", Handle<Function>::Cast(args[3]), args);
-  } else {
-    Handle<Object> response;
-    if (-1==Sync_Call(env, "open", args, &response)) {
-      args.GetReturnValue().Set(-1);
-    } else {
-      args.GetReturnValue().Set(response->Get(String::NewFromUtf8(
-                                                env->isolate(),
-                                                "result"))->Int32Value());
-    }
-  }
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_OPEN);
+  AddString(&msg, args[0]);
+  codius_rpc_add_int32(&msg, args[1]->Int32Value());
+  codius_rpc_add_int32(&msg, args[2]->Int32Value());
+
+  // The file might be new, so cached stats can't be trusted anymore.
+  if (args[1]->Int32Value() & O_CREAT)
+    StatCacheClear();
+
+  Call(env, &msg, "open", DecodeResult, Handle<Object>(), args[3], args);
 }
 
 
@@ -729,6 +925,20 @@ static void Open(const FunctionCallbackInfo<Value>& args) {
 //}
 
 
+// Reads answer with the bytes read as the payload and their count as the
+// result. context is [buffer, offset].
+static Local<Value> DecodeRead(Environment* env,
+                               codius_rpc_reply_t* reply,
+                               Handle<Object> context) {
+  Local<Object> buffer_obj = context->Get(0)->ToObject();
+  size_t off = context->Get(1)->Uint32Value();
+
+  memcpy(Buffer::Data(buffer_obj) + off, reply->payload,
+         MIN(reply->payload_len, Buffer::Length(buffer_obj) - off));
+
+  return Integer::New(env->isolate(), reply->result);
+}
+
 /*
  * Wrapper for read(2).
  *
@@ -750,16 +960,12 @@ static void Read(const FunctionCallbackInfo<Value>& args) {
   }
   
   size_t len;
-  int64_t pos;
-
-  char * buf = NULL;
 
   if (!Buffer::HasInstance(args[1])) {
     return env->ThrowError("Second argument needs to be a buffer");
   }
 
   Local<Object> buffer_obj = args[1]->ToObject();
-  char *buffer_data = Buffer::Data(buffer_obj);
   size_t buffer_length = Buffer::Length(buffer_obj);
 
   size_t off = args[2]->Int32Value();
@@ -771,28 +977,131 @@ static void Read(const FunctionCallbackInfo<Value>& args) {
   if (!Buffer::IsWithinBounds(off, len, buffer_length))
     return env->ThrowRangeError("Length extends beyond buffer");
 
-  buf = buffer_data + off;
+  // The host sends the bytes back raw: (fd, length, position)
+  char buf[CODIUS_RPC_SMALL_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_READ);
+  codius_rpc_add_int32(&msg, args[0]->Int32Value());
+  codius_rpc_add_int32(&msg, len);
+  AddPosition(&msg, args[4]);
 
   if (args[5]->IsFunction()) {
-    Async_Call(env, "read", Handle<Function>::Cast(args[5]), args);
+    Local<Array> context = Array::New(env->isolate(), 2);
+    context->Set(0, buffer_obj);
+    context->Set(1, Integer::NewFromUnsigned(env->isolate(), off));
+    Post(env, &msg, "read", DecodeRead, context,
+         Handle<Function>::Cast(args[5]), len);
   } else {
-    Handle<Object> response;
-    Sync_Call(env, "read", args, &response);
-    
-    /* Legacy read returns [str, bytesRead] */
-    Handle<Array> results = Handle<Array>::Cast(response->Get(String::NewFromUtf8(env->isolate(), "result")));
-    
-    /* Copy the read str to buffer. */
-    String::Utf8Value data(results->Get(0)->ToString());
-    assert(buffer_length >= data.length());
-    strncpy (buffer_data, *data, data.length());
-    
-    /* Return bytesRead */
-    args.GetReturnValue().Set(results->Get(1));
+    // Read straight into the buffer.
+    codius_rpc_reply_t reply;
+    if (-1==Sync_Call(env, &msg, "read", Buffer::Data(buffer_obj) + off, len,
+                      &reply))
+      return;
+    args.GetReturnValue().Set(reply.result);
   }
 }
 
 
+static Local<Value> DecodeReadFile(Environment* env,
+                                   codius_rpc_reply_t* reply,
+                                   Handle<Object> context) {
+  return Buffer::New(env->isolate(), reply->payload, reply->payload_len);
+}
+
+/*
+ * Read a whole file in one round trip, as a batch of open, read and close.
+ *
+ * buffer = fs.readFile(path, flags)
+ *
+ * 0 path      string
+ * 1 flags     integer. open flags
+ * 2 callback  function, or undefined to return the buffer
+ *
+ */
+static void ReadFile(const FunctionCallbackInfo<Value>& args) {
+  Environment* env = Environment::GetCurrent(args.GetIsolate());
+  HandleScope scope(env->isolate());
+
+  if (args.Length() < 1)
+    return TYPE_ERROR("path required");
+  if (args.Length() < 2)
+    return TYPE_ERROR("flags required");
+  if (!args[0]->IsString())
+    return TYPE_ERROR("path must be a string");
+  if (!args[1]->IsInt32())
+    return TYPE_ERROR("flags must be an int");
+
+  char buf[FS_MESSAGE_SIZE];
+  codius_rpc_msg_t msg;
+  codius_rpc_msg_init(&msg, buf, sizeof(buf), CODIUS_RPC_FS_BATCH);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_OPEN);
+  AddString(&msg, args[0]);
+  codius_rpc_add_int32(&msg, args[1]->Int32Value());
+  codius_rpc_add_int32(&msg, 0666);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_READ);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_BATCH_FD);
+  codius_rpc_add_int32(&msg, -1);
+  codius_rpc_add_int32(&msg, -1);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_CLOSE);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_BATCH_FD);
+
+  if (args[1]->Int32Value() & O_CREAT)
+    StatCacheClear();
+
+  if (args[2]->IsFunction()) {
+    Post(env, &msg, NULL, DecodeReadFile, Handle<Object>(),
+         Handle<Function>::Cast(args[2]), 0);
+    return;
+  }
+
+  codius_rpc_reply_t reply;
+  if (codius_image_call(&msg, image_response, sizeof(image_response),
+                        NULL, 0, &reply)) {
+    if (reply.result < 0) {
+      env->isolate()->ThrowException(Async::RpcError(env, &reply, NULL));
+      return;
+    }
+    args.GetReturnValue().Set(DecodeReadFile(env, &reply, Handle<Object>()));
+    return;
+  }
+
+  // The host sends the data in chunks, which go straight into the buffer.
+  if (-1==codius_rpc_call_begin(&msg, NULL, 0, &reply))
+    return TYPE_ERROR("Error making binary RPC call");
+
+  // The values are the results of open and read, the latter the size.
+  double fd, bytes_read = 0;
+  size_t size = 0;
+  if (reply.result >= 0 &&
+      0==codius_rpc_get_number(&reply, &fd) &&
+      0==codius_rpc_get_number(&reply, &bytes_read) &&
+      bytes_read > 0 && bytes_read <= CODIUS_MAX_RESPONSE_SIZE) {
+    size = static_cast<size_t>(bytes_read);
+  }
+
+  Local<Object> buffer = Buffer::New(env->isolate(), size);
+  char* data = Buffer::Data(buffer);
+  size_t len = 0;
+  ssize_t n;
+  while ((n = codius_rpc_read_payload(data + len, size - len)) > 0)
+    len += n;
+  // Whatever doesn't fit the announced size has to be read all the same.
+  while (n == 0 && codius_rpc_read_payload(NULL, 4096) > 0) {}
+
+  if (reply.result < 0) {
+    env->isolate()->ThrowException(Async::RpcError(env, &reply, NULL));
+    return;
+  }
+  if (n == -1)
+    return TYPE_ERROR("Error making binary RPC call");
+  // Skipped above, it doesn't fit a Buffer.
+  if (bytes_read > CODIUS_MAX_RESPONSE_SIZE)
+    return env->ThrowRangeError("File size is greater than possible Buffer");
+
+  args.GetReturnValue().Set(len < size ? Buffer::New(env->isolate(), data, len)
+                                       : buffer);
+}
+
 ///* fs.chmod(path, mode);
 // * Wrapper for chmod(1) / EIO_CHMOD
 // */
@@ -957,6 +1266,7 @@ void InitFs(Handle<Object> target,
   NODE_SET_METHOD(target, "close", Close);
   NODE_SET_METHOD(target, "open", Open);
   NODE_SET_METHOD(target, "read", Read);
+  NODE_SET_METHOD(target, "readFile", ReadFile);
 //  NODE_SET_METHOD(target, "fdatasync", Fdatasync);
 //  NODE_SET_METHOD(target, "fsync", Fsync);
 //  NODE_SET_METHOD(target, "rename", Rename);
@@ -967,6 +1277,8 @@ void InitFs(Handle<Object> target,
   NODE_SET_METHOD(target, "stat", Stat);
   NODE_SET_METHOD(target, "lstat", LStat);
   NODE_SET_METHOD(target, "fstat", FStat);
+  NODE_SET_METHOD(target, "statCached", StatCached);
+  NODE_SET_METHOD(target, "scanTree", ScanTree);
 //  NODE_SET_METHOD(target, "link", Link);
 //  NODE_SET_METHOD(target, "symlink", Symlink);
 //  NODE_SET_METHOD(target, "readlink", ReadLink);
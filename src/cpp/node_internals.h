@@ -38,6 +38,9 @@ namespace node {
 // Forward declaration
 class Environment;
 
+// Set by --code-cache, or by the host for a parked sandbox.
+extern bool code_cache_enabled;
+
 // If persistent.IsWeak() == false, then do not call persistent.Reset()
 // while the returned Local<T> is still in scope, it will destroy the
 // reference to the object.
@@ -37,11 +37,24 @@ using v8::HandleScope;
 using v8::Local;
 using v8::Object;
 using v8::String;
+using v8::Undefined;
+using v8::Value;
 
 Handle<String> MainSource(Environment* env) {
   return OneByteString(env->isolate(), node_native, sizeof(node_native) - 1);
 }
 
+// The bootstrap function precompiled into the startup snapshot by
+// tools/js2snapshot.py, or undefined when V8 was built without it.
+Local<Value> SnapshotMain(Environment* env) {
+  Local<Value> natives = env->context()->Global()->Get(
+      FIXED_ONE_BYTE_STRING(env->isolate(), "__codius_natives"));
+  if (!natives->IsObject())
+    return Undefined(env->isolate());
+  return natives.As<Object>()->Get(
+      FIXED_ONE_BYTE_STRING(env->isolate(), "node"));
+}
+
 void DefineJavaScript(Environment* env, Handle<Object> target) {
   HandleScope scope(env->isolate());
 
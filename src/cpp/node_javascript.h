@@ -29,6 +29,7 @@ namespace node {
 
 void DefineJavaScript(Environment* env, v8::Handle<v8::Object> target);
 v8::Handle<v8::String> MainSource(Environment* env);
+v8::Local<v8::Value> SnapshotMain(Environment* env);
 
 }  // namespace node
 
@@ -405,14 +405,11 @@ void TCPWrap::Connect(const FunctionCallbackInfo<Value>& args) {
     ConnectWrap* req_wrap = new ConnectWrap(env,
                                             req_wrap_obj,
                                             AsyncWrap::PROVIDER_CONNECTWRAP);
-    // Call Dispatched before uv_tcp_connect because AfterConnect is now called
-    // inside uv_tcp_connect
-    req_wrap->Dispatched();
     err = uv_tcp_connect(&req_wrap->req_,
                          &wrap->handle_,
                          reinterpret_cast<const sockaddr*>(&addr),
                          AfterConnect);
-    
+    req_wrap->Dispatched();
     if (err)
       delete req_wrap;
   }
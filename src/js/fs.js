@@ -39,7 +39,6 @@ var Readable = Stream.Readable;
 var Writable = Stream.Writable;
 
 var kMinPoolSpace = 128;
-var kMaxLength = require('smalloc').kMaxLength;
 
 var O_APPEND = constants.O_APPEND || 0;
 var O_CREAT = constants.O_CREAT || 0;
@@ -213,89 +212,17 @@ fs.readFile = function(path, options, callback_) {
   var encoding = options.encoding;
   assertEncoding(encoding);
 
-  // first, stat the file, so we know the size.
-  var size;
-  var buffer; // single buffer with file data
-  var buffers; // list for when size is unknown
-  var pos = 0;
-  var fd;
+  if (!nullCheck(path, callback)) return;
 
+  // Open, read and close in a single call to the host.
   var flag = options.flag || 'r';
-  fs.open(path, flag, 438 /*=0666*/, function(er, fd_) {
+  binding.readFile(pathModule._makeLong(path),
+                   stringToFlags(flag),
+                   function(er, buffer) {
     if (er) return callback(er);
-    fd = fd_;
-
-    fs.fstat(fd, function(er, st) {
-      if (er) {
-        return fs.close(fd, function() {
-          callback(er);
-        });
-      }
-
-      size = st.size;
-      if (size === 0) {
-        // the kernel lies about many files.
-        // Go ahead and try to read some bytes.
-        buffers = [];
-        return read();
-      }
-
-      if (size > kMaxLength) {
-        var err = new RangeError('File size is greater than possible Buffer: ' +
-            '0x3FFFFFFF bytes');
-        return fs.close(fd, function() {
-          callback(err);
-        });
-      }
-      buffer = new Buffer(size);
-      read();
-    });
+    if (encoding) buffer = buffer.toString(encoding);
+    callback(null, buffer);
   });
-
-  function read() {
-    if (size === 0) {
-      buffer = new Buffer(8192);
-      fs.read(fd, buffer, 0, 8192, -1, afterRead);
-    } else {
-      fs.read(fd, buffer, pos, size - pos, -1, afterRead);
-    }
-  }
-
-  function afterRead(er, bytesRead) {
-    if (er) {
-      return fs.close(fd, function(er2) {
-        return callback(er);
-      });
-    }
-
-    if (bytesRead === 0) {
-      return close();
-    }
-
-    pos += bytesRead;
-    if (size !== 0) {
-      if (pos === size) close();
-      else read();
-    } else {
-      // unknown size, just read until we don't get bytes.
-      buffers.push(buffer.slice(0, bytesRead));
-      read();
-    }
-  }
-
-  function close() {
-    fs.close(fd, function(er) {
-      if (size === 0) {
-        // collected the data into the buffers list.
-        buffer = Buffer.concat(buffers, pos);
-      } else if (pos < size) {
-        buffer = buffer.slice(0, pos);
-      }
-
-      if (encoding) buffer = buffer.toString(encoding);
-      return callback(er, buffer);
-    });
-  }
 };
 
 fs.readFileSync = function(path, options) {
@@ -310,66 +237,12 @@ fs.readFileSync = function(path, options) {
   var encoding = options.encoding;
   assertEncoding(encoding);
 
-  var flag = options.flag || 'r';
-  var fd = fs.openSync(path, flag, 438 /*=0666*/);
-
-  var size;
-  var threw = true;
-  try {
-    size = fs.fstatSync(fd).size;
-    threw = false;
-  } finally {
-    if (threw) fs.closeSync(fd);
-  }
-
-  var pos = 0;
-  var buffer; // single buffer with file data
-  var buffers; // list for when size is unknown
-
-  if (size === 0) {
-    buffers = [];
-  } else {
-    var threw = true;
-    try {
-      buffer = new Buffer(size);
-      threw = false;
-    } finally {
-      if (threw) fs.closeSync(fd);
-    }
-  }
-
-  var done = false;
-  while (!done) {
-    var threw = true;
-    try {
-      if (size !== 0) {
-        var bytesRead = fs.readSync(fd, buffer, pos, size - pos);
-      } else {
-        // the kernel lies about many files.
-        // Go ahead and try to read some bytes.
-        buffer = new Buffer(8192);
-        var bytesRead = fs.readSync(fd, buffer, 0, 8192);
-        if (bytesRead) {
-          buffers.push(buffer.slice(0, bytesRead));
-        }
-      }
-      threw = false;
-    } finally {
-      if (threw) fs.closeSync(fd);
-    }
-
-    pos += bytesRead;
-    done = (bytesRead === 0) || (size !== 0 && pos >= size);
-  }
-
-  fs.closeSync(fd);
+  nullCheck(path);
 
-  if (size === 0) {
-    // data was collected into the buffers list.
-    buffer = Buffer.concat(buffers, pos);
-  } else if (pos < size) {
-    buffer = buffer.slice(0, pos);
-  }
+  // Open, read and close in a single call to the host.
+  var flag = options.flag || 'r';
+  var buffer = binding.readFile(pathModule._makeLong(path),
+                                stringToFlags(flag));
 
   if (encoding) buffer = buffer.toString(encoding);
   return buffer;
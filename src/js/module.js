@@ -25,6 +25,7 @@ var runInThisContext = require('vm').runInThisContext;
 var runInNewContext = require('vm').runInNewContext;
 var assert = require('assert').ok;
 var fs = NativeModule.require('fs');
+var fsBinding = process.binding('fs');
 
 
 // If obj.hasOwnProperty has been overridden, then calling
@@ -81,11 +82,10 @@ var debug = Module._debug;
 //   -> a.<ext>
 //   -> a/index.<ext>
 
+// The fs binding remembers what it found, and what it didn't, so repeated
+// probes of the same paths stay inside the sandbox.
 function statPath(path) {
-  try {
-    return fs.statSync(path);
-  } catch (ex) {}
-  return false;
+  return fsBinding.statCached(path) || false;
 }
 
 // check if the directory is a package.json dir
@@ -96,8 +96,12 @@ function readPackage(requestPath) {
     return packageMainCache[requestPath];
   }
 
+  var jsonPath = path.resolve(requestPath, 'package.json');
+  if (!statPath(jsonPath)) {
+    return false;
+  }
+
   try {
-    var jsonPath = path.resolve(requestPath, 'package.json');
     var json = fs.readFileSync(jsonPath, 'utf8');
   } catch (e) {
     return false;
@@ -166,6 +170,12 @@ Module._findPath = function(request, paths) {
 
   // For each path
   for (var i = 0, PL = paths.length; i < PL; i++) {
+    // Fetch whole node_modules trees at once rather than probing them one
+    // path at a time. Missing ones are remembered as such.
+    if (path.basename(paths[i]) === 'node_modules') {
+      fsBinding.scanTree(paths[i]);
+    }
+
     var basePath = path.resolve(paths[i], request);
     var filename;
 
@@ -423,7 +433,8 @@ Module.prototype._compile = function(content, filename) {
       sandbox.global = sandbox;
       sandbox.root = root;
 
-      return runInNewContext(content, sandbox, { filename: filename });
+      return runInNewContext(content, sandbox, { filename: filename,
+                                                 codeCache: true });
     }
 
     debug('load root module');
@@ -434,13 +445,14 @@ Module.prototype._compile = function(content, filename) {
     global.__dirname = dirname;
     global.module = self;
 
-    return runInThisContext(content, { filename: filename });
+    return runInThisContext(content, { filename: filename, codeCache: true });
   }
 
   // create wrapper function
   var wrapper = Module.wrap(content);
 
-  var compiledWrapper = runInThisContext(wrapper, { filename: filename });
+  var compiledWrapper = runInThisContext(wrapper, { filename: filename,
+                                                    codeCache: true });
   if (global.v8debug) {
     if (!resolvedArgv) {
       // we enter the repl if we're not given a filename argument.
@@ -63,6 +63,15 @@
 
     //startup.resolveArgv0();
 
+    if (process._park) {
+      // Started ahead of time by the host's sandbox pool. Everything up to
+      // here is done, so wait for the contract to run and then go on as if
+      // it had been on the command line.
+      NativeModule.require('module');
+      process.argv = process.argv.slice(0, 1)
+                                 .concat(process._waitForContract());
+    }
+
     // There are various modes that Node can run in. The most common two
     // are running from a script and running the REPL - but there are a few
     // others like the debugger or running --eval arguments. Here we decide
@@ -645,6 +654,10 @@
   NativeModule._source = process.binding('natives');
   NativeModule._cache = {};
 
+  // Natives precompiled into the V8 startup snapshot by tools/js2snapshot.py.
+  NativeModule._compiled = this.__codius_natives || {};
+  delete this.__codius_natives;
+
   NativeModule.require = function(id) {
     if (id == 'native_module') {
       return NativeModule;
@@ -691,10 +704,13 @@
   ];
 
   NativeModule.prototype.compile = function() {
-    var source = NativeModule.getSource(this.id);
-    source = NativeModule.wrap(source);
+    var fn = NativeModule._compiled[this.id];
+    if (typeof fn !== 'function') {
+      var source = NativeModule.getSource(this.id);
+      source = NativeModule.wrap(source);
 
-    var fn = runInThisContext(source, { filename: this.filename });
+      fn = runInThisContext(source, { filename: this.filename });
+    }
     fn(this.exports, NativeModule.require, this, this.filename);
 
     this.loaded = true;
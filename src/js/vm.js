@@ -25,7 +25,8 @@ var util = require('util');
 
 // The binding provides a few useful primitives:
 // - ContextifyScript(code, { filename = "evalmachine.anonymous",
-//                            displayErrors = true } = {})
+//                            displayErrors = true,
+//                            codeCache = false } = {})
 //   with methods:
 //   - runInThisContext({ displayErrors = true } = {})
 //   - runInContext(sandbox, { displayErrors = true, timeout = undefined } = {})
@@ -0,0 +1,115 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var CodeCache = require('../lib/code_cache').CodeCache;
+
+function data(length, fill) {
+  var buffer = new Buffer(length);
+  buffer.fill(fill || 0);
+  return buffer;
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('Code cache', function() {
+  it('should answer with the data put under a manifest hash and path', function() {
+    var cache = new CodeCache();
+
+    cache.put('m1', '/a.js', data(10, 1));
+    cache.put('m2', '/a.js', data(10, 2));
+
+    cache.get('m1', '/a.js')[0].should.eql(1);
+    cache.get('m2', '/a.js')[0].should.eql(2);
+    should.not.exist(cache.get('m1', '/b.js'));
+    should.not.exist(cache.get('m3', '/a.js'));
+  });
+
+  it('should keep a manifest within its limit, oldest first', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 100 });
+
+    cache.put('m1', '/a.js', data(10));
+    cache.put('m1', '/b.js', data(10));
+    cache.put('m2', '/a.js', data(10));
+    cache.put('m1', '/c.js', data(10));
+    cache.put('m1', '/d.js', data(10));
+
+    should.not.exist(cache.get('m1', '/a.js'));
+    should.exist(cache.get('m1', '/b.js'));
+    should.exist(cache.get('m1', '/c.js'));
+    should.exist(cache.get('m1', '/d.js'));
+    // Other manifests don't pay for it.
+    should.exist(cache.get('m2', '/a.js'));
+  });
+
+  it('should keep all manifests within the total limit, oldest first', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 40 });
+
+    cache.put('m1', '/a.js', data(10));
+    cache.put('m2', '/a.js', data(10));
+    cache.put('m3', '/a.js', data(10));
+    cache.put('m4', '/a.js', data(10));
+    cache.put('m5', '/a.js', data(20));
+
+    should.not.exist(cache.get('m1', '/a.js'));
+    should.not.exist(cache.get('m2', '/a.js'));
+    should.exist(cache.get('m3', '/a.js'));
+    should.exist(cache.get('m4', '/a.js'));
+    should.exist(cache.get('m5', '/a.js'));
+  });
+
+  it('should evict what was used longest ago', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 100 });
+
+    cache.put('m1', '/a.js', data(10));
+    cache.put('m1', '/b.js', data(10));
+    cache.put('m1', '/c.js', data(10));
+    cache.get('m1', '/a.js');
+    cache.put('m1', '/d.js', data(10));
+
+    should.exist(cache.get('m1', '/a.js'));
+    should.not.exist(cache.get('m1', '/b.js'));
+    should.exist(cache.get('m1', '/c.js'));
+    should.exist(cache.get('m1', '/d.js'));
+  });
+
+  it('should replace the data of an existing key', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 100 });
+
+    cache.put('m1', '/a.js', data(20, 1));
+    cache.put('m1', '/b.js', data(10));
+    cache.put('m1', '/a.js', data(20, 2));
+
+    // The old data no longer counts, so only /b.js had to make room.
+    cache.get('m1', '/a.js')[0].should.eql(2);
+    cache.get('m1', '/a.js').length.should.eql(20);
+    should.exist(cache.get('m1', '/b.js'));
+    cache._bytes.should.eql(30);
+  });
+
+  it('should not keep data larger than one manifest may hold', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 100 });
+
+    cache.put('m1', '/a.js', data(10));
+    cache.put('m1', '/big.js', data(31));
+
+    should.not.exist(cache.get('m1', '/big.js'));
+    // Nothing was evicted for it.
+    should.exist(cache.get('m1', '/a.js'));
+    cache._bytes.should.eql(10);
+  });
+
+  it('should drop the old data of a key replaced by data too large', function() {
+    var cache = new CodeCache({ maxManifestBytes: 30, maxBytes: 100 });
+
+    cache.put('m1', '/a.js', data(10));
+    cache.put('m1', '/a.js', data(31));
+
+    should.not.exist(cache.get('m1', '/a.js'));
+    cache._bytes.should.eql(0);
+    should.not.exist(cache._manifests.m1);
+  });
+});
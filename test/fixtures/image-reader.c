@@ -0,0 +1,164 @@
+/* Reads a contract image through codius_image_call, for test/image-test.js.
+ *
+ * Usage: CODIUS_IMAGE_FD=<fd> image-reader (stat|readdir|cat|readfile <path>)...
+ *
+ * Prints one JSON object per command: {"host":1} if the call would go to the
+ * host, {"result":<errno>,"code":"..."} if it failed, and otherwise the mode,
+ * size and mtime of stat, the names of readdir or the hex data of cat. cat
+ * reads in small chunks to move the file position along. readfile reads the
+ * file with one batch of open, read and close, and a failed batch adds the
+ * method id of the call that failed as "method".
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "codius-util.h"
+
+static char buf[65536];
+
+static int call(codius_rpc_msg_t *msg, codius_rpc_reply_t *reply) {
+  if (!codius_image_call(msg, buf, sizeof(buf), NULL, 0, reply)) {
+    printf("{\"host\":1}\n");
+    return -1;
+  }
+  if (reply->result < 0) {
+    const char *code;
+    size_t len;
+    codius_rpc_get_string(reply, &code, &len);
+    printf("{\"result\":%d,\"code\":\"%.*s\"}\n", reply->result,
+           (int) len, code);
+    return -1;
+  }
+  return 0;
+}
+
+static void stat_path(const char *path) {
+  char m[1024];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  double values[14];
+  int i;
+
+  codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_STAT);
+  codius_rpc_add_string(&msg, path, strlen(path));
+  if (call(&msg, &reply) == -1)
+    return;
+
+  for (i = 0; i < 14; i++)
+    codius_rpc_get_number(&reply, &values[i]);
+  printf("{\"result\":0,\"mode\":%.0f,\"size\":%.0f,\"mtime\":%.0f}\n",
+         values[1], values[8], values[11]);
+}
+
+static void readdir_path(const char *path) {
+  char m[1024];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  const char *name;
+  size_t len;
+  uint32_t i;
+
+  codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_READDIR);
+  codius_rpc_add_string(&msg, path, strlen(path));
+  if (call(&msg, &reply) == -1)
+    return;
+
+  printf("{\"result\":0,\"names\":[");
+  for (i = 0; i < reply.count; i++) {
+    codius_rpc_get_string(&reply, &name, &len);
+    printf("%s\"%.*s\"", i ? "," : "", (int) len, name);
+  }
+  printf("]}\n");
+}
+
+static void cat_path(const char *path) {
+  char m[1024];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  int32_t fd;
+  size_t i;
+
+  codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_OPEN);
+  codius_rpc_add_string(&msg, path, strlen(path));
+  codius_rpc_add_int32(&msg, O_RDONLY);
+  codius_rpc_add_int32(&msg, 0);
+  if (call(&msg, &reply) == -1)
+    return;
+  fd = reply.result;
+
+  printf("{\"result\":0,\"data\":\"");
+  do {
+    codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_READ);
+    codius_rpc_add_int32(&msg, fd);
+    codius_rpc_add_int32(&msg, 7);
+    codius_rpc_add_double(&msg, -1);
+    codius_image_call(&msg, buf, sizeof(buf), NULL, 0, &reply);
+    for (i = 0; i < reply.payload_len; i++)
+      printf("%02x", (unsigned char) reply.payload[i]);
+  } while (reply.result > 0);
+  printf("\"}\n");
+
+  codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_CLOSE);
+  codius_rpc_add_int32(&msg, fd);
+  codius_image_call(&msg, buf, sizeof(buf), NULL, 0, &reply);
+}
+
+static void readfile_path(const char *path) {
+  char m[1024];
+  codius_rpc_msg_t msg;
+  codius_rpc_reply_t reply;
+  const char *code;
+  size_t len, i;
+  int32_t method;
+
+  codius_rpc_msg_init(&msg, m, sizeof(m), CODIUS_RPC_FS_BATCH);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_OPEN);
+  codius_rpc_add_string(&msg, path, strlen(path));
+  codius_rpc_add_int32(&msg, O_RDONLY);
+  codius_rpc_add_int32(&msg, 0);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_READ);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_BATCH_FD);
+  codius_rpc_add_int32(&msg, -1);
+  codius_rpc_add_int32(&msg, -1);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_CLOSE);
+  codius_rpc_add_int32(&msg, CODIUS_RPC_FS_BATCH_FD);
+  if (!codius_image_call(&msg, buf, sizeof(buf), NULL, 0, &reply)) {
+    printf("{\"host\":1}\n");
+    return;
+  }
+
+  if (reply.result < 0) {
+    codius_rpc_get_string(&reply, &code, &len);
+    printf("{\"result\":%d,\"code\":\"%.*s\"", reply.result, (int) len, code);
+    /* Skip the path, if any. */
+    codius_rpc_get_string(&reply, &code, &len);
+    if (codius_rpc_get_int32(&reply, &method) == 0)
+      printf(",\"method\":%d", method);
+    printf("}\n");
+    return;
+  }
+
+  printf("{\"result\":0,\"data\":\"");
+  for (i = 0; i < reply.payload_len; i++)
+    printf("%02x", (unsigned char) reply.payload[i]);
+  printf("\"}\n");
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "stat") == 0)
+      stat_path(argv[i + 1]);
+    else if (strcmp(argv[i], "readdir") == 0)
+      readdir_path(argv[i + 1]);
+    else if (strcmp(argv[i], "cat") == 0)
+      cat_path(argv[i + 1]);
+    else if (strcmp(argv[i], "readfile") == 0)
+      readfile_path(argv[i + 1]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+/* Talks to test/shm-test.js through codius_channel_*, for the shared memory
+ * transport and the plain fd 3 pipe alike.
+ *
+ * Usage: [CODIUS_SHM_FD=<fd>] ring-peer <size>...
+ *
+ * Checks that nothing is waiting at first, then sends a message of each size
+ * and reads it back from the host, which echoes everything. Prints "ok" and
+ * exits with 0 if every echo matched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codius-util.h"
+
+int main(int argc, char *argv[]) {
+  struct iovec iov[2];
+  uint32_t len;
+  char *out, *in;
+  size_t i;
+  int arg;
+
+  if (codius_channel_poll(20) != 0) {
+    printf("unexpected data\n");
+    return 1;
+  }
+
+  for (arg = 1; arg < argc; arg++) {
+    len = (uint32_t) atoi(argv[arg]);
+    out = malloc(len + 1);
+    in = malloc(len + 1);
+    for (i = 0; i < len; i++)
+      out[i] = (char) ((i * 13 + arg) & 0xff);
+
+    iov[0].iov_base = &len;
+    iov[0].iov_len = sizeof(len);
+    iov[1].iov_base = out;
+    iov[1].iov_len = len;
+    if (codius_channel_writev(iov, 2) == -1 ||
+        codius_channel_poll(-1) != 1 ||
+        codius_channel_read(in, sizeof(len)) == -1 ||
+        memcmp(in, &len, sizeof(len)) != 0 ||
+        codius_channel_read(in, len) == -1 ||
+        memcmp(in, out, len) != 0) {
+      printf("bad echo of %u bytes\n", len);
+      return 1;
+    }
+
+    free(out);
+    free(in);
+  }
+
+  printf("ok\n");
+  return 0;
+}
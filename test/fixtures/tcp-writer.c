@@ -0,0 +1,66 @@
+/* Writes to a TCP connection through the sandbox's libuv, for
+ * test/tcp-write-test.js.
+ *
+ * Usage: tcp-writer <port> <size>...
+ *
+ * Connects to 127.0.0.1:<port> and queues one write of each size back to
+ * back, the bytes of the i-th write being (j * 7 + i) & 0xff. Prints one
+ * JSON object per finished write with its index and status, then closes the
+ * connection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uv.h"
+
+static uv_tcp_t tcp;
+static uv_connect_t connect_req;
+static uv_write_t* write_reqs;
+static uv_buf_t* bufs;
+static int nwrites;
+static int finished;
+
+static void write_cb(uv_write_t* req, int status) {
+  printf("{\"write\":%d,\"status\":%d}\n", (int) (req - write_reqs), status);
+  fflush(stdout);
+
+  if (++finished == nwrites)
+    uv_close((uv_handle_t*) &tcp, NULL);
+}
+
+static void connect_cb(uv_connect_t* req, int status) {
+  int i;
+
+  if (status != 0) {
+    printf("{\"connect\":%d}\n", status);
+    uv_close((uv_handle_t*) &tcp, NULL);
+    return;
+  }
+
+  for (i = 0; i < nwrites; i++)
+    uv_write(&write_reqs[i], (uv_stream_t*) &tcp, &bufs[i], 1, write_cb);
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in addr;
+  size_t j;
+  int i;
+
+  nwrites = argc - 2;
+  write_reqs = calloc(nwrites, sizeof(*write_reqs));
+  bufs = calloc(nwrites, sizeof(*bufs));
+  for (i = 0; i < nwrites; i++) {
+    bufs[i].len = atoi(argv[i + 2]);
+    bufs[i].base = malloc(bufs[i].len);
+    for (j = 0; j < bufs[i].len; j++)
+      bufs[i].base[j] = (char) ((j * 7 + i) & 0xff);
+  }
+
+  uv_ip4_addr("127.0.0.1", atoi(argv[1]), &addr);
+  uv_tcp_init(uv_default_loop(), &tcp);
+  uv_tcp_connect(&connect_req, &tcp, (const struct sockaddr*) &addr,
+                 connect_cb);
+
+  return uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
@@ -0,0 +1,194 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var format  = require('../lib/binary/format');
+
+// Build a request body the way codius_rpc_msg_init and codius_rpc_add_* do.
+function encodeRequest(method, values, payload) {
+  var parts = [];
+  var head = new Buffer(8);
+
+  head.writeUInt32LE(method, 0);
+  head.writeUInt32LE(values.length, 4);
+  parts.push(head);
+
+  values.forEach(function (value) {
+    var part;
+    if (typeof value === 'string') {
+      var bytes = new Buffer(value, 'utf8');
+      part = new Buffer(8 + bytes.length);
+      part.writeUInt32LE(format.TYPE_STRING, 0);
+      part.writeUInt32LE(bytes.length, 4);
+      bytes.copy(part, 8);
+    } else if (value.double) {
+      part = new Buffer(12);
+      part.writeUInt32LE(format.TYPE_DOUBLE, 0);
+      part.writeDoubleLE(value.double, 4);
+    } else {
+      part = new Buffer(8);
+      part.writeUInt32LE(format.TYPE_INT32, 0);
+      part.writeInt32LE(value, 4);
+    }
+    parts.push(part);
+  });
+
+  if (payload) {
+    parts.push(payload);
+  }
+  return Buffer.concat(parts);
+}
+
+// Collects what writeFrames writes into frames of { magic, body }.
+function FrameCollector() {
+  this.data = [];
+}
+
+FrameCollector.prototype.write = function (buffer) {
+  this.data.push(buffer);
+};
+
+FrameCollector.prototype.frames = function () {
+  var data = Buffer.concat(this.data);
+  var frames = [];
+  var offset = 0;
+
+  while (offset < data.length) {
+    var size = data.readUInt32LE(offset + 8);
+    frames.push({
+      magic: data.readUInt32LE(offset),
+      body: data.slice(offset + format.HEADER_SIZE,
+                       offset + format.HEADER_SIZE + size)
+    });
+    offset += format.HEADER_SIZE + size;
+  }
+  return frames;
+};
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('Binary format', function() {
+  describe('decodeRequest', function() {
+    it('should decode the method and typed values', function() {
+      var call = format.decodeRequest(encodeRequest(0x0101, [
+        '/dir/fé.js', 0x241, -1, { double: 1.5 }
+      ]));
+
+      call.id.should.eql(0x0101);
+      call.api.should.eql('fs');
+      call.method.should.eql('open');
+      call.args.should.eql(['/dir/fé.js', 0x241, -1, 1.5]);
+    });
+
+    it('should pass the payload to methods that take one', function() {
+      var payload = new Buffer([0, 1, 2, 255]);
+      var call = format.decodeRequest(encodeRequest(0x0207, [5], payload));
+
+      call.method.should.eql('write');
+      call.args.should.have.length(2);
+      call.args[0].should.eql(5);
+      call.args[1].toString('hex').should.eql('000102ff');
+    });
+
+    it('should leave the payload out for other methods', function() {
+      var call = format.decodeRequest(encodeRequest(0x0104, ['/a'],
+                                                    new Buffer('junk')));
+
+      call.args.should.eql(['/a']);
+    });
+
+    it('should not name unknown methods', function() {
+      var call = format.decodeRequest(encodeRequest(0x7f01, [1]));
+
+      should.not.exist(call.api);
+      should.not.exist(call.method);
+      call.args.should.eql([1]);
+    });
+
+    it('should refuse unknown value types', function() {
+      var buffer = encodeRequest(0x0104, [1]);
+
+      buffer.writeUInt32LE(9, 8);
+      (function () {
+        format.decodeRequest(buffer);
+      }).should.throw('Invalid binary value type: 9');
+    });
+  });
+
+  describe('encodeResponse', function() {
+    it('should encode the result, values and payload', function() {
+      var payload = new Buffer('data');
+      var buffer = format.encodeResponse(-2, [7, 'ENOENT'], payload);
+
+      buffer.readInt32LE(0).should.eql(-2);
+      buffer.readUInt32LE(4).should.eql(2);
+      buffer.readUInt32LE(8).should.eql(format.TYPE_INT32);
+      buffer.readInt32LE(12).should.eql(7);
+      buffer.readUInt32LE(16).should.eql(format.TYPE_STRING);
+      buffer.readUInt32LE(20).should.eql(6);
+      buffer.toString('utf8', 24, 30).should.eql('ENOENT');
+      buffer.toString('utf8', 30).should.eql('data');
+      buffer.length.should.eql(34);
+    });
+
+    it('should round-trip through the request layout', function() {
+      // Response and request bodies share their layout, so a response with
+      // a method id as its result decodes as that call.
+      var payload = new Buffer([1, 2, 3]);
+      var values = [0, -5, 0x7fffffff, 4294967296, 0.25, 'xü', new Buffer('raw')];
+      var call = format.decodeRequest(format.encodeResponse(0x0502, values,
+                                                            payload));
+
+      call.method.should.eql('put');
+      call.args.slice(0, 6).should.eql([0, -5, 0x7fffffff, 4294967296, 0.25,
+                                        'xü']);
+      call.args[6].should.eql('raw');
+      call.args[7].toString('hex').should.eql('010203');
+    });
+
+    it('should encode an empty response', function() {
+      var buffer = format.encodeResponse(0);
+
+      buffer.length.should.eql(8);
+      buffer.readUInt32LE(4).should.eql(0);
+    });
+  });
+
+  describe('writeFrames', function() {
+    var chunk = format.FRAME_CHUNK_SIZE;
+
+    function body(length) {
+      var buffer = new Buffer(length);
+      for (var i = 0; i < length; i++) {
+        buffer[i] = i % 251;
+      }
+      return buffer;
+    }
+
+    [0, 1, chunk - 1, chunk, chunk + 1, 3 * chunk].forEach(function (length) {
+      it('should split a body of ' + length + ' bytes into chunks', function() {
+        var stream = new FrameCollector();
+        var data = body(length);
+
+        format.writeFrames(stream, format.MAGIC_BYTES_BINARY, data);
+
+        var frames = stream.frames();
+        frames.should.have.length(Math.max(1, Math.ceil(length / chunk)));
+        frames.forEach(function (frame, i) {
+          var last = i === frames.length - 1;
+          frame.magic.should.eql(last ? format.MAGIC_BYTES_BINARY
+                                      : format.MAGIC_BYTES_CONTINUATION);
+          if (!last) {
+            frame.body.length.should.eql(chunk);
+          }
+        });
+        Buffer.concat(frames.map(function (frame) {
+          return frame.body;
+        })).toString('hex').should.eql(data.toString('hex'));
+      });
+    });
+  });
+});
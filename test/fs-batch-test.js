@@ -0,0 +1,189 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var fs      = require('fs');
+var os      = require('os');
+var path    = require('path');
+var constants = require('constants');
+var format  = require('../lib/binary/format');
+var PassthroughApi = require('../lib/api/passthrough').PassthroughApi;
+
+// Method ids, see codius_rpc_method_t in codius-util.h
+var OPEN = 0x0101;
+var CLOSE = 0x0102;
+var READ = 0x0103;
+var FSTAT = 0x0106;
+var STAT = 0x0104;
+
+var O_RDONLY = constants.O_RDONLY;
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('fs batch', function() {
+  var api, tmp, cwd;
+  var realOpen, realClose, opened, closed;
+
+  before(function() {
+    cwd = process.cwd();
+    tmp = path.join(os.tmpdir(), 'codius-batch-test-' + process.pid);
+    fs.mkdirSync(tmp);
+    fs.writeFileSync(path.join(tmp, 'a.txt'), 'hello batch\n');
+    fs.writeFileSync(path.join(tmp, 'b.txt'), '');
+    // Paths from the sandbox are taken relative to the working directory.
+    process.chdir(tmp);
+
+    // The batch only needs the API's methods, not a running sandbox.
+    api = Object.create(PassthroughApi.prototype);
+
+    realOpen = fs.open;
+    realClose = fs.close;
+  });
+
+  after(function() {
+    process.chdir(cwd);
+    fs.unlinkSync(path.join(tmp, 'a.txt'));
+    fs.unlinkSync(path.join(tmp, 'b.txt'));
+    fs.rmdirSync(tmp);
+  });
+
+  beforeEach(function() {
+    // Track which descriptors the batch opens and closes.
+    opened = [];
+    closed = [];
+    fs.open = function () {
+      var args = Array.prototype.slice.call(arguments);
+      var callback = args.pop();
+      realOpen.apply(fs, args.concat(function (error, fd) {
+        if (!error) opened.push(fd);
+        callback(error, fd);
+      }));
+    };
+    fs.close = function (fd, callback) {
+      closed.push(fd);
+      realClose.call(fs, fd, callback);
+    };
+  });
+
+  afterEach(function() {
+    fs.open = realOpen;
+    fs.close = realClose;
+  });
+
+  it('should answer with the values of every call and the data read', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               FSTAT, format.FS_BATCH_FD,
+               READ, format.FS_BATCH_FD, -1, -1,
+               CLOSE, format.FS_BATCH_FD], function (error, values, data) {
+      should.not.exist(error);
+
+      var stats = fs.statSync(path.join(tmp, 'a.txt'));
+      values.should.have.length(1 + 15 + 1 + 1);
+      values[0].should.eql(opened[0]);
+      values[1].should.eql(0);
+      values[2 + 1].should.eql(stats.mode);
+      values[2 + 8].should.eql(stats.size);
+      values[16].should.eql(stats.size);
+      values[17].should.eql(0);
+      data.toString().should.eql('hello batch\n');
+      closed.should.eql(opened);
+      done();
+    });
+  });
+
+  it('should read a length from a position and leave the file open', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               READ, format.FS_BATCH_FD, 5, 6], function (error, values, data) {
+      should.not.exist(error);
+
+      values.should.eql([opened[0], 5]);
+      data.toString().should.eql('batch');
+      closed.should.eql([]);
+      realClose(opened[0], done);
+    });
+  });
+
+  it('should read an empty file to its end', function(done) {
+    api.batch([OPEN, '/b.txt', O_RDONLY, 0,
+               READ, format.FS_BATCH_FD, -1, -1,
+               CLOSE, format.FS_BATCH_FD], function (error, values, data) {
+      should.not.exist(error);
+
+      values.should.eql([opened[0], 0, 0]);
+      data.length.should.eql(0);
+      done();
+    });
+  });
+
+  it('should end with the error of a failed open and run nothing after it', function(done) {
+    api.batch([OPEN, '/missing.txt', O_RDONLY, 0,
+               READ, format.FS_BATCH_FD, -1, -1,
+               CLOSE, format.FS_BATCH_FD], function (error, values, data) {
+      error.code.should.eql('ENOENT');
+      should.not.exist(values);
+      should.not.exist(data);
+      opened.should.eql([]);
+      closed.should.eql([]);
+      done();
+    });
+  });
+
+  it('should close the files it opened when a later call fails', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               OPEN, '/b.txt', O_RDONLY, 0,
+               OPEN, '/missing.txt', O_RDONLY, 0,
+               READ, format.FS_BATCH_FD, -1, -1], function (error) {
+      error.code.should.eql('ENOENT');
+      opened.should.have.length(2);
+      closed.should.eql(opened);
+      done();
+    });
+  });
+
+  it('should fail on a read from a bad descriptor and close the rest', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               READ, 0x3fffffff, 10, 0,
+               CLOSE, format.FS_BATCH_FD], function (error) {
+      error.code.should.eql('EBADF');
+      closed.should.eql(opened);
+      done();
+    });
+  });
+
+  it('should refuse methods that cannot be batched', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               STAT, '/a.txt'], function (error) {
+      error.message.should.eql('Unhandled fs batch method: ' + STAT);
+      closed.should.eql(opened);
+      done();
+    });
+  });
+
+  it('should answer a failed batch with the negative errno and code', function(done) {
+    api.batch([OPEN, '/missing.txt', O_RDONLY, 0], function (error) {
+      var body = api.encodeBinaryResult(error);
+      var response = format.decodeRequest(body);
+
+      body.readInt32LE(0).should.eql(-constants.ENOENT);
+      response.args[0].should.eql('ENOENT');
+      // The call that failed comes last.
+      response.args[response.args.length - 1].should.eql(OPEN);
+      done();
+    });
+  });
+
+  it('should name the call that failed in the error', function(done) {
+    api.batch([OPEN, '/a.txt', O_RDONLY, 0,
+               FSTAT, format.FS_BATCH_FD,
+               READ, 0x3fffffff, 10, 0], function (error) {
+      var response = format.decodeRequest(api.encodeBinaryResult(error));
+
+      error.batchMethod.should.eql(READ);
+      response.args.should.eql(['EBADF', READ]);
+      done();
+    });
+  });
+});
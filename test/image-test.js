@@ -0,0 +1,197 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var fs      = require('fs');
+var os      = require('os');
+var path    = require('path');
+var spawn   = require('child_process').spawn;
+var execFile = require('child_process').execFile;
+var image   = require('../lib/image');
+
+var UTIL_DIR = path.resolve(__dirname, '../deps/codius-util');
+
+function removeTree(file) {
+  if (fs.lstatSync(file).isDirectory()) {
+    fs.readdirSync(file).forEach(function (name) {
+      removeTree(path.join(file, name));
+    });
+    fs.rmdirSync(file);
+  } else {
+    fs.unlinkSync(file);
+  }
+}
+
+// Run the commands through test/fixtures/image-reader.c with the image on fd 4.
+function readImage(reader, imageFile, commands, callback) {
+  var imageFd = fs.openSync(imageFile, 'r');
+  var child = spawn(reader, commands, {
+    env: { CODIUS_IMAGE_FD: '4' },
+    stdio: ['ignore', 'pipe', 'inherit', 'ignore', imageFd]
+  });
+  var output = '';
+
+  fs.closeSync(imageFd);
+  child.stdout.setEncoding('utf8');
+  child.stdout.on('data', function (data) {
+    output += data;
+  });
+  child.on('close', function (code) {
+    if (code !== 0) {
+      return callback(new Error('image-reader exited with ' + code));
+    }
+    callback(null, output.trim().split('\n').map(function (line) {
+      return JSON.parse(line);
+    }));
+  });
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('Contract image', function() {
+  var tmp, dir, imageFile, reader;
+  var bigData;
+
+  before(function(done) {
+    tmp = path.join(os.tmpdir(), 'codius-image-test-' + process.pid);
+    dir = path.join(tmp, 'contract');
+    imageFile = path.join(tmp, 'contract.img');
+    reader = path.join(tmp, 'image-reader');
+
+    bigData = new Buffer(10000);
+    for (var i = 0; i < bigData.length; i++) {
+      bigData[i] = (i * 7) & 0xff;
+    }
+
+    fs.mkdirSync(tmp);
+    fs.mkdirSync(dir);
+    fs.mkdirSync(path.join(dir, 'sub'));
+    fs.writeFileSync(path.join(dir, 'a.js'), 'console.log(1);\n');
+    fs.writeFileSync(path.join(dir, 'empty'), '');
+    fs.writeFileSync(path.join(dir, 'sub', 'big.bin'), bigData);
+    // Must not end up in the image.
+    fs.symlinkSync('/etc/passwd', path.join(dir, 'link'));
+
+    image.writeSync(imageFile, dir, '/contract');
+
+    execFile('cc', [
+      '-D_GNU_SOURCE',
+      '-I' + path.join(UTIL_DIR, 'include'),
+      '-o', reader,
+      path.join(__dirname, 'fixtures', 'image-reader.c')
+    ].concat(fs.readdirSync(path.join(UTIL_DIR, 'src')).filter(function (name) {
+      return /\.c$/.test(name);
+    }).map(function (name) {
+      return path.join(UTIL_DIR, 'src', name);
+    })), function (error) {
+      done(error);
+    });
+  });
+
+  after(function() {
+    removeTree(tmp);
+  });
+
+  it('should start with the documented header', function() {
+    var data = fs.readFileSync(imageFile);
+
+    data.readUInt32LE(0).should.eql(image.MAGIC);
+    data.readUInt32LE(4).should.eql(image.VERSION);
+    // /contract, a.js, empty, sub and sub/big.bin
+    data.readUInt32LE(8).should.eql(5);
+    data.readUInt32LE(16).should.eql(4);
+  });
+
+  it('should refuse a relative root or a file as the directory', function() {
+    (function () {
+      image.build(dir, 'contract');
+    }).should.throw();
+    (function () {
+      image.build(path.join(dir, 'a.js'), '/contract');
+    }).should.throw();
+  });
+
+  it('should stat files and directories like the host', function(done) {
+    var files = ['/contract', '/contract/a.js', '/contract/empty',
+                 '/contract/sub', '/contract/sub/big.bin'];
+    var commands = [];
+
+    files.forEach(function (file) {
+      commands.push('stat', file);
+    });
+    readImage(reader, imageFile, commands, function (error, results) {
+      if (error) return done(error);
+
+      results.should.have.length(files.length);
+      files.forEach(function (file, i) {
+        var stats = fs.statSync(path.join(dir, path.relative('/contract', file)));
+        results[i].result.should.eql(0);
+        results[i].mode.should.eql(stats.mode);
+        results[i].size.should.eql(stats.isFile() ? stats.size : 0);
+        results[i].mtime.should.eql(stats.mtime.getTime());
+      });
+      done();
+    });
+  });
+
+  it('should list directories in order, without symlinks', function(done) {
+    readImage(reader, imageFile, ['readdir', '/contract',
+                                  'readdir', '/contract/sub',
+                                  'readdir', '/contract/a.js'],
+              function (error, results) {
+      if (error) return done(error);
+
+      results[0].names.should.eql(['a.js', 'empty', 'sub']);
+      results[1].names.should.eql(['big.bin']);
+      results[2].code.should.eql('ENOTDIR');
+      done();
+    });
+  });
+
+  it('should read back the contents of files', function(done) {
+    readImage(reader, imageFile, ['cat', '/contract/a.js',
+                                  'cat', '/contract/empty',
+                                  'cat', '/contract/sub/big.bin'],
+              function (error, results) {
+      if (error) return done(error);
+
+      new Buffer(results[0].data, 'hex').toString().should.eql('console.log(1);\n');
+      results[1].data.should.eql('');
+      results[2].data.should.eql(bigData.toString('hex'));
+      done();
+    });
+  });
+
+  it('should run a read batch and name the call that failed', function(done) {
+    readImage(reader, imageFile, ['readfile', '/contract/a.js',
+                                  'readfile', '/contract/missing.js',
+                                  'readfile', '/contract/sub'],
+              function (error, results) {
+      if (error) return done(error);
+
+      new Buffer(results[0].data, 'hex').toString().should.eql('console.log(1);\n');
+      results[1].code.should.eql('ENOENT');
+      results[1].method.should.eql(0x0101);  // open
+      results[2].code.should.eql('EISDIR');
+      results[2].method.should.eql(0x0103);  // read
+      done();
+    });
+  });
+
+  it('should answer for missing paths under the root only', function(done) {
+    readImage(reader, imageFile, ['stat', '/contract/missing.js',
+                                  'stat', '/contract/link',
+                                  'stat', '/elsewhere/a.js'],
+              function (error, results) {
+      if (error) return done(error);
+
+      results[0].code.should.eql('ENOENT');
+      results[1].code.should.eql('ENOENT');
+      results[2].should.eql({ host: 1 });
+      done();
+    });
+  });
+});
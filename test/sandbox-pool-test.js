@@ -0,0 +1,138 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var EventEmitter = require('events').EventEmitter;
+var Sandbox = require('../sandbox');
+
+// Stands in for a parked sandbox process.
+function FakeChild() {
+  EventEmitter.call(this);
+  this.killed = null;
+}
+require('util').inherits(FakeChild, EventEmitter);
+
+FakeChild.prototype.kill = function (signal) {
+  this.killed = signal;
+};
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('Sandbox pool', function() {
+  var realSpawn, spawned, pool;
+
+  beforeEach(function() {
+    realSpawn = Sandbox.prototype.spawnChildToRunCode;
+    spawned = [];
+    Sandbox.prototype.spawnChildToRunCode = function (code, disableNaCl) {
+      var child = new FakeChild();
+      child.code = code;
+      spawned.push(child);
+      return child;
+    };
+  });
+
+  afterEach(function() {
+    if (pool) {
+      pool.close();
+      pool = null;
+    }
+    Sandbox.prototype.spawnChildToRunCode = realSpawn;
+  });
+
+  it('should park sandboxes without a contract up to its size', function() {
+    pool = new Sandbox.Pool({ size: 3, disableNaCl: true });
+
+    spawned.should.have.length(3);
+    spawned.forEach(function (child) {
+      should.not.exist(child.code);
+    });
+  });
+
+  it('should hand out parked sandboxes in the order they were started', function() {
+    pool = new Sandbox.Pool({ size: 2, disableNaCl: true });
+
+    pool.take(new Sandbox({ disableNaCl: true })).should.equal(spawned[0]);
+    pool.take(new Sandbox({ disableNaCl: true })).should.equal(spawned[1]);
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true })));
+  });
+
+  it('should not hand out sandboxes started differently', function() {
+    pool = new Sandbox.Pool({ size: 1, disableNaCl: true, image: 'a.img' });
+
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true })));
+    should.not.exist(pool.take(new Sandbox({ image: 'a.img' })));
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true,
+                                             image: 'b.img' })));
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true,
+                                             image: 'a.img',
+                                             enableValgrind: true })));
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true,
+                                             image: 'a.img',
+                                             sharedMemory: true })));
+    // The same options, however they are spelled.
+    pool.take(new Sandbox({ disableNaCl: '1',
+                            image: './a.img' })).should.equal(spawned[0]);
+  });
+
+  it('should start a replacement after a sandbox is taken', function(done) {
+    pool = new Sandbox.Pool({ size: 2, disableNaCl: true });
+
+    pool.take(new Sandbox({ disableNaCl: true }));
+    pool.take(new Sandbox({ disableNaCl: true }));
+    spawned.should.have.length(2);
+
+    // Both are replaced together, off the caller's stack.
+    setImmediate(function () {
+      spawned.should.have.length(4);
+      pool.take(new Sandbox({ disableNaCl: true })).should.equal(spawned[2]);
+      done();
+    });
+  });
+
+  it('should replace a sandbox that exits while parked', function(done) {
+    pool = new Sandbox.Pool({ size: 2, disableNaCl: true });
+
+    spawned[0].emit('exit', 1);
+    pool.take(new Sandbox({ disableNaCl: true })).should.equal(spawned[1]);
+
+    setImmediate(function () {
+      spawned.should.have.length(4);
+      pool.take(new Sandbox({ disableNaCl: true })).should.equal(spawned[2]);
+      done();
+    });
+  });
+
+  it('should replace sandboxes parked longer than maxAge', function(done) {
+    pool = new Sandbox.Pool({ size: 1, maxAge: 10, disableNaCl: true });
+
+    setTimeout(function () {
+      spawned[0].killed.should.eql('SIGKILL');
+      spawned.length.should.be.above(1);
+      pool.take(new Sandbox({ disableNaCl: true }))
+        .should.equal(spawned[spawned.length - 1]);
+      done();
+    }, 50);
+  });
+
+  it('should kill parked sandboxes on close and not start more', function(done) {
+    pool = new Sandbox.Pool({ size: 2, disableNaCl: true });
+    var taken = pool.take(new Sandbox({ disableNaCl: true }));
+
+    pool.close();
+
+    should.not.exist(taken.killed);
+    spawned[1].killed.should.eql('SIGKILL');
+    should.not.exist(pool.take(new Sandbox({ disableNaCl: true })));
+
+    // Neither the pending refill nor the exit of a killed sandbox starts one.
+    spawned[1].emit('exit', null, 'SIGKILL');
+    setImmediate(function () {
+      spawned.should.have.length(2);
+      done();
+    });
+  });
+});
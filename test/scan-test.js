@@ -0,0 +1,101 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var fs      = require('fs');
+var os      = require('os');
+var path    = require('path');
+var PassthroughApi = require('../lib/api/passthrough').PassthroughApi;
+
+// Values per entry: relative path, complete, then the 14 stat values.
+var ENTRY_SIZE = 2 + 14;
+
+function entries(values) {
+  var result = {};
+  for (var i = 0; i < values.length; i += ENTRY_SIZE) {
+    result[values[i]] = {
+      order: i / ENTRY_SIZE,
+      complete: values[i + 1],
+      mode: values[i + 3],
+      size: values[i + 10]
+    };
+  }
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('fs scan', function() {
+  var api, tmp;
+
+  before(function() {
+    tmp = path.join(os.tmpdir(), 'codius-scan-test-' + process.pid);
+    fs.mkdirSync(tmp);
+    fs.mkdirSync(path.join(tmp, 'lib'));
+    fs.mkdirSync(path.join(tmp, 'lib', 'sub'));
+    fs.writeFileSync(path.join(tmp, 'b.js'), 'b');
+    fs.writeFileSync(path.join(tmp, 'lib', 'a.js'), 'aaa');
+    fs.symlinkSync(path.join(tmp, 'lib'), path.join(tmp, 'linked'));
+    fs.symlinkSync(path.join(tmp, 'missing'), path.join(tmp, 'dangling'));
+
+    // The scan only needs the API's methods, not a running sandbox.
+    api = Object.create(PassthroughApi.prototype);
+  });
+
+  after(function() {
+    fs.unlinkSync(path.join(tmp, 'dangling'));
+    fs.unlinkSync(path.join(tmp, 'linked'));
+    fs.unlinkSync(path.join(tmp, 'lib', 'a.js'));
+    fs.rmdirSync(path.join(tmp, 'lib', 'sub'));
+    fs.rmdirSync(path.join(tmp, 'lib'));
+    fs.unlinkSync(path.join(tmp, 'b.js'));
+    fs.rmdirSync(tmp);
+  });
+
+  it('should list the tree depth first in name order', function(done) {
+    api.scan(tmp, function (error, values) {
+      should.not.exist(error);
+
+      values.length.should.eql(6 * ENTRY_SIZE);
+      Object.keys(entries(values)).should.eql(['', 'b.js', 'lib', 'lib/a.js',
+                                               'lib/sub', 'linked']);
+      done();
+    });
+  });
+
+  it('should stat entries like fs.stat', function(done) {
+    api.scan(tmp, function (error, values) {
+      var result = entries(values);
+
+      result['lib/a.js'].size.should.eql(3);
+      result['lib/a.js'].mode.should.eql(fs.statSync(path.join(tmp, 'lib', 'a.js')).mode);
+      // Symlinks are followed for their stats.
+      result['linked'].mode.should.eql(fs.statSync(path.join(tmp, 'lib')).mode);
+      done();
+    });
+  });
+
+  it('should mark the directories it descended into as complete', function(done) {
+    api.scan(tmp, function (error, values) {
+      var result = entries(values);
+
+      result[''].complete.should.eql(1);
+      result['lib'].complete.should.eql(1);
+      result['lib/sub'].complete.should.eql(1);
+      result['b.js'].complete.should.eql(0);
+      // Symlinked directories are left for the sandbox to ask about.
+      result['linked'].complete.should.eql(0);
+      done();
+    });
+  });
+
+  it('should fail for a missing directory', function(done) {
+    api.scan(path.join(tmp, 'missing'), function (error) {
+      error.code.should.eql('ENOENT');
+      done();
+    });
+  });
+});
@@ -0,0 +1,135 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var fs      = require('fs');
+var os      = require('os');
+var path    = require('path');
+var spawn   = require('child_process').spawn;
+var execFile = require('child_process').execFile;
+var shm     = require('../lib/binary/shm_channel');
+
+var UTIL_DIR = path.resolve(__dirname, '../deps/codius-util');
+
+// Small enough for messages to wrap around and fill the rings.
+var RING_SIZE = 1024;
+var SIZES = ['0', '1', '100', '1023', '1024', '4096', '10000'];
+
+// Run test/fixtures/ring-peer.c against a host that echoes all it gets,
+// through the shared memory transport if useShm is set.
+function runPeer(peer, useShm, callback) {
+  var region = useShm ? shm.allocate(RING_SIZE) : null;
+  var stdio = ['ignore', 'pipe', 'inherit', 'pipe'];
+  var env = {};
+
+  if (region) {
+    stdio.push(region.fd);
+    env.CODIUS_SHM_FD = '4';
+  }
+
+  var child = spawn(peer, SIZES, { env: env, stdio: stdio });
+  var channel = child.stdio[3];
+  var doorbells = [];
+  var output = '';
+
+  if (region) {
+    // The channel owns the descriptor from here on.
+    channel = new shm.ShmChannel(region.fd, region.ringSize, child.stdio[3]);
+    child.stdio[3].on('data', function (data) {
+      doorbells.push(data);
+    });
+  }
+
+  channel.on('data', function (data) {
+    channel.write(data);
+  });
+  child.stdout.setEncoding('utf8');
+  child.stdout.on('data', function (data) {
+    output += data;
+  });
+  child.on('close', function (code) {
+    callback(null, code, output, Buffer.concat(doorbells));
+  });
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('Shared memory transport', function() {
+  var tmp, peer;
+
+  before(function(done) {
+    tmp = path.join(os.tmpdir(), 'codius-shm-test-' + process.pid);
+    peer = path.join(tmp, 'ring-peer');
+
+    fs.mkdirSync(tmp);
+    execFile('cc', [
+      '-D_GNU_SOURCE',
+      '-I' + path.join(UTIL_DIR, 'include'),
+      '-o', peer,
+      path.join(__dirname, 'fixtures', 'ring-peer.c')
+    ].concat(fs.readdirSync(path.join(UTIL_DIR, 'src')).filter(function (name) {
+      return /\.c$/.test(name);
+    }).map(function (name) {
+      return path.join(UTIL_DIR, 'src', name);
+    })), function (error) {
+      done(error);
+    });
+  });
+
+  after(function() {
+    fs.unlinkSync(peer);
+    fs.rmdirSync(tmp);
+  });
+
+  it('should lay out the region for the sandbox', function() {
+    var region = shm.allocate(RING_SIZE);
+    var data = new Buffer(64 + 2 * (256 + RING_SIZE));
+    var size = fs.fstatSync(region.fd).size;
+
+    fs.readSync(region.fd, data, 0, data.length, 0);
+    fs.closeSync(region.fd);
+
+    size.should.eql(data.length);
+    data.readUInt32LE(0).should.eql(shm.SHM_MAGIC);
+    data.readUInt32LE(4).should.eql(RING_SIZE);
+    [64, 64 + 256 + RING_SIZE].forEach(function (ring) {
+      [0, 64, 128, 192].forEach(function (field) {
+        data.readUInt32LE(ring + field).should.eql(0);
+        data.readUInt32LE(ring + field + 4).should.eql(0xffffffff);
+      });
+    });
+  });
+
+  it('should refuse a ring size that is not a power of two', function() {
+    (function () {
+      shm.allocate(1000);
+    }).should.throw('Ring size must be a power of two: 1000');
+  });
+
+  it('should carry messages larger than the rings both ways', function(done) {
+    runPeer(peer, true, function (error, code, output, doorbells) {
+      if (error) return done(error);
+
+      output.should.eql('ok\n');
+      code.should.eql(0);
+      // fd 3 only carried wake-ups.
+      for (var i = 0; i < doorbells.length; i++) {
+        doorbells[i].should.eql(0);
+      }
+      done();
+    });
+  });
+
+  it('should fall back to fd 3 without a region', function(done) {
+    runPeer(peer, false, function (error, code, output) {
+      if (error) return done(error);
+
+      output.should.eql('ok\n');
+      code.should.eql(0);
+      done();
+    });
+  });
+});
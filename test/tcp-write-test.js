@@ -0,0 +1,155 @@
+//-----------------------------------------------------------------------------
+// Init
+//-----------------------------------------------------------------------------
+
+var should  = require('should');
+var fs      = require('fs');
+var os      = require('os');
+var net     = require('net');
+var path    = require('path');
+var PassThrough = require('stream').PassThrough;
+var spawn   = require('child_process').spawn;
+var execFile = require('child_process').execFile;
+var PassthroughApi = require('../lib/api/passthrough').PassthroughApi;
+var FakeSocket = require('../lib/mock/fake_socket').FakeSocket;
+
+var ROOT = path.resolve(__dirname, '..');
+var UV_EIO = -5;
+
+function sources(dir) {
+  return fs.readdirSync(dir).filter(function (name) {
+    return /\.c$/.test(name);
+  }).map(function (name) {
+    return path.join(dir, name);
+  });
+}
+
+// What test/fixtures/tcp-writer.c writes for write i.
+function pattern(size, i) {
+  var buffer = new Buffer(size);
+  for (var j = 0; j < size; j++) {
+    buffer[j] = (j * 7 + i) & 0xff;
+  }
+  return buffer;
+}
+
+// Run tcp-writer against the passthrough API with a server on the other end,
+// and answer with the write statuses and what the server received.
+function runWriter(writer, sizes, callback) {
+  var received = [];
+  var server = net.createServer(function (socket) {
+    socket.on('data', function (data) {
+      received.push(data);
+    });
+  });
+
+  server.listen(0, '127.0.0.1', function () {
+    var child = spawn(writer, [server.address().port].concat(sizes), {
+      stdio: ['ignore', 'pipe', 'inherit', 'pipe']
+    });
+    var output = '';
+
+    // The API only needs the channel of a sandbox.
+    new PassthroughApi({
+      stdio: [null, new PassThrough(), new PassThrough(), child.stdio[3]],
+      channel: child.stdio[3]
+    });
+
+    child.stdout.setEncoding('utf8');
+    child.stdout.on('data', function (data) {
+      output += data;
+    });
+    child.on('close', function (code) {
+      server.close();
+      if (code !== 0) {
+        return callback(new Error('tcp-writer exited with ' + code));
+      }
+      var statuses = [];
+      output.trim().split('\n').forEach(function (line) {
+        var result = JSON.parse(line);
+        statuses[result.write] = result.status;
+      });
+      callback(null, statuses, Buffer.concat(received));
+    });
+  });
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+
+describe('TCP writes', function() {
+  var tmp, writer, realWrite;
+
+  before(function(done) {
+    tmp = path.join(os.tmpdir(), 'codius-tcp-write-test-' + process.pid);
+    writer = path.join(tmp, 'tcp-writer');
+    realWrite = FakeSocket.prototype.write;
+
+    fs.mkdirSync(tmp);
+    execFile('cc', [
+      '-D_GNU_SOURCE',
+      '-I' + path.join(ROOT, 'deps/uv/include'),
+      '-I' + path.join(ROOT, 'deps/uv/src'),
+      '-I' + path.join(ROOT, 'deps/codius-util/include'),
+      '-o', writer,
+      path.join(__dirname, 'fixtures', 'tcp-writer.c')
+    ].concat(sources(path.join(ROOT, 'deps/uv/src')),
+             sources(path.join(ROOT, 'deps/codius-util/src'))),
+    function (error) {
+      done(error);
+    });
+  });
+
+  after(function() {
+    fs.unlinkSync(writer);
+    fs.rmdirSync(tmp);
+  });
+
+  afterEach(function() {
+    FakeSocket.prototype.write = realWrite;
+  });
+
+  it('should deliver pipelined writes in order', function(done) {
+    // Too large to share a batch, so several are with the host at once.
+    var sizes = [40000, 40000, 1, 40000];
+
+    runWriter(writer, sizes, function (error, statuses, received) {
+      if (error) return done(error);
+
+      statuses.should.eql([0, 0, 0, 0]);
+      received.toString('hex').should.eql(Buffer.concat(sizes.map(pattern))
+                                           .toString('hex'));
+      done();
+    });
+  });
+
+  it('should fail a short write instead of resending its tail', function(done) {
+    var sizes = [40000, 40000, 40000];
+    var calls = 0;
+
+    // The host socket takes only half of the first write.
+    FakeSocket.prototype.write = function (data, callback) {
+      if (calls++ === 0) {
+        var half = data.length >> 1;
+        return realWrite.call(this, data.slice(0, half), function (error) {
+          callback(error, half);
+        });
+      }
+      realWrite.call(this, data, callback);
+    };
+
+    runWriter(writer, sizes, function (error, statuses, received) {
+      if (error) return done(error);
+
+      statuses.should.eql([UV_EIO, 0, 0]);
+      // Nothing of the first write comes after the ones behind it.
+      received.toString('hex').should.eql(Buffer.concat([
+        pattern(sizes[0], 0).slice(0, sizes[0] >> 1),
+        pattern(sizes[1], 1),
+        pattern(sizes[2], 2)
+      ]).toString('hex'));
+      done();
+    });
+  });
+});
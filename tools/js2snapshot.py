@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2014 Ripple Labs Inc.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to permit
+# persons to whom the Software is furnished to do so, subject to the
+# following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+# NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+# OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+# USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+# Generates the script that V8's mksnapshot runs (--extra-code) when it
+# builds the startup snapshot. The script compiles node's JavaScript natives,
+# preprocessed exactly like tools/js2c.py does for node_natives.h, and leaves
+# the resulting functions on the global object as __codius_natives. Every
+# context deserialized from the snapshot then starts with the natives already
+# parsed; src/js/node.js picks them up instead of compiling the sources, and
+# ContextifyContext strips them from contexts made by the vm module.
+#
+# Usage: js2snapshot.py <output.js> <macros.py|file.js|node.gyp> ...
+#
+# A .gyp argument stands for the 'library_files' listed in it.
+
+import json
+import os
+import sys
+
+import js2c
+
+# Must match NativeModule.wrapper in src/js/node.js.
+MODULE_WRAPPER = ('(function (exports, require, module, __filename, '
+                  '__dirname) { ', '\n});')
+
+SNAPSHOT_TEMPLATE = """\
+// Generated by tools/js2snapshot.py. Do not edit.
+(function(global) {
+  var natives = {};
+  var compile = eval;
+
+%(native_lines)s
+  Object.defineProperty(global, '__codius_natives', {
+    value: natives,
+    configurable: true,
+    enumerable: false,
+    writable: false
+  });
+})(this);
+"""
+
+NATIVE_DECLARATION = """\
+  natives[%(id)s] = compile(%(source)s);
+"""
+
+
+def LibraryFiles(gyp_file):
+  # gyp files are Python literals; paths in them are relative to the file.
+  gyp = eval(js2c.ReadFile(gyp_file), { '__builtins__': None }, {})
+  base = os.path.dirname(gyp_file)
+  return [os.path.join(base, f) for f in gyp['variables']['library_files']]
+
+
+def JS2Snapshot(source, target):
+  modules = []
+  macro_lines = []
+
+  for s in source:
+    if s.endswith('macros.py'):
+      macro_lines.extend(js2c.ReadLines(s))
+    elif s.endswith('.gyp'):
+      modules.extend(LibraryFiles(s))
+    elif s.endswith('.js'):
+      modules.append(s)
+
+  (consts, macros) = js2c.ReadMacros(macro_lines)
+
+  native_lines = []
+  for s in modules:
+    lines = js2c.ReadFile(s)
+    do_jsmin = lines.find('// jsminify this file, js2c: jsmin') != -1
+
+    lines = js2c.ExpandConstants(lines, consts)
+    lines = js2c.ExpandMacros(lines, macros)
+    lines = js2c.CompressScript(lines, do_jsmin)
+
+    id = os.path.basename(s).split('.')[0]
+    # node.js is the bootstrap function itself, everything else is a module.
+    if id != 'node':
+      lines = MODULE_WRAPPER[0] + lines + MODULE_WRAPPER[1]
+    # Name the script like the runtime does so stack traces stay the same.
+    lines += '\n//# sourceURL=%s.js' % id
+
+    native_lines.append(NATIVE_DECLARATION % {
+      'id': json.dumps(id),
+      'source': json.dumps(lines)
+    })
+
+  output = open(target, "w")
+  output.write(SNAPSHOT_TEMPLATE % {
+    'native_lines': "".join(native_lines)
+  })
+  output.close()
+
+
+def main():
+  JS2Snapshot(sys.argv[2:], sys.argv[1])
+
+if __name__ == "__main__":
+  main()